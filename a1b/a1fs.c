@@ -17,16 +17,19 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/xattr.h>
 
 // Using 2.9.x FUSE API
 #define FUSE_USE_VERSION 29
 #include <fuse.h>
 
 #include "a1fs.h"
+#include "bitmap.h"
 #include "fs_ctx.h"
 #include "options.h"
 #include "map.h"
@@ -61,12 +64,15 @@ static bool a1fs_init(fs_ctx *fs, a1fs_opts *opts)
 	if (opts->help || opts->version) return true;
 
 	size_t size;
-	void *image = map_file(opts->img_path, A1FS_BLOCK_SIZE, &size);
+	void *image = map_file(opts->img_path, A1FS_BLOCK_SIZE, &size, opts->hugepages);
 	if (!image) return false;
 
 	return fs_ctx_init(fs, image, size, opts);
 }
 
+static void flush_all_delalloc(fs_ctx *fs);
+bool reap_inodes(fs_ctx *fs);
+
 /**
  * Cleanup the file system.
  *
@@ -77,9 +83,16 @@ static void a1fs_destroy(void *ctx)
 {
 	fs_ctx *fs = (fs_ctx*)ctx;
 	if (fs->image) {
+		reap_inodes(fs);
+		flush_all_delalloc(fs);
 		if (fs->opts->sync && (msync(fs->image, fs->size, MS_SYNC) < 0)) {
 			perror("msync");
 		}
+		if (fs->opts->verbose) {
+			groups_report(&fs->groups, stderr);
+			fprintf(stderr, "delalloc: %lu flushes, %lu blocks\n",
+			        (unsigned long)fs->delalloc.flushes, (unsigned long)fs->delalloc.blocks);
+		}
 		munmap(fs->image, fs->size);
 		fs_ctx_destroy(fs);
 	}
@@ -100,358 +113,426 @@ uint32_t ceil_divide(uint32_t x, uint32_t y) {
 }
 
 
-// Turn on the i-th bit in bitmap
-void setBitOn(uint32_t *bm, uint32_t i) {
-	uint32_t int_bits = sizeof(uint32_t) * 8;
-	bm[i/int_bits] |= 1 << (i%int_bits);
+// Return the inode number of an inode in the inode table
+a1fs_ino_t get_ino_num(a1fs_inode *inode) {
+	fs_ctx *fs = get_fs();
+	a1fs_superblock *sb = (a1fs_superblock *)fs->image;
+	char *inode_table = (char *)fs->image + A1FS_BLOCK_SIZE * sb->bg_inode_table;
+	return (a1fs_ino_t)(((char *)inode - inode_table) / fs->inode_size) + 1;
 }
 
-// Turn off the i-th bit in bitmap
-void setBitOff(uint32_t *bm, uint32_t i) {
-	uint32_t int_bits = sizeof(uint32_t) * 8;
-	bm[i/int_bits] &= ~(1 << (i%int_bits));
+// Get an inode in the inode table by its number
+a1fs_inode *get_inode(a1fs_ino_t ino) {
+	fs_ctx *fs = get_fs();
+	a1fs_superblock *sb = (a1fs_superblock *)fs->image;
+	char *inode_table = (char *)fs->image + A1FS_BLOCK_SIZE * sb->bg_inode_table;
+	return (a1fs_inode *)(inode_table + (uint64_t)fs->inode_size * (ino - 1));
 }
 
-// Check whether the  i-th bit in bitmap is off
-bool is_bit_off(uint32_t *bm, uint32_t i) {
-	uint32_t int_bits = sizeof(uint32_t) * 8;
-	return ( (bm[i/int_bits] & (1 << (i%int_bits))) == 0 );
+/**
+ * A leaf of the extent table of a file: an array of extent slots in logical
+ * order.
+ *
+ * A file without an extent tree has a single leaf: its extent block, or the
+ * extent slots in the inode itself (A1FS_INODE_INLINE_EXTENTS). With an
+ * extent tree (A1FS_INODE_EXTENT_TREE) the leaf is reached through the index
+ * nodes on its path from the root, which find_leaf() records so that the
+ * leaf can be split, or the next leaf found, without searching again.
+ */
+typedef struct extent_leaf {
+	/** The extent slots. */
+	a1fs_extent *extents;
+	/** Number of slots in use. */
+	uint32_t nslots;
+	/** Block number of the leaf; 0 for the inode's inline extents. */
+	a1fs_blk_t block;
+	/** Logical block at which the first slot starts. */
+	uint64_t first;
+	/** Number of index nodes on the path; 0 without an extent tree. */
+	uint32_t depth;
+	/** Index nodes on the path, starting with the root. */
+	a1fs_extent_node *nodes[A1FS_EXTENT_MAX_LEVELS + 1];
+	/** Entry taken in each node on the path. */
+	uint32_t index[A1FS_EXTENT_MAX_LEVELS + 1];
+} extent_leaf;
+
+// Get an extent tree node by its block number
+static a1fs_extent_node *extent_node(a1fs_blk_t block)
+{
+	return (a1fs_extent_node *)(get_fs()->image + (uint64_t)A1FS_BLOCK_SIZE * block);
 }
 
-
-// Helper function to seek a byte in the file represented by inode with offset,
-// return the pointer to the byte, or NULL if offset is beyond EOF
-void *seekbyte(a1fs_inode *inode, off_t offset) {
-	uint64_t implicit_file_size = inode->size;
-	if (S_ISDIR(inode->mode)) {
-		implicit_file_size = sizeof(a1fs_dentry) * inode->dentry_count;
-	}
-	if ((uint64_t)offset > implicit_file_size) {return NULL;}
-
-	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-
-	a1fs_blk_t blocks_to_skip = offset / A1FS_BLOCK_SIZE;
-	a1fs_extent *curr_extent;
-	// block number of the remaining bytes
-	a1fs_blk_t last_block;
-	a1fs_blk_t blockcount;
-	// Traverse through the extents
-	for (int i = 0; i < inode->extentcount; i++) {
-		curr_extent = (a1fs_extent *)(image + A1FS_BLOCK_SIZE * inode->extentblock + sizeof(a1fs_extent) * i);
-		blockcount = curr_extent->count;
-		if (blockcount > 0) {
-			last_block = curr_extent->start;
-			while (blockcount > 0) {
-				if (blocks_to_skip == 0) {break;}
-				last_block++;
-				blockcount--;
-			}
-			if (blocks_to_skip == 0) {break;}
-		}
-	}
-	// We have strictly less than 4096 bytes to traverse, so just visit the block using pointer arithmetic
-	int remaining_bytes = offset % A1FS_BLOCK_SIZE;
-	void *target_byte = (void *)(image + A1FS_BLOCK_SIZE * last_block + remaining_bytes);
-	return target_byte;
+// Point a leaf at the child of the last node on its path
+static void leaf_from_path(extent_leaf *leaf)
+{
+	a1fs_extent_idx *entry = &leaf->nodes[leaf->depth - 1]->entries[leaf->index[leaf->depth - 1]];
+	leaf->block = entry->block;
+	leaf->first = entry->lblk;
+	leaf->nslots = entry->count;
+	leaf->extents = (a1fs_extent *)extent_node(entry->block);
 }
 
-
 /**
- * Get inode number by absolute path.
- * 
- * Errors:
- *   ENAMETOOLONG  the path or one of its components is too long.
- *   ENOENT        a component of the path does not exist.
- *   ENOTDIR       a component of the path prefix is not a directory.
- * 
- * @param path  path to any file in the file syste.
- * @return      inode number represented by the path on success; -errno on error;
+ * Find the leaf of a file's extent table that maps a logical block.
+ *
+ * In an extent tree the leaf is found with a binary search at each level. The
+ * file must have an extent table (extentcount != 0), though it may be empty.
+ *
+ * @param inode  the file (or directory) inode.
+ * @param lblk   logical block number.
+ * @param leaf   pointer to the leaf that receives the result; the last leaf
+ *               if lblk is past the end of the file.
  */
-long get_ino_num_by_path(const char *path) {
-	
-	if (strlen(path) >= A1FS_PATH_MAX) {
-		printf("ENAMETOOLONG\n");
-		return -ENAMETOOLONG;
+static void find_leaf(a1fs_inode *inode, uint64_t lblk, extent_leaf *leaf)
+{
+	leaf->depth = 0;
+	if (inode->flags & A1FS_INODE_INLINE_EXTENTS) {
+		leaf->block = 0;
+		leaf->first = 0;
+		leaf->nslots = inode->extentcount;
+		leaf->extents = a1fs_inode_extents(inode);
+		return;
 	}
-
-	printf("The path length is %ld\n", strlen(path));
-	printf("The path is:%s\n", path);
-
-	// path is just "/"
-	if (strcmp(path, "/") == 0) {
-		// Root inode number is 1
-		return 1;
+	if (!(inode->flags & A1FS_INODE_EXTENT_TREE)) {
+		leaf->block = inode->extentblock;
+		leaf->first = 0;
+		leaf->nslots = inode->extentcount;
+		leaf->extents = (a1fs_extent *)extent_node(inode->extentblock);
+		return;
 	}
-
-	// Continuing from here, path = "/..."
-
-	// get the address to the beginning of file system
-	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *)image;
-
-	// Start with the Root inode
-	a1fs_ino_t  curr_ino_t = 1;
-	a1fs_inode  *curr_inode;
-	uint64_t    dentry_count;
-	int        foundPathCompo;
-	a1fs_dentry *curr_dentry;
-
-	// Make of a copy to the path, since strtok is destructive
-	char cpy_path[strlen(path) + 1];
-	strcpy(cpy_path, path);
-	char delim[] = "/";
-	char *pathComponent = pathComponent = strtok(cpy_path, delim);
-	// Using do-while loop since curr_inode would be root inode initially, thus
-	// iterating at least once.
-	do {
-		curr_inode = (a1fs_inode *) (image + A1FS_BLOCK_SIZE*(sb->bg_inode_table) + sizeof(a1fs_inode)*(curr_ino_t - 1));
-		// If the path prefix is not a dir
-		if ((curr_inode->mode & __S_IFDIR) <= 0) {
-				printf("ENOTDIR\n");
-				return -ENOTDIR;
-		}
-		// The inode is a directory inode, but did not allocate any directory entry
-		dentry_count = curr_inode->dentry_count;
-		if (dentry_count == 0) {
-			return -ENOENT;
-		}
-
-		// Search in the current inode 's directory entries to find the next path component
-		foundPathCompo = 0;
-		for (uint64_t i = 0; i < dentry_count; i++) {
-			curr_dentry = (a1fs_dentry *)(seekbyte(curr_inode, sizeof(a1fs_dentry) * i));
-			if (strcmp(curr_dentry->name, pathComponent) == 0) {
-				foundPathCompo = 1;
-				curr_ino_t = curr_dentry->ino;
-				break;
+	a1fs_extent_node *node = extent_node(inode->extentblock);
+	for (;;) {
+		// Find the last entry that starts at or before lblk
+		uint32_t lo = 0, hi = node->count;
+		while (hi - lo > 1) {
+			uint32_t mid = lo + (hi - lo) / 2;
+			if (node->entries[mid].lblk <= lblk) {
+				lo = mid;
+			} else {
+				hi = mid;
 			}
 		}
-		if (!foundPathCompo) {
-			printf("Path is --%s--\n", path);
-			printf("Path %d \"/\"\n", strcmp(path, "/"));
-			printf("PathCompo is %s\n", pathComponent);
-			printf("dentry_count is %ld\n", dentry_count);
-			printf("ENOENT\n");
-			return -ENOENT;
-		}
-
-		pathComponent = strtok(NULL, delim);
-		
-	} while (pathComponent != NULL);
-
-	return (long) curr_ino_t;
+		leaf->nodes[leaf->depth] = node;
+		leaf->index[leaf->depth] = lo;
+		leaf->depth++;
+		if ((node->levels == 0) || (leaf->depth > A1FS_EXTENT_MAX_LEVELS)) {break;}
+		node = extent_node(node->entries[lo].block);
+	}
+	leaf_from_path(leaf);
 }
 
-// Return the parent directory's inode number
-long get_parent_dir_ino_num_by_path(const char *path) {
+// Move to the next leaf of an extent tree; false if this is the last one
+static bool next_leaf(extent_leaf *leaf)
+{
+	int d = (int)leaf->depth - 1;
+	while ((d >= 0) && (leaf->index[d] + 1 >= leaf->nodes[d]->count)) {d--;}
+	if (d < 0) {return false;}
+	leaf->index[d]++;
+	for (d++; d < (int)leaf->depth; d++) {
+		a1fs_extent_node *parent = leaf->nodes[d - 1];
+		leaf->nodes[d] = extent_node(parent->entries[leaf->index[d - 1]].block);
+		leaf->index[d] = 0;
+	}
+	leaf_from_path(leaf);
+	return true;
+}
 
-	// cut the last component which is the directory name we want to create
-	char parent_path[strlen(path) + 1];
-	strcpy(parent_path, path);
-	char *ptr = strrchr(parent_path, '/');
-	if (ptr != parent_path){
-		ptr[0] = '\0';
+// Set the number of slots in use in a leaf
+static void leaf_set_count(a1fs_inode *inode, extent_leaf *leaf, uint32_t nslots)
+{
+	leaf->nslots = nslots;
+	if (leaf->depth == 0) {
+		inode->extentcount = nslots;
 	} else {
-		ptr[1] = '\0';
+		leaf->nodes[leaf->depth - 1]->entries[leaf->index[leaf->depth - 1]].count = nslots;
 	}
+}
 
-	return (long) get_ino_num_by_path(parent_path);
+// Return the number of logical blocks mapped by a leaf
+static uint64_t leaf_nblocks(a1fs_inode *inode, const extent_leaf *leaf)
+{
+	uint64_t total = 0;
+	if (emap_nblocks(&get_fs()->emaps, get_ino_num(inode), leaf->block,
+	                 leaf->extents, leaf->nslots, &total)) {return total;}
+	for (uint32_t i = 0; i < leaf->nslots; i++) {
+		total += a1fs_extent_len(&leaf->extents[i]);
+	}
+	return total;
 }
 
 /**
- * Get file system statistics.
- *
- * Implements the statvfs() system call. See "man 2 statvfs" for details.
- * The f_bfree and f_bavail fields should be set to the same value.
- * The f_ffree and f_favail fields should be set to the same value.
- * The f_fsid and f_flag fields are ignored.
+ * Position within the data of a file or directory.
  *
- * @param path  path to any file in the file system. Can be ignored.
- * @param st    pointer to the struct statvfs that receives the result.
- * @return      0 on success; -errno on error.
+ * A cursor is resolved from a byte offset once with seek_cursor() and then
+ * moved forward run by run with cursor_advance(), so sequential access never
+ * has to rescan the extent table from the first extent.
  */
+typedef struct extent_cursor {
+	/** The current leaf of the inode's extent table. */
+	extent_leaf leaf;
+	/** Current extent slot in the leaf. */
+	uint32_t slot;
+	/** Block index within the current extent. */
+	a1fs_blk_t block;
+	/** Byte offset within the current block. */
+	uint32_t offset;
+} extent_cursor;
 
-static int a1fs_statfs(const char *path, struct statvfs *st)
+/**
+ * Resolve a byte offset within the file to an extent cursor.
+ *
+ * Empty extent slots (count == 0) are skipped. The extent is located with a
+ * binary search in the leaf's cached extent map, after a binary search at each
+ * level of the extent tree if the file has one, so the cost does not grow with
+ * the offset or the file size.
+ *
+ * @param inode   the file (or directory) inode.
+ * @param offset  byte offset from the beginning of the file.
+ * @param cur     pointer to the cursor that receives the result.
+ * @return        true on success; false if offset is not backed by an extent.
+ */
+bool seek_cursor(a1fs_inode *inode, uint64_t offset, extent_cursor *cur)
 {
-	(void)path;// unused
+	if (inode->extentcount == 0) {return false;}
 	fs_ctx *fs = get_fs();
+	uint64_t lblk = offset / A1FS_BLOCK_SIZE;
+	extent_leaf *leaf = &cur->leaf;
+	find_leaf(inode, lblk, leaf);
+	if (lblk < leaf->first) {return false;}
+
+	uint64_t blocks_to_skip = lblk - leaf->first;
+	uint64_t first;
+	int found = emap_lookup(&fs->emaps, get_ino_num(inode), leaf->block,
+	                        leaf->extents, leaf->nslots, blocks_to_skip, &cur->slot, &first);
+	if (found >= 0) {
+		if (found == 0) {return false;}
+		cur->block = (a1fs_blk_t)(blocks_to_skip - first);
+		cur->offset = offset % A1FS_BLOCK_SIZE;
+		return true;
+	}
 
-	memset(st, 0, sizeof(*st));
-	st->f_bsize   = A1FS_BLOCK_SIZE;
-	st->f_frsize  = A1FS_BLOCK_SIZE;
-	a1fs_superblock *sb = fs->image;
-	st->f_blocks = sb->size / A1FS_BLOCK_SIZE;
-	st->f_bfree = sb->s_free_blocks_count;
-	st->f_files = sb->s_inodes_count;
-	st->f_ffree = sb->s_free_inodes_count;
-	st->f_namemax = A1FS_NAME_MAX;
-
-	return 0;
+	// Out of memory for the map, fall back to walking the leaf
+	for (uint32_t i = 0; i < leaf->nslots; i++) {
+		a1fs_blk_t count = a1fs_extent_len(&leaf->extents[i]);
+		if (blocks_to_skip < count) {
+			cur->slot = i;
+			cur->block = (a1fs_blk_t)blocks_to_skip;
+			cur->offset = offset % A1FS_BLOCK_SIZE;
+			return true;
+		}
+		blocks_to_skip -= count;
+	}
+	return false;
 }
 
 /**
- * Get file or directory attributes.
- *
- * Implements the stat() system call. See "man 2 stat" for details.
- * The st_dev, st_blksize, and st_ino fields are ignored.
+ * Get the contiguous run of bytes from the cursor to the end of its extent.
  *
- * NOTE: the st_blocks field is measured in 512-byte units (disk sectors).
+ * @param cur  the cursor.
+ * @param run  pointer to the variable that receives the start of the run;
+ *             NULL if the extent is a hole.
+ * @return     length of the run in bytes; 0 if the cursor is past the last extent.
+ */
+size_t cursor_run(const extent_cursor *cur, char **run)
+{
+	if (cur->slot >= cur->leaf.nslots) {return 0;}
+	a1fs_extent *ext = &cur->leaf.extents[cur->slot];
+	if (a1fs_extent_hole(ext)) {
+		*run = NULL;
+	} else {
+		*run = (char *)get_fs()->image + (uint64_t)A1FS_BLOCK_SIZE * (ext->start + cur->block) + cur->offset;
+	}
+	return (uint64_t)A1FS_BLOCK_SIZE * (a1fs_extent_len(ext) - cur->block) - cur->offset;
+}
+
+// Check if the cursor is in a hole or an unwritten extent, whose data must
+// read as zeros
+bool cursor_zeroed(const extent_cursor *cur)
+{
+	if (cur->slot >= cur->leaf.nslots) {return false;}
+	const a1fs_extent *ext = &cur->leaf.extents[cur->slot];
+	return a1fs_extent_hole(ext) || a1fs_extent_unwritten(ext);
+}
+
+/**
+ * Move the cursor forward within its current run.
  *
- * Errors:
- *   ENAMETOOLONG  the path or one of its components is too long.
- *   ENOENT        a component of the path does not exist.
- *   ENOTDIR       a component of the path prefix is not a directory.
+ * Moving to the end of the run positions the cursor at the start of the next
+ * non-empty extent, in the next leaf if needed.
  *
- * @param path  path to a file or directory.
- * @param st    pointer to the struct stat that receives the result.
- * @return      0 on success; -errno on error;
+ * @param cur  the cursor.
+ * @param len  number of bytes to move; must not exceed the current run length.
  */
-static int a1fs_getattr(const char *path, struct stat *st)
+void cursor_advance(extent_cursor *cur, size_t len)
 {
-	memset(st, 0, sizeof(*st));
-	fs_ctx *fs = get_fs();
+	uint64_t pos = (uint64_t)cur->block * A1FS_BLOCK_SIZE + cur->offset + len;
+	cur->block = pos / A1FS_BLOCK_SIZE;
+	cur->offset = pos % A1FS_BLOCK_SIZE;
+	for (;;) {
+		while (cur->slot < cur->leaf.nslots && cur->block >= a1fs_extent_len(&cur->leaf.extents[cur->slot])) {
+			cur->slot++;
+			cur->block = 0;
+		}
+		if ((cur->slot < cur->leaf.nslots) || !next_leaf(&cur->leaf)) {break;}
+		cur->slot = 0;
+	}
+}
 
-	void *image = fs->image;
-	a1fs_superblock *sb = image;
-	printf("GETATTR Path passed is: %s\n", path);
 
-	long curr_ino_num = get_ino_num_by_path(path);
-	if (curr_ino_num < 0) {
-		fprintf(stderr, "get_attr ERRROR\n");
-		return curr_ino_num;
-	}
-	a1fs_ino_t curr_ino_t = (a1fs_ino_t) curr_ino_num;
+// Get the number of blocks a file is still expected to grow by, according to
+// its expected size hint; 0 if it has none or has reached it
+uint32_t hint_growth(const a1fs_inode *inode) {
+	if ((inode->hint_size_order == 0) || (inode->hint_size_order > A1FS_HINT_SIZE_ORDER_MAX)) { return 0; }
+	uint64_t expected = UINT64_C(1) << (inode->hint_size_order - 1);
+	uint64_t have = (inode->size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+	return (expected > have) ? (uint32_t)(expected - have) : 0;
+}
 
-	a1fs_inode *curr_inode = (a1fs_inode *)(image + A1FS_BLOCK_SIZE*(sb->bg_inode_table) + sizeof(a1fs_inode)*(curr_ino_t - 1));
-	st->st_mode = curr_inode->mode;
-	st->st_nlink = (nlink_t)(curr_inode->links);
-	blkcnt_t sectors_used = (blkcnt_t)(curr_inode->size / 512);
-	if (curr_inode->size % 512 != 0)
-		sectors_used++;
-	st->st_blocks = sectors_used;
-	st->st_mtime = curr_inode->mtime.tv_sec;
-	st->st_size = curr_inode->size;
-	return 0;
+// Get the number of free blocks to keep after a file's next run of data blocks
+// for it to grow into, according to its allocation hints: the rest of its
+// expected size, or the largest reservation window if it only wants to be
+// contiguous; at most a group
+uint32_t hint_room(const a1fs_inode *inode) {
+	fs_ctx *fs = get_fs();
+	uint32_t room = hint_growth(inode);
+	if ((room == 0) && (inode->hint_contig == A1FS_HINT_CONTIG_YES)) { room = A1FS_RSV_MAX_BLOCKS; }
+	return (room < fs->groups.blocks_per_group) ? room : fs->groups.blocks_per_group;
+}
 
+// Get the allocation group named by an inode's placement hint; -1 if none
+long hint_group(const a1fs_inode *inode) {
+	fs_ctx *fs = get_fs();
+	if ((inode->hint_group == 0) || (inode->hint_group > fs->groups.count)) { return -1; }
+	return inode->hint_group - 1;
+}
+
+// Get the alignment of a file's new extents in the image, in blocks: huge
+// pages for large regular files (or ones expected to become large) when
+// mounted with --hugepages, 1 otherwise
+uint32_t extent_align(a1fs_inode *inode) {
+	fs_ctx *fs = get_fs();
+	if (!S_ISREG(inode->mode)) { return 1; }
+	uint64_t size = inode->size + (uint64_t)hint_growth(inode) * A1FS_BLOCK_SIZE;
+	if (size < A1FS_HUGE_FILE_SIZE) { return 1; }
+	return fs->huge_align;
 }
 
 /**
- * Read a directory.
+ * Allocate a run of free data blocks and mark it in the data bitmap.
  *
- * Implements the readdir() system call. Should call filler() for each directory
- * entry. See fuse.h in libfuse source code for details.
+ * The run is the first one that holds all *len blocks from the inode's data
+ * goal on (see group_data_goal() and group_alloc_from()), so that the blocks
+ * of a directory and of the files in it end up together. A regular file that
+ * needs more than one block is put where it has room for a first reservation
+ * window (see rsv.h) to grow into, rather than in a short gap, and a large one
+ * starts at a huge page boundary if possible (see extent_align()).
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a directory.
+ * The allocation hints of the inode change this: the run is placed from the
+ * start of the hinted group if the inode is not in it, a file with an expected
+ * size (or that wants to be contiguous) is put where it has room for all of it
+ * if possible, and one that need not be contiguous takes the first gap that
+ * fits. If no group has a suitable run, it is taken as in group_alloc_blocks():
+ * the smallest free run that holds all *len blocks (best fit) or, if there is
+ * none and partial is true, a shorter run whose length is stored in *len.
  *
  * Errors:
- *   ENOMEM  not enough memory (e.g. a filler() call failed).
+ *   ENOSPC  no suitable free run.
  *
- * @param path    path to the directory.
- * @param buf     buffer that receives the result.
- * @param filler  function that needs to be called for each directory entry.
- *                Pass 0 as offset (4th argument). 3rd argument can be NULL.
- * @param offset  unused.
- * @param fi      unused.
- * @return        0 on success; -errno on error.
+ * @param inode    the inode the blocks are for.
+ * @param len      pointer to the number of blocks wanted/allocated.
+ * @param partial  whether a shorter run may be returned.
+ * @return         index of the first block of the run in the data bitmap on
+ *                 success; -ENOSPC on error.
  */
-static int a1fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                        off_t offset, struct fuse_file_info *fi)
-{
-	printf("\nEntered into readdir\n");
-	(void)offset;// unused
-	(void)fi;// unused
+long alloc_data_run(a1fs_inode *inode, uint32_t *len, bool partial) {
 	fs_ctx *fs = get_fs();
-
-	void *image = fs->image;
-	a1fs_superblock *sb = image;
-	
-	long curr_ino_num = get_ino_num_by_path(path);
-	if (curr_ino_num < 0) {
-		fprintf(stderr, "read_dirERORORROORORORORR\n");
-		return curr_ino_num;
+	a1fs_ino_t ino = get_ino_num(inode);
+	uint32_t room = *len, hinted = *len;
+	if (S_ISREG(inode->mode) && (inode->hint_contig != A1FS_HINT_CONTIG_NO)) {
+		if ((room > 1) && (room < A1FS_RSV_MIN_BLOCKS)) { room = A1FS_RSV_MIN_BLOCKS; }
+		hinted = hint_room(inode);
+		if (hinted < room) { hinted = room; }
 	}
-	a1fs_inode *curr_inode = (image + A1FS_BLOCK_SIZE*(sb->bg_inode_table) + sizeof(a1fs_inode)*(curr_ino_num - 1));
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
-	a1fs_dentry *curr_dir;
-	for (uint64_t i = 0; i < curr_inode->dentry_count; i++) {
-		curr_dir = (a1fs_dentry *) seekbyte(curr_inode, sizeof(a1fs_dentry) * i);
-		if (curr_dir->ino != 0) {
-			filler(buf, curr_dir->name, NULL, 0);
-		}
+	long hint = hint_group(inode);
+	uint32_t goal = (hint >= 0) ? (uint32_t) hint : group_of_inode(&fs->groups, ino);
+	uint32_t data_goal = (goal != group_of_inode(&fs->groups, ino)) ? fs->groups.groups[goal].first_block
+	                                                                : group_data_goal(&fs->groups, ino);
+	uint32_t align = extent_align(inode);
+	long bit = group_alloc_from(&fs->groups, data_goal, *len, hinted, align);
+	if ((bit < 0) && (align > 1)) { bit = group_alloc_from(&fs->groups, data_goal, *len, hinted, 1); }
+	// No group may have as much room as the hints ask for
+	if ((bit < 0) && (hinted > room)) { bit = group_alloc_from(&fs->groups, data_goal, *len, room, 1); }
+	if (bit >= 0) { return bit; }
+	uint32_t wanted = *len;
+	bit = group_alloc_blocks(&fs->groups, goal, len, partial);
+	// The free blocks left may all be set aside in reservation windows
+	if ((bit < 0) && rsv_release_all(&fs->rsv)) {
+		*len = wanted;
+		bit = group_alloc_blocks(&fs->groups, goal, len, partial);
 	}
-	return 0;
+	return bit;
 }
 
 /**
- * Return the index of the first bit of a bit sequence such that
- * - all bits in the sequence have value of 0
- * - the sequence is of length len
- *
- * NOTE: If len == 1, then it is equivalently searching for a bit of value 0
- * in the bitmap.
+ * Allocate a run of free data blocks for a file close to one of its blocks,
+ * so that it can be merged into (or stay close to) the extent that block is
+ * in; see group_alloc_near(). Falls back to alloc_data_run() if there is no
+ * room near that block.
  *
- * Errors:
- *   ENOSPC  no such bit sequence of length len exists
- *
- * @param bitmap the bitmap.
- * @param limit  how many bits to iterate through at total.
- * @param len    how many consecutive bits 
- * @return       the first bit of the bit sequence on success; -ENOSPC on error.
- */
-
-long find_free_entry_of_length_in_bitmap(uint32_t *bitmap, uint32_t limit, uint32_t len) {
-	for (uint32_t bit = 0; bit < limit; bit++) {
-		// found a bit of value 0
-		if (is_bit_off(bitmap, bit)) {
-			int all_bits_zero = 1;
-			for (uint32_t i = 0; i < len; i++) {
-				if (!is_bit_off(bitmap, bit + i)) {
-					all_bits_zero = 0;
-					break;
-				}
-			}
-			if (all_bits_zero) {
-				return bit;
-			}
-		}
-
-		// The number of unchecked bits are less than len
-		if (limit - bit < len) {
-			return -ENOSPC;
-		}
-	}
-	// Actually hopefully would not ever each here
-	return -ENOSPC;
+ * @param inode    the inode the blocks are for.
+ * @param near     preferred first block of the run.
+ * @param len      pointer to the number of blocks wanted/allocated.
+ * @param partial  whether a shorter run may be returned.
+ * @return         index of the first block of the run in the data bitmap on
+ *                 success; -ENOSPC on error.
+ */
+long alloc_data_run_near(a1fs_inode *inode, a1fs_blk_t near, uint32_t *len, bool partial) {
+	fs_ctx *fs = get_fs();
+	a1fs_superblock *sb = (a1fs_superblock *) fs->image;
+	uint32_t wanted = *len;
+	long bit = group_alloc_near(&fs->groups, near - sb->bg_data_block, len, partial);
+	if (bit >= 0) { return bit; }
+	*len = wanted;
+	return alloc_data_run(inode, len, partial);
 }
 
 /**
- * Return the longest length of continuous empty bits
+ * Allocate a run of free data blocks for a file to follow one of its extents
+ * on disk: from the file's reservation window (see rsv.h) if it is a regular
+ * file, otherwise as close after the extent as possible. A window that cannot
+ * follow the extent starts at a huge page boundary for large files (see
+ * extent_align()), and is made large enough for the growth the file's hints
+ * ask for; files hinted not to need contiguity get no window. Runs that do not
+ * follow a data extent are allocated with alloc_data_run(), and a window for
+ * the growth the hints ask for is opened right after them.
  *
- * @param bitmap the bitmap.
- * @param limit  how many bits to iterate through at total.
- * @return       the longest length of continuous empty bits
+ * @param inode  the inode the blocks are for.
+ * @param ext    the extent the run is to follow; NULL if there is none.
+ * @param len    pointer to the number of blocks wanted/allocated; a shorter
+ *               run may be returned.
+ * @return       index of the first block of the run in the data bitmap on
+ *               success; -ENOSPC on error.
  */
-uint32_t find_largest_chunk(uint32_t *bitmap, uint32_t limit){
-	uint32_t longest = 0;
-	uint32_t sec_longest = 0;
-	for (uint32_t bit = 0; bit < limit; bit++) {
-		if (is_bit_off(bitmap, bit)) {
-			if (longest == 0) {
-				longest += 1;
-			}
-			sec_longest += 1;
-			if (sec_longest >= longest) {
-				longest = sec_longest;
-			}
-		} else {
-			sec_longest = 0;
-		}
+long alloc_run_after(a1fs_inode *inode, const a1fs_extent *ext, uint32_t *len) {
+	fs_ctx *fs = get_fs();
+	bool windowed = S_ISREG(inode->mode) && (inode->hint_contig != A1FS_HINT_CONTIG_NO);
+	if ((ext == NULL) || a1fs_extent_hole(ext)) {
+		long bit = alloc_data_run(inode, len, true);
+		// Set the room the hints ask for aside right away, after the new run
+		uint32_t room = windowed ? hint_room(inode) : 0;
+		if ((bit >= 0) && (room > *len)) { rsv_reserve(&fs->rsv, get_ino_num(inode), bit + *len, room - *len); }
+		return bit;
+	}
+	a1fs_superblock *sb = (a1fs_superblock *) fs->image;
+	a1fs_blk_t near = ext->start + a1fs_extent_len(ext);
+	if (windowed) {
+		uint32_t wanted = *len;
+		long bit = rsv_alloc(&fs->rsv, get_ino_num(inode), near - sb->bg_data_block, len,
+		                     extent_align(inode), hint_room(inode));
+		if (bit >= 0) { return bit; }
+		*len = wanted;
 	}
-	return longest;
+	return alloc_data_run_near(inode, near, len, true);
 }
 
 /**
@@ -459,170 +540,2084 @@ uint32_t find_largest_chunk(uint32_t *bitmap, uint32_t limit){
  */
 int alloc_extent_block(a1fs_inode *ino) {
 	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *) image;
-	// no more free data block, return error
-	if (sb->s_free_blocks_count < 1) { return -ENOSPC; }
-	uint32_t *data_bitmap = (uint32_t *) (image + sb->bg_block_bitmap * A1FS_BLOCK_SIZE);
-	long some_bit_off = find_free_entry_of_length_in_bitmap(data_bitmap, sb->data_block_count, 1);
-	if (some_bit_off < 0) { return -ENOSPC; }
-	ino->extentblock = (a1fs_blk_t) sb->bg_data_block + some_bit_off;
-	setBitOn(data_bitmap, some_bit_off);
-	(sb->s_free_blocks_count)--;
+	a1fs_superblock *sb = (a1fs_superblock *) fs->image;
+	uint32_t len = 1;
+	long bit = alloc_data_run(ino, &len, false);
+	if (bit < 0) { return bit; }
+	ino->extentblock = (a1fs_blk_t) sb->bg_data_block + bit;
 	return 0;
 }
 
-// Allocate an extent according to the size
-int alloc_an_extent_for_size(a1fs_extent *extent, uint64_t size) {
-	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *) image;
-	// no more free data block, return error
-	if (sb->s_free_blocks_count < 1) { return -ENOSPC; }
-	uint32_t *data_bitmap = (uint32_t *) (image + sb->bg_block_bitmap * A1FS_BLOCK_SIZE);
-	uint32_t blocks_needed = ceil_divide(size, A1FS_BLOCK_SIZE);
-	long some_bit_off = find_free_entry_of_length_in_bitmap(data_bitmap, sb->data_block_count, blocks_needed);
-	if (some_bit_off < 0) { return -ENOSPC; }
-	for (uint32_t i = 0; i < blocks_needed; i++) {
-		setBitOn(data_bitmap, some_bit_off + i);
-		(sb->s_free_blocks_count)--;
-	}
-
-	extent->start = (a1fs_blk_t)(sb->bg_data_block + some_bit_off);
-	extent->count = blocks_needed;
-	return 0;
+// pad the buf with size many zeroes
+void pad_zeroes(char *buf, size_t size) {
+	memset(buf, 0, size);
 }
 
-// Fill a block with free directories
-void fill_with_dentry(a1fs_blk_t blk_num) {
+// Release the data blocks [start, start + count) back to the data bitmap
+void free_data_blocks(a1fs_blk_t start, a1fs_blk_t count) {
 	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_dentry *curr_dentry;
-	for (uint32_t i = 0; i < A1FS_BLOCK_SIZE / sizeof(a1fs_dentry); i++) {
-		curr_dentry = (a1fs_dentry *) (image + A1FS_BLOCK_SIZE * blk_num + sizeof(a1fs_dentry) * i);
-		curr_dentry->ino = 0;
-	}
+	a1fs_superblock *sb = (a1fs_superblock *) fs->image;
+	group_free_blocks(&fs->groups, start - sb->bg_data_block, count);
 }
 
-// First allocate an extent block for the directory inode, then allocate an extent of length 1
-// then fill the first block pointed to by the extent with 16 directories
-int init_dir_inode_extent(a1fs_inode *inode) {
-	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-
-	int ret0 = alloc_extent_block(inode);
-	if (ret0 != 0) { return ret0; };
-	a1fs_extent *curr_extent;
-	// Initialize 512 free extents
-	for (uint32_t i = 0; i < A1FS_BLOCK_SIZE / sizeof(a1fs_extent); i++) {
-		curr_extent = (a1fs_extent *)(image + A1FS_BLOCK_SIZE * inode->extentblock + sizeof(a1fs_extent) * i);
-		curr_extent->count = 0;
-	}
-	a1fs_extent *new_extent = (a1fs_extent *)(image + A1FS_BLOCK_SIZE *(inode->extentblock));
-	int ret1 = alloc_an_extent_for_size(new_extent, sizeof(a1fs_dentry));
-	if (ret1 != 0) {return ret1;}
-	(inode->extentcount)++;
-	// allocate a new directory entry
-	fill_with_dentry(new_extent->start);
-	inode->dentry_count += A1FS_BLOCK_SIZE / sizeof(a1fs_dentry);
-	(inode->links)++;
-	return 0;
+// Get the data of a file stored in its inode or in a fragment; NULL if the
+// file's data is in blocks
+char *small_file_data(a1fs_inode *inode) {
+	if (inode->flags & A1FS_INODE_INLINE_DATA) { return a1fs_inode_data(inode); }
+	if (!(inode->flags & A1FS_INODE_FRAGMENT)) { return NULL; }
+	return (char *)get_fs()->image + (uint64_t)inode->extentblock * A1FS_BLOCK_SIZE + inode->frag_offset;
 }
 
-// Create a new inode for the given mode, returns the new inode number
-long init_new_inode(mode_t mode) {
-	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *) image;
-	if (sb->s_free_inodes_count < 1) {
-		return -ENOSPC;
-	}
+// Number of fragment units that hold size bytes
+uint32_t frag_units(uint64_t size) {
+	return (size + A1FS_FRAG_UNIT - 1) / A1FS_FRAG_UNIT;
+}
 
-	uint32_t *inode_bitmap = (uint32_t *) (image + sb->bg_inode_bitmap * A1FS_BLOCK_SIZE);
-	long free_bit = find_free_entry_of_length_in_bitmap(inode_bitmap, sb->s_inodes_count, 1);
-	// out of inodes to allocate, return ENOSPC
-	if (free_bit < 0) { return free_bit; }
-	a1fs_inode *new_inode = (a1fs_inode *)(image + sb->bg_inode_table * A1FS_BLOCK_SIZE + (free_bit) * sizeof(a1fs_inode));
-	setBitOn(inode_bitmap, free_bit);
-	a1fs_ino_t new_inode_num = free_bit + 1;
-	(sb->s_free_inodes_count)--;
-	
-	new_inode->mode = (mode | 0777);
-	if (S_ISDIR(mode)) {
-		new_inode->links = 2;
-	} else if (S_ISREG(mode)) {
-		new_inode->links = 1;
-	}
-	new_inode->size = 0;
-	clock_gettime(CLOCK_REALTIME, &(new_inode->mtime));
-	new_inode->extentcount = 0;
-	new_inode->dentry_count = 0;
-	return new_inode_num;
+// Free the fragment of a file (A1FS_INODE_FRAGMENT)
+void free_fragment(a1fs_blk_t block, uint16_t offset, uint64_t size) {
+	frag_free(&get_fs()->frags, block, offset, frag_units(size));
 }
 
-// Insert a new inode num to the parent directory's entries and update metadata accordingly
-int add_new_inode_to_parent_dir(a1fs_inode *parent_inode, a1fs_ino_t new_ino_num, const char *entryname) {
+// Allocate an extent block for the inode with all of its extent slots empty
+int init_extent_table(a1fs_inode *inode) {
 	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	clock_gettime(CLOCK_REALTIME, &(parent_inode->mtime));
-	// allocate extent block for the parent_inode if it hasn't allocate any yet
-	if (parent_inode->extentcount == 0) {
-		int ret = init_dir_inode_extent(parent_inode);
-		if (ret != 0) { return ret; }
-	}
+	int ret = alloc_extent_block(inode);
+	if (ret != 0) { return ret; }
+	memset(fs->image + A1FS_BLOCK_SIZE * inode->extentblock, 0, A1FS_BLOCK_SIZE);
+	inode->extentcount = 0;
+	return 0;
+}
 
-	parent_inode->size += sizeof(a1fs_dentry);
-	a1fs_dentry *new_dir = NULL;
-	// search for a free directory by checking if the ino == 0
-	uint64_t i = 0;
-	a1fs_dentry *cur_dir;
-	off_t offset = 0;
-	while (i < parent_inode->dentry_count){
-		cur_dir = (a1fs_dentry *) seekbyte(parent_inode, offset);
-		if (cur_dir->ino == 0){
-			new_dir = cur_dir;
-			break;
-		}
-		offset += sizeof(a1fs_dentry);
-		i++;
-	}
+/** Blocks allocated up front for the extent tree nodes a split needs. */
+typedef struct node_pool {
+	a1fs_blk_t blocks[A1FS_EXTENT_MAX_LEVELS + 3];
+	uint32_t count;
+} node_pool;
 
-	// Allocate more extent for the free directory
-	if (new_dir == NULL) {
-		a1fs_extent *curr_extent = NULL;
-		a1fs_extent *free_extent = NULL;
-		// Find a free extent to allocate more directories
-		for (int i = 0; i < parent_inode->extentcount; i++) {
-			curr_extent = (a1fs_extent *)(image + A1FS_BLOCK_SIZE*(parent_inode->extentblock) + sizeof(a1fs_extent) * i);
-			if (curr_extent->count == 0) {
-				free_extent = curr_extent;
-				break;
-			}
-		}
-		// Cannot find any free extent, no space
-		if (free_extent == NULL) {
+/**
+ * Allocate the blocks for an extent tree split, near the inode's blocks.
+ *
+ * The blocks are taken from the free blocks even if they are reserved for
+ * delayed allocation: a flush must not fail for the few blocks of the tree.
+ *
+ * @return  0 on success; -ENOSPC if there are not enough free blocks.
+ */
+static int node_pool_fill(a1fs_inode *inode, node_pool *pool, uint32_t count)
+{
+	a1fs_superblock *sb = (a1fs_superblock *)get_fs()->image;
+	for (pool->count = 0; pool->count < count; pool->count++) {
+		uint32_t len = 1;
+		long bit = alloc_data_run(inode, &len, false);
+		if (bit < 0) {
+			while (pool->count > 0) { free_data_blocks(pool->blocks[--pool->count], 1); }
 			return -ENOSPC;
 		}
-		int ret1 = alloc_an_extent_for_size(free_extent, sizeof(a1fs_dentry));
-		// Not enough free data blocks left to new directories
-		if (ret1 < 0) {return ret1;}
-		new_dir = (a1fs_dentry *)(image + A1FS_BLOCK_SIZE * free_extent->start);
+		pool->blocks[pool->count] = (a1fs_blk_t)(sb->bg_data_block + bit);
 	}
-
-	new_dir->ino = new_ino_num;
-	// get the entry name we want to create
-	strcpy(new_dir->name, entryname);
 	return 0;
 }
 
+// Take a zeroed block from the pool
+static a1fs_blk_t node_pool_take(node_pool *pool)
+{
+	assert(pool->count > 0);
+	a1fs_blk_t block = pool->blocks[--pool->count];
+	memset(extent_node(block), 0, A1FS_BLOCK_SIZE);
+	return block;
+}
+
+/**
+ * Insert an entry into the index node at depth d on a leaf's path, splitting
+ * the node (and its ancestors) if it is full.
+ *
+ * A full root is first pushed down into a new child, adding a level to the
+ * tree, so that the root block never moves. The path of the leaf is only
+ * valid above depth d afterwards.
+ *
+ * @param inode  the file inode.
+ * @param leaf   the leaf whose path leads to the node.
+ * @param d      depth of the node on the path.
+ * @param pos    position of the new entry in the node.
+ * @param entry  the new entry.
+ * @param pool   blocks for new nodes.
+ */
+static void node_insert(a1fs_inode *inode, extent_leaf *leaf, uint32_t d, uint32_t pos,
+                        const a1fs_extent_idx *entry, node_pool *pool)
+{
+	a1fs_extent_node *node = leaf->nodes[d];
+	if (node->count == A1FS_EXTENT_IDX_LIMIT) {
+		if (d == 0) {
+			a1fs_blk_t block = node_pool_take(pool);
+			a1fs_extent_node *child = extent_node(block);
+			memcpy(child, node, A1FS_BLOCK_SIZE);
+			memset(node, 0, A1FS_BLOCK_SIZE);
+			node->levels = child->levels + 1;
+			node->count = 1;
+			node->entries[0].block = block;
+			memmove(&leaf->nodes[1], &leaf->nodes[0], sizeof(leaf->nodes[0]) * leaf->depth);
+			memmove(&leaf->index[1], &leaf->index[0], sizeof(leaf->index[0]) * leaf->depth);
+			leaf->nodes[0] = node;
+			leaf->index[0] = 0;
+			leaf->nodes[1] = child;
+			leaf->depth++;
+			node = child;
+			d = 1;
+		}
+
+		// Move the upper entries to a new sibling; appends leave it empty
+		uint32_t split = (pos == node->count) ? pos : node->count / 2;
+		a1fs_blk_t block = node_pool_take(pool);
+		a1fs_extent_node *sib = extent_node(block);
+		sib->levels = node->levels;
+		sib->count = node->count - split;
+		memcpy(sib->entries, &node->entries[split], sizeof(a1fs_extent_idx) * sib->count);
+		node->count = split;
+		if (pos >= split && (pos > split || sib->count == 0)) {
+			node = sib;
+			pos -= split;
+		}
+		memmove(&node->entries[pos + 1], &node->entries[pos], sizeof(a1fs_extent_idx) * (node->count - pos));
+		node->entries[pos] = *entry;
+		node->count++;
+
+		a1fs_extent_idx up = { sib->entries[0].lblk, block, 0 };
+		node_insert(inode, leaf, d - 1, leaf->index[d - 1] + 1, &up, pool);
+		return;
+	}
+	memmove(&node->entries[pos + 1], &node->entries[pos], sizeof(a1fs_extent_idx) * (node->count - pos));
+	node->entries[pos] = *entry;
+	node->count++;
+	inode->extentcount = extent_node(inode->extentblock)->count;
+}
+
+/**
+ * Split a full leaf of a file's extent table in two, turning the extent
+ * block into the root of an extent tree first if the file does not have one.
+ *
+ * The upper half of the slots moves to a new leaf, or only the last one if
+ * the split is for an append (pos is past the last slot), so that files that
+ * grow at the end get full leaves and no leaf is ever left empty. On success the leaf is the one that
+ * now holds the slot at pos, and pos is updated to its position there. On
+ * failure nothing is changed.
+ *
+ * Errors:
+ *   ENOSPC  not enough free blocks, or the tree is at its maximum depth.
+ *
+ * @param inode  the file inode.
+ * @param leaf   the leaf.
+ * @param pos    pointer to a slot position in the leaf.
+ * @return       0 on success; -errno on error.
+ */
+static int split_leaf(a1fs_inode *inode, extent_leaf *leaf, uint32_t *pos)
+{
+	// Count the new nodes: a root, and a sibling for each full node on the path
+	uint32_t need = (leaf->depth == 0) ? 2 : 1;
+	for (int d = (int)leaf->depth - 1; d >= 0; d--) {
+		if (leaf->nodes[d]->count < A1FS_EXTENT_IDX_LIMIT) { break; }
+		if (d == 0) {
+			if (leaf->nodes[0]->levels >= A1FS_EXTENT_MAX_LEVELS) { return -ENOSPC; }
+			need++;
+		}
+		need++;
+	}
+	node_pool pool;
+	int ret = node_pool_fill(inode, &pool, need);
+	if (ret != 0) { return ret; }
+
+	if (leaf->depth == 0) {
+		a1fs_blk_t root = node_pool_take(&pool);
+		a1fs_extent_node *node = extent_node(root);
+		node->levels = 0;
+		node->count = 1;
+		node->entries[0] = (a1fs_extent_idx){ 0, leaf->block, leaf->nslots };
+		inode->extentblock = root;
+		inode->extentcount = 1;
+		inode->flags |= A1FS_INODE_EXTENT_TREE;
+		leaf->nodes[0] = node;
+		leaf->index[0] = 0;
+		leaf->depth = 1;
+	}
+
+	uint32_t split = (*pos == leaf->nslots) ? leaf->nslots - 1 : leaf->nslots / 2;
+	uint64_t lblk = leaf->first;
+	for (uint32_t i = 0; i < split; i++) {
+		lblk += a1fs_extent_len(&leaf->extents[i]);
+	}
+	a1fs_blk_t block = node_pool_take(&pool);
+	memcpy(extent_node(block), &leaf->extents[split], sizeof(a1fs_extent) * (leaf->nslots - split));
+	memset(&leaf->extents[split], 0, sizeof(a1fs_extent) * (leaf->nslots - split));
+	a1fs_extent_idx entry = { lblk, block, leaf->nslots - split };
+	leaf_set_count(inode, leaf, split);
+	uint64_t first = leaf->first;
+	node_insert(inode, leaf, leaf->depth - 1, leaf->index[leaf->depth - 1] + 1, &entry, &pool);
+	assert(pool.count == 0);
+	emap_invalidate(&get_fs()->emaps, get_ino_num(inode));
+
+	// Find the leaf again, since the path may have changed
+	if (*pos < split) {
+		find_leaf(inode, first, leaf);
+	} else {
+		find_leaf(inode, lblk, leaf);
+		*pos -= split;
+	}
+	return 0;
+}
+
+/**
+ * Move the extents stored in the inode to a new extent block, which becomes
+ * the leaf.
+ *
+ * Errors:
+ *   ENOSPC  no free block for the extent block.
+ */
+static int spill_inline_extents(a1fs_inode *inode, extent_leaf *leaf)
+{
+	int ret = alloc_extent_block(inode);
+	if (ret != 0) { return ret; }
+	a1fs_extent *extents = (a1fs_extent *)extent_node(inode->extentblock);
+	memset(extents, 0, A1FS_BLOCK_SIZE);
+	memcpy(extents, leaf->extents, sizeof(a1fs_extent) * leaf->nslots);
+	memset(leaf->extents, 0, sizeof(a1fs_extent) * get_fs()->inline_extents);
+	inode->flags &= ~A1FS_INODE_INLINE_EXTENTS;
+	emap_invalidate(&get_fs()->emaps, get_ino_num(inode));
+	find_leaf(inode, 0, leaf);
+	return 0;
+}
+
+// Move the extents of a file back into the inode once they fit there again
+static void unspill_extents(a1fs_inode *inode)
+{
+	fs_ctx *fs = get_fs();
+	if ((fs->inline_extents == 0) || (inode->extentcount > fs->inline_extents) ||
+	    (inode->flags & (A1FS_INODE_INLINE_EXTENTS | A1FS_INODE_EXTENT_TREE))) { return; }
+	a1fs_extent *extents = a1fs_inode_extents(inode);
+	memset(extents, 0, sizeof(a1fs_extent) * fs->inline_extents);
+	if (inode->extentcount > 0) {
+		memcpy(extents, extent_node(inode->extentblock), sizeof(a1fs_extent) * inode->extentcount);
+		free_data_blocks(inode->extentblock, 1);
+	}
+	inode->extentblock = 0;
+	inode->flags |= A1FS_INODE_INLINE_EXTENTS;
+}
+
+/**
+ * Open n empty slots at position pos of a leaf, shifting the slots from pos
+ * on to the right. The leaf is split first if it does not have room, in
+ * which case the leaf and pos are updated to where the new slots are.
+ *
+ * Errors:
+ *   ENOSPC  the leaf is full and could not be split.
+ *
+ * @param inode  the file inode.
+ * @param leaf   the leaf.
+ * @param pos    pointer to the position of the new slots.
+ * @param n      number of slots.
+ * @return       0 on success; -errno on error.
+ */
+static int leaf_insert(a1fs_inode *inode, extent_leaf *leaf, uint32_t *pos, uint32_t n)
+{
+	if ((leaf->block == 0) && (leaf->nslots + n > get_fs()->inline_extents)) {
+		int ret = spill_inline_extents(inode, leaf);
+		if (ret != 0) { return ret; }
+	}
+	if (leaf->nslots + n > A1FS_EXTENTS_PER_BLOCK) {
+		int ret = split_leaf(inode, leaf, pos);
+		if (ret != 0) { return ret; }
+	}
+	a1fs_extent *extents = leaf->extents;
+	memmove(&extents[*pos + n], &extents[*pos], sizeof(a1fs_extent) * (leaf->nslots - *pos));
+	memset(&extents[*pos], 0, sizeof(a1fs_extent) * n);
+	leaf_set_count(inode, leaf, leaf->nslots + n);
+	return 0;
+}
+
+// Remove a slot from a leaf, keeping it non-empty unless it is the extent block
+static void leaf_remove(a1fs_inode *inode, extent_leaf *leaf, uint32_t pos)
+{
+	a1fs_extent *extents = leaf->extents;
+	memmove(&extents[pos], &extents[pos + 1], sizeof(a1fs_extent) * (leaf->nslots - pos - 1));
+	extents[leaf->nslots - 1].start = 0;
+	extents[leaf->nslots - 1].count = 0;
+	leaf_set_count(inode, leaf, leaf->nslots - 1);
+}
+
+/**
+ * Release the last leaf of an extent tree, and the index nodes left empty.
+ * Releasing the only leaf releases the whole tree, leaving the file without
+ * an extent table.
+ *
+ * @param inode  the file inode.
+ * @param leaf   the last leaf, as found by find_leaf().
+ */
+static void remove_last_leaf(a1fs_inode *inode, extent_leaf *leaf)
+{
+	free_data_blocks(leaf->block, 1);
+	for (int d = (int)leaf->depth - 1; d >= 0; d--) {
+		a1fs_extent_node *node = leaf->nodes[d];
+		node->count--;
+		if (node->count > 0) { break; }
+		if (d == 0) {
+			free_data_blocks(inode->extentblock, 1);
+			inode->flags &= ~A1FS_INODE_EXTENT_TREE;
+			inode->extentcount = 0;
+			return;
+		}
+		free_data_blocks(leaf->nodes[d - 1]->entries[leaf->index[d - 1]].block, 1);
+	}
+	inode->extentcount = extent_node(inode->extentblock)->count;
+}
+
+// Remove the levels of an extent tree whose root has a single entry, down to
+// a file without an extent tree if the root points to a single leaf
+static void collapse_tree(a1fs_inode *inode)
+{
+	if (!(inode->flags & A1FS_INODE_EXTENT_TREE)) { return; }
+	a1fs_extent_node *root = extent_node(inode->extentblock);
+	while ((root->count == 1) && (root->levels > 0)) {
+		a1fs_blk_t block = root->entries[0].block;
+		memcpy(root, extent_node(block), A1FS_BLOCK_SIZE);
+		free_data_blocks(block, 1);
+	}
+	if (root->count == 1) {
+		a1fs_blk_t leaf = root->entries[0].block;
+		inode->extentcount = root->entries[0].count;
+		free_data_blocks(inode->extentblock, 1);
+		inode->extentblock = leaf;
+		inode->flags &= ~A1FS_INODE_EXTENT_TREE;
+	}
+}
+
+/**
+ * Release blocks from the end of the file so that it keeps only "keep" blocks.
+ *
+ * Leaves of the extent tree are released as they become empty, and the tree
+ * is collapsed back into a single extent block once its extents fit in one,
+ * or into the inode with inline extents. The extent block itself is released
+ * once the file has no blocks left.
+ *
+ * @param inode  the file inode.
+ * @param keep   number of blocks to keep.
+ */
+void free_file_blocks(a1fs_inode *inode, uint64_t keep) {
+	fs_ctx *fs = get_fs();
+	if (inode->extentcount == 0) { return; }
+	emap_invalidate(&fs->emaps, get_ino_num(inode));
+
+	extent_leaf leaf;
+	for (;;) {
+		find_leaf(inode, UINT64_MAX, &leaf);
+		a1fs_extent *extents = leaf.extents;
+		uint64_t total = leaf.first;
+		for (uint32_t i = 0; i < leaf.nslots; i++) {
+			total += a1fs_extent_len(&extents[i]);
+		}
+		while (leaf.nslots > 0) {
+			a1fs_extent *ext = &extents[leaf.nslots - 1];
+			a1fs_blk_t len = a1fs_extent_len(ext);
+			if ((total <= keep) && (len > 0)) { break; }
+			a1fs_blk_t drop = len;
+			if (total < keep + drop) { drop = (total > keep) ? (a1fs_blk_t)(total - keep) : 0; }
+			if (a1fs_extent_hole(ext)) {
+				inode->hole_blocks -= drop;
+			} else {
+				free_data_blocks(ext->start + len - drop, drop);
+			}
+			ext->count -= drop;
+			total -= drop;
+			if (drop < len) { break; }
+			leaf_remove(inode, &leaf, leaf.nslots - 1);
+		}
+		if (leaf.depth == 0) {
+			if ((total == 0) && (leaf.block != 0)) {
+				free_data_blocks(inode->extentblock, 1);
+				inode->extentcount = 0;
+			}
+			break;
+		}
+		if (leaf.nslots > 0) { break; }
+		remove_last_leaf(inode, &leaf);
+		if (inode->extentcount == 0) { break; }
+	}
+	collapse_tree(inode);
+	unspill_extents(inode);
+}
+
+// Get the logical block lblk of a file or directory; NULL if it is not mapped
+char *get_file_block(a1fs_inode *inode, uint64_t lblk) {
+	extent_cursor cur;
+	if (!seek_cursor(inode, lblk * A1FS_BLOCK_SIZE, &cur)) {return NULL;}
+	char *block;
+	if (cursor_run(&cur, &block) == 0) {return NULL;}
+	return block;
+}
+
+// Return the number of data blocks mapped by the inode's extents
+uint64_t inode_nblocks(a1fs_inode *inode) {
+	if (inode->extentcount == 0) {return 0;}
+	extent_leaf leaf;
+	find_leaf(inode, UINT64_MAX, &leaf);
+	return leaf.first + leaf_nblocks(inode, &leaf);
+}
+
+/** The blocks were reserved with group_reserve_blocks(). */
+#define ALLOC_RESERVED  0x1
+
+/**
+ * Append blocks to the end of the file's extent table.
+ *
+ * If the file ends in a data extent, the new blocks are allocated to follow
+ * it on disk (see alloc_run_after()): taken from the file's reservation
+ * window, or right after the extent if they are free, extending it in place,
+ * or else from the first free run after it in its group. A run that starts
+ * where the last extent ends is merged into it instead of taking a new extent
+ * slot, so sequential appends end up in one extent. Files that do not end in
+ * data follow the allocation algorithm in README.txt: the blocks go into a
+ * single extent taken from the smallest free run that holds them (best fit);
+ * otherwise the request is filled with the largest free chunks, one extent
+ * each. The new blocks are zeroed. On failure nothing is allocated.
+ *
+ * Blocks reserved for delayed allocation are not used unless the blocks were
+ * reserved for this request (ALLOC_RESERVED); such a reservation is consumed
+ * on success.
+ *
+ * Errors:
+ *   ENOSPC  not enough free blocks, or the extent tree is full.
+ *
+ * @param inode   the file inode.
+ * @param blocks  number of blocks to add.
+ * @param flags   ALLOC_* flags.
+ * @return        0 on success; -errno on error.
+ */
+int alloc_file_blocks(a1fs_inode *inode, uint32_t blocks, int flags) {
+	fs_ctx *fs = get_fs();
+	void *image = fs->image;
+	a1fs_superblock *sb = (a1fs_superblock *) image;
+	if (blocks == 0) { return 0; }
+
+	bool new_table = (inode->extentcount == 0) && !(inode->flags & A1FS_INODE_INLINE_EXTENTS);
+	bool reserved = (flags & ALLOC_RESERVED) != 0;
+	uint32_t avail = group_avail_blocks(&fs->groups) + (reserved ? blocks : 0);
+	bool enough = (blocks + (new_table ? 1 : 0) <= avail);
+	if (!enough) { return -ENOSPC; }
+	if (new_table) {
+		int ret = init_extent_table(inode);
+		if (ret != 0) { return ret; }
+	}
+	uint64_t old_blocks = inode_nblocks(inode);
+	uint32_t requested = blocks;
+	extent_leaf leaf;
+	find_leaf(inode, UINT64_MAX, &leaf);
+
+	while (blocks > 0) {
+		uint32_t len = blocks;
+		a1fs_extent *last = (leaf.nslots > 0) ? &leaf.extents[leaf.nslots - 1] : NULL;
+		long bit = alloc_run_after(inode, last, &len);
+		if (bit < 0) { goto nospace; }
+		a1fs_blk_t start = (a1fs_blk_t)(sb->bg_data_block + bit);
+		pad_zeroes((char *)image + (uint64_t)A1FS_BLOCK_SIZE * start, (uint64_t)A1FS_BLOCK_SIZE * len);
+		blocks -= len;
+
+		// Grow the last extent if the run continues it
+		if ((last != NULL) && !a1fs_extent_hole(last) && !a1fs_extent_unwritten(last) &&
+		    (start == last->start + last->count) &&
+		    (len < A1FS_EXTENT_UNWRITTEN - last->count))
+		{
+			last->count += len;
+			emap_invalidate(&fs->emaps, get_ino_num(inode));
+			continue;
+		}
+		uint32_t slot = leaf.nslots;
+		if (leaf_insert(inode, &leaf, &slot, 1) != 0) {
+			free_data_blocks(start, len);
+			goto nospace;
+		}
+		leaf.extents[slot].start = start;
+		leaf.extents[slot].count = len;
+		emap_append(&fs->emaps, get_ino_num(inode), leaf.block, slot, len);
+	}
+	if (reserved) { group_unreserve_blocks(&fs->groups, requested); }
+	return 0;
+
+nospace:
+	// Undo the partial allocation
+	if (new_table && (inode->extentcount == 0)) {
+		free_data_blocks(inode->extentblock, 1);
+	} else {
+		free_file_blocks(inode, old_blocks);
+	}
+	return -ENOSPC;
+}
+
+/**
+ * Append a hole to the end of the file's extent table, merging it into the
+ * last extent if that is a hole too. On failure nothing is added.
+ *
+ * Errors:
+ *   ENOSPC  no free block for the extent table, or the extent tree is full.
+ *
+ * @param inode   the file inode.
+ * @param blocks  number of blocks in the hole.
+ * @return        0 on success; -errno on error.
+ */
+int add_hole(a1fs_inode *inode, uint64_t blocks) {
+	fs_ctx *fs = get_fs();
+	if (blocks == 0) { return 0; }
+	if ((inode->extentcount == 0) && !(inode->flags & A1FS_INODE_INLINE_EXTENTS)) {
+		if (group_avail_blocks(&fs->groups) == 0) { return -ENOSPC; }
+		int ret = init_extent_table(inode);
+		if (ret != 0) { return ret; }
+	}
+	a1fs_ino_t ino = get_ino_num(inode);
+	uint64_t old_blocks = inode_nblocks(inode);
+	extent_leaf leaf;
+	find_leaf(inode, UINT64_MAX, &leaf);
+
+	while (blocks > 0) {
+		a1fs_extent *last = (leaf.nslots > 0) ? &leaf.extents[leaf.nslots - 1] : NULL;
+		if ((last != NULL) && a1fs_extent_hole(last) && (last->count < A1FS_EXTENT_UNWRITTEN - 1)) {
+			a1fs_blk_t n = A1FS_EXTENT_UNWRITTEN - 1 - last->count;
+			if (n > blocks) { n = blocks; }
+			last->count += n;
+			inode->hole_blocks += n;
+			blocks -= n;
+			emap_invalidate(&fs->emaps, ino);
+			continue;
+		}
+		uint32_t slot = leaf.nslots;
+		if (leaf_insert(inode, &leaf, &slot, 1) != 0) {
+			free_file_blocks(inode, old_blocks);
+			return -ENOSPC;
+		}
+		emap_append(&fs->emaps, ino, leaf.block, slot, 0);
+	}
+	return 0;
+}
+
+/**
+ * Unwritten extents up to this many blocks are converted by zeroing them as a
+ * whole rather than by splitting them.
+ */
+#define UNWRITTEN_ZEROOUT_BLOCKS 16
+
+// Zero the blocks [from, to) of an extent
+static void zero_extent_blocks(const a1fs_extent *ext, a1fs_blk_t from, a1fs_blk_t to) {
+	char *image = get_fs()->image;
+	pad_zeroes(image + (uint64_t)A1FS_BLOCK_SIZE * (ext->start + from), (uint64_t)A1FS_BLOCK_SIZE * (to - from));
+}
+
+/**
+ * Convert the blocks [from, to) of the unwritten extent in the given slot
+ * of a leaf into written ones.
+ *
+ * The blocks are given to the written extent before or after the unwritten one
+ * in the leaf if it continues on disk where they are and its length stays
+ * below A1FS_EXTENT_UNWRITTEN (the unwritten extent is removed if nothing is
+ * left of it), otherwise the extent is split into up to three: unwritten,
+ * written, and unwritten. Small extents, or any extent if the leaf cannot make
+ * room for the split, are zeroed and converted whole.
+ * The contents of the converted blocks are left as they are.
+ *
+ * @param inode  the file inode.
+ * @param leaf   the leaf; updated if it is split.
+ * @param slot   the extent slot.
+ * @param from   first block to convert, relative to the extent.
+ * @param to     end of the blocks to convert, relative to the extent.
+ * @param end    pointer to the variable that receives the end of the extent
+ *               in the returned slot, relative to the original extent.
+ * @return       slot of the extent that holds the last converted block.
+ */
+static uint32_t split_unwritten(a1fs_inode *inode, extent_leaf *leaf, uint32_t slot,
+                                a1fs_blk_t from, a1fs_blk_t to, a1fs_blk_t *end) {
+	a1fs_extent *extents = leaf->extents;
+	a1fs_extent *ext = &extents[slot];
+	a1fs_blk_t len = a1fs_extent_len(ext);
+
+	// Grow the written neighbour that ends (or starts) right at the blocks
+	*end = to;
+	a1fs_extent *prev = (slot > 0) ? &extents[slot - 1] : NULL;
+	if ((from == 0) && (prev != NULL) && !a1fs_extent_hole(prev) && !a1fs_extent_unwritten(prev) &&
+	    (prev->start + prev->count == ext->start) && (to < A1FS_EXTENT_UNWRITTEN - prev->count))
+	{
+		prev->count += to;
+		ext->start += to;
+		ext->count -= to;
+		if (to == len) { leaf_remove(inode, leaf, slot); }
+		return slot - 1;
+	}
+	if ((from == 0) && (to == len)) {
+		ext->count = len;
+		return slot;
+	}
+	a1fs_extent *next = (slot + 1 < leaf->nslots) ? &extents[slot + 1] : NULL;
+	if ((to == len) && (next != NULL) && !a1fs_extent_hole(next) && !a1fs_extent_unwritten(next) &&
+	    (ext->start + len == next->start) && (len - from < A1FS_EXTENT_UNWRITTEN - next->count))
+	{
+		next->start -= len - from;
+		next->count += len - from;
+		ext->count -= len - from;
+		*end = from + next->count;
+		return slot + 1;
+	}
+
+	uint32_t extra = (from > 0) + (to < len);
+	a1fs_blk_t start = ext->start;
+	uint32_t pos = slot;
+	if ((len <= UNWRITTEN_ZEROOUT_BLOCKS) || (leaf_insert(inode, leaf, &pos, extra) != 0)) {
+		zero_extent_blocks(ext, 0, from);
+		zero_extent_blocks(ext, to, len);
+		ext->count = len;
+		*end = len;
+		return slot;
+	}
+	// The extent is now in slot pos + extra
+	extents = leaf->extents;
+	slot = pos;
+	if (from > 0) {
+		extents[slot].start = start;
+		extents[slot].count = from | A1FS_EXTENT_UNWRITTEN;
+		slot++;
+	}
+	extents[slot].start = start + from;
+	extents[slot].count = to - from;
+	if (to < len) {
+		extents[slot + 1].start = start + to;
+		extents[slot + 1].count = (len - to) | A1FS_EXTENT_UNWRITTEN;
+	}
+	return slot;
+}
+
+/**
+ * Allocate unwritten extents for the holes of a file in the block range
+ * [first, last).
+ *
+ * New runs of blocks are allocated to follow the extent before the hole on
+ * disk (see alloc_run_after()). A new run is merged into the unwritten extent
+ * before it in the same leaf if that ends right where the run starts.
+ *
+ * Errors:
+ *   ENOSPC  not enough free blocks, or the extent tree is full; the blocks
+ *           allocated so far are kept.
+ *
+ * @param inode  the file inode, locked for writing.
+ * @param first  first logical block.
+ * @param last   end of the logical blocks.
+ * @return       0 on success; -errno on error.
+ */
+int fill_holes(a1fs_inode *inode, uint64_t first, uint64_t last) {
+	extent_cursor cur;
+	if ((first >= last) || (inode->hole_blocks == 0) ||
+	    !seek_cursor(inode, first * A1FS_BLOCK_SIZE, &cur)) { return 0; }
+	fs_ctx *fs = get_fs();
+	a1fs_superblock *sb = (a1fs_superblock *) fs->image;
+	extent_leaf *leaf = &cur.leaf;
+
+	int ret = 0;
+	bool changed = false;
+	uint64_t lblk = first - cur.block;
+	uint32_t i = cur.slot;
+	while (lblk < last) {
+		if (i >= leaf->nslots) {
+			if (!next_leaf(leaf)) { break; }
+			i = 0;
+			continue;
+		}
+		a1fs_blk_t len = a1fs_extent_len(&leaf->extents[i]);
+		uint64_t ext_first = lblk;
+		lblk += len;
+		if ((len == 0) || !a1fs_extent_hole(&leaf->extents[i])) {
+			i++;
+			continue;
+		}
+
+		// Split off the parts of the hole outside the range
+		a1fs_blk_t from = (first > ext_first) ? first - ext_first : 0;
+		a1fs_blk_t to = ((last < lblk) ? last : lblk) - ext_first;
+		uint32_t extra = (from > 0) + (to < len);
+		if (extra > 0) {
+			if (leaf_insert(inode, leaf, &i, extra) != 0) { ret = -ENOSPC; break; }
+			changed = true;
+			if (from > 0) {
+				leaf->extents[i].count = from;
+				i++;
+			}
+			leaf->extents[i].count = to - from;
+			if (to < len) { leaf->extents[i + 1].count = len - to; }
+		}
+		changed = true;
+
+		// Replace the hole in slot i with runs of blocks
+		a1fs_blk_t left = to - from;
+		while (left > 0) {
+			uint32_t n = group_avail_blocks(&fs->groups);
+			if (n == 0) { ret = -ENOSPC; goto out; }
+			if (n > left) { n = left; }
+			long bit = alloc_run_after(inode, (i > 0) ? &leaf->extents[i - 1] : NULL, &n);
+			if (bit < 0) { ret = (int)bit; goto out; }
+			a1fs_blk_t start = (a1fs_blk_t)(sb->bg_data_block + bit);
+			inode->hole_blocks -= n;
+			left -= n;
+
+			a1fs_extent *extents = leaf->extents;
+			a1fs_extent *prev = (i > 0) ? &extents[i - 1] : NULL;
+			if ((prev != NULL) && !a1fs_extent_hole(prev) && a1fs_extent_unwritten(prev) &&
+			    (prev->start + a1fs_extent_len(prev) == start) &&
+			    (a1fs_extent_len(prev) + n < A1FS_EXTENT_UNWRITTEN))
+			{
+				prev->count += n;
+				if (left > 0) {
+					extents[i].count = left;
+					continue;
+				}
+				leaf_remove(inode, leaf, i);
+				i--;
+			} else if (left == 0) {
+				extents[i].start = start;
+				extents[i].count = n | A1FS_EXTENT_UNWRITTEN;
+			} else if (leaf_insert(inode, leaf, &i, 1) == 0) {
+				extents = leaf->extents;
+				extents[i].start = start;
+				extents[i].count = n | A1FS_EXTENT_UNWRITTEN;
+				i++;
+				extents[i].count = left;
+			} else {
+				free_data_blocks(start, n);
+				inode->hole_blocks += n;
+				ret = -ENOSPC;
+				goto out;
+			}
+		}
+		lblk = ext_first + to;
+		i++;
+	}
+out:
+	if (changed) { emap_invalidate(&fs->emaps, get_ino_num(inode)); }
+	return ret;
+}
+
+/**
+ * Prepare a range of a file for writing: allocate blocks for the holes it
+ * overlaps and convert the unwritten extents into written ones.
+ *
+ * The converted blocks that the write only covers partially are zeroed, so
+ * that the rest of them still reads as zeros.
+ *
+ * Errors:
+ *   ENOSPC  not enough free blocks, or the extent tree is full.
+ *
+ * @param inode   the file inode, locked for writing.
+ * @param offset  file offset of the write.
+ * @param size    number of bytes to write.
+ * @return        0 on success; -errno on error.
+ */
+int prepare_write(a1fs_inode *inode, uint64_t offset, size_t size) {
+	if (size == 0) { return 0; }
+	uint64_t first = offset / A1FS_BLOCK_SIZE;
+	uint64_t last = (offset + size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+	int ret = fill_holes(inode, first, last);
+	if (ret != 0) { return ret; }
+	extent_cursor cur;
+	if (!seek_cursor(inode, offset, &cur)) { return 0; }
+	extent_leaf *leaf = &cur.leaf;
+	bool head = (offset % A1FS_BLOCK_SIZE) != 0;
+	bool tail = ((offset + size) % A1FS_BLOCK_SIZE) != 0;
+
+	bool changed = false;
+	uint64_t lblk = first - cur.block;
+	uint32_t i = cur.slot;
+	while (lblk < last) {
+		if (i >= leaf->nslots) {
+			if (!next_leaf(leaf)) { break; }
+			i = 0;
+			continue;
+		}
+		a1fs_extent *ext = &leaf->extents[i];
+		a1fs_blk_t len = a1fs_extent_len(ext);
+		uint64_t ext_first = lblk;
+		lblk += len;
+		if (!a1fs_extent_unwritten(ext)) {
+			i++;
+			continue;
+		}
+
+		a1fs_blk_t from = (first > ext_first) ? first - ext_first : 0;
+		a1fs_blk_t to = ((last < lblk) ? last : lblk) - ext_first;
+		if (head && (ext_first + from == first)) { zero_extent_blocks(ext, from, from + 1); }
+		if (tail && (ext_first + to == last)) { zero_extent_blocks(ext, to - 1, to); }
+		a1fs_blk_t end;
+		i = split_unwritten(inode, leaf, i, from, to, &end) + 1;
+		lblk = ext_first + end;
+		changed = true;
+	}
+	if (changed) { emap_invalidate(&get_fs()->emaps, get_ino_num(inode)); }
+	return 0;
+}
+
+/** Number of fixed size directory entries in a block. */
+#define DENTRIES_PER_BLOCK (A1FS_BLOCK_SIZE / sizeof(a1fs_dentry))
+
+// Hash a file name with the hash seed of the file system
+uint32_t name_hash(const char *name) {
+	a1fs_superblock *sb = (a1fs_superblock *)get_fs()->image;
+	return a1fs_name_hash(name, sb->s_hash_seed);
+}
+
+/** A directory entry as seen by the directory block helpers below. */
+typedef struct dir_rec {
+	/** Inode number. */
+	a1fs_ino_t ino;
+	/** Name hash. */
+	uint32_t hash;
+	/** File name. A null-terminated string. */
+	const char *name;
+} dir_rec;
+
+// Check whether directory blocks hold compact (a1fs_dirent) records
+bool compact_dirents(void) {
+	a1fs_superblock *sb = (a1fs_superblock *)get_fs()->image;
+	return (sb->s_features & A1FS_FEATURE_COMPACT_DIRENT) != 0;
+}
+
+// Get the record at byte offset off of a compact directory block
+a1fs_dirent *dirent_at(char *block, uint32_t off) {
+	return (a1fs_dirent *)(block + off);
+}
+
+// Check whether a compact record is the given name; compares the hash and
+// length first so that most records are rejected without looking at the name
+bool dirent_match(a1fs_dirent *de, const char *name, size_t len, uint32_t hash) {
+	return de->ino != 0 && de->hash == hash && de->name_len == len &&
+	       memcmp(de->name, name, len) == 0;
+}
+
+// Find a name in a directory block, return its inode number or 0 if absent
+a1fs_ino_t dirblock_find(char *block, const char *name, uint32_t hash) {
+	if (compact_dirents()) {
+		size_t len = strlen(name);
+		for (uint32_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+			a1fs_dirent *de = dirent_at(block, off);
+			if (de->rec_len == 0) {break;}
+			if (dirent_match(de, name, len, hash)) {return de->ino;}
+			off += de->rec_len;
+		}
+		return 0;
+	}
+
+	a1fs_dentry *dentries = (a1fs_dentry *)block;
+	for (uint32_t i = 0; i < DENTRIES_PER_BLOCK; i++) {
+		if (dentries[i].ino != 0 && strcmp(dentries[i].name, name) == 0) {
+			return dentries[i].ino;
+		}
+	}
+	return 0;
+}
+
+// Add an entry to a directory block, return false if the block is full
+bool dirblock_add(char *block, const char *name, uint32_t hash, a1fs_ino_t ino) {
+	if (compact_dirents()) {
+		size_t len = strlen(name);
+		uint32_t need = A1FS_DIRENT_LEN(len);
+		for (uint32_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+			a1fs_dirent *de = dirent_at(block, off);
+			if (de->rec_len == 0) {break;}
+			uint32_t used = de->ino != 0 ? A1FS_DIRENT_LEN(de->name_len) : 0;
+			if (de->rec_len - used >= need) {
+				// Take the free record, or split the slack off the end of a used one
+				if (used != 0) {
+					a1fs_dirent *next = dirent_at(block, off + used);
+					next->rec_len = de->rec_len - used;
+					de->rec_len = used;
+					de = next;
+				}
+				de->ino = ino;
+				de->name_len = len;
+				de->reserved = 0;
+				de->hash = hash;
+				memcpy(de->name, name, len + 1);
+				return true;
+			}
+			off += de->rec_len;
+		}
+		return false;
+	}
+
+	a1fs_dentry *dentries = (a1fs_dentry *)block;
+	for (uint32_t i = 0; i < DENTRIES_PER_BLOCK; i++) {
+		if (dentries[i].ino == 0) {
+			dentries[i].ino = ino;
+			strcpy(dentries[i].name, name);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Remove a name from a directory block, return its inode number or 0 if absent
+a1fs_ino_t dirblock_remove(char *block, const char *name, uint32_t hash) {
+	if (compact_dirents()) {
+		size_t len = strlen(name);
+		a1fs_dirent *prev = NULL;
+		for (uint32_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+			a1fs_dirent *de = dirent_at(block, off);
+			if (de->rec_len == 0) {break;}
+			if (dirent_match(de, name, len, hash)) {
+				a1fs_ino_t ino = de->ino;
+				// Give the space back to the previous record
+				if (prev != NULL) {
+					prev->rec_len += de->rec_len;
+				} else {
+					de->ino = 0;
+				}
+				return ino;
+			}
+			prev = de;
+			off += de->rec_len;
+		}
+		return 0;
+	}
+
+	a1fs_dentry *dentries = (a1fs_dentry *)block;
+	for (uint32_t i = 0; i < DENTRIES_PER_BLOCK; i++) {
+		if (dentries[i].ino != 0 && strcmp(dentries[i].name, name) == 0) {
+			a1fs_ino_t ino = dentries[i].ino;
+			dentries[i].ino = 0;
+			dentries[i].name[0] = '\0';
+			return ino;
+		}
+	}
+	return 0;
+}
+
+// Point the entry for a name in a directory block to another inode, return
+// the inode number it had or 0 if the name is absent
+a1fs_ino_t dirblock_replace(char *block, const char *name, uint32_t hash, a1fs_ino_t ino) {
+	if (compact_dirents()) {
+		size_t len = strlen(name);
+		for (uint32_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+			a1fs_dirent *de = dirent_at(block, off);
+			if (de->rec_len == 0) {break;}
+			if (dirent_match(de, name, len, hash)) {
+				a1fs_ino_t old = de->ino;
+				de->ino = ino;
+				return old;
+			}
+			off += de->rec_len;
+		}
+		return 0;
+	}
+
+	a1fs_dentry *dentries = (a1fs_dentry *)block;
+	for (uint32_t i = 0; i < DENTRIES_PER_BLOCK; i++) {
+		if (dentries[i].ino != 0 && strcmp(dentries[i].name, name) == 0) {
+			a1fs_ino_t old = dentries[i].ino;
+			dentries[i].ino = ino;
+			return old;
+		}
+	}
+	return 0;
+}
+
+// Make a directory block empty
+void dirblock_init(char *block) {
+	if (compact_dirents()) {
+		a1fs_dirent *de = dirent_at(block, 0);
+		de->ino = 0;
+		de->rec_len = A1FS_BLOCK_SIZE;
+		de->name_len = 0;
+		return;
+	}
+
+	a1fs_dentry *dentries = (a1fs_dentry *)block;
+	for (uint32_t i = 0; i < DENTRIES_PER_BLOCK; i++) {
+		dentries[i].ino = 0;
+		dentries[i].name[0] = '\0';
+	}
+}
+
+// List the entries of a directory block into recs (which must have room for
+// DIRBLOCK_MAX_RECS entries), return the number of entries
+uint32_t dirblock_list(char *block, dir_rec *recs) {
+	uint32_t n = 0;
+	if (compact_dirents()) {
+		for (uint32_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+			a1fs_dirent *de = dirent_at(block, off);
+			if (de->rec_len == 0) {break;}
+			if (de->ino != 0) {
+				recs[n].ino = de->ino;
+				recs[n].name = de->name;
+				recs[n].hash = de->hash;
+				n++;
+			}
+			off += de->rec_len;
+		}
+		return n;
+	}
+
+	a1fs_dentry *dentries = (a1fs_dentry *)block;
+	for (uint32_t i = 0; i < DENTRIES_PER_BLOCK; i++) {
+		if (dentries[i].ino != 0) {
+			recs[n].ino = dentries[i].ino;
+			recs[n].name = dentries[i].name;
+			recs[n].hash = name_hash(dentries[i].name);
+			n++;
+		}
+	}
+	return n;
+}
+
+// Space an entry for the name takes in a directory block
+uint32_t dirblock_rec_size(const char *name) {
+	return compact_dirents() ? A1FS_DIRENT_LEN(strlen(name)) : sizeof(a1fs_dentry);
+}
+
+// Maximum number of entries dirblock_list() can return
+#define DIRBLOCK_MAX_RECS (A1FS_BLOCK_SIZE / A1FS_DIRENT_LEN(1))
+
+/**
+ * Append empty blocks to a directory.
+ *
+ * Errors:
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param dir    the directory inode.
+ * @param count  number of blocks to add.
+ * @return       logical block number of the first new block on success;
+ *               -errno on error.
+ */
+long dir_grow(a1fs_inode *dir, uint32_t count) {
+	uint64_t first = inode_nblocks(dir);
+	int ret = alloc_file_blocks(dir, count, 0);
+	if (ret != 0) {return ret;}
+	for (uint32_t i = 0; i < count; i++) {
+		dirblock_init(get_file_block(dir, first + i));
+	}
+	dir->size += (uint64_t)count * A1FS_BLOCK_SIZE;
+	return (long)first;
+}
+
+/** Position in one index node on the path from the root to a leaf. */
+typedef struct dx_frame {
+	/** The index node. */
+	a1fs_dx_node *node;
+	/** Entry followed down from this node. */
+	uint32_t pos;
+} dx_frame;
+
+/**
+ * Walk the hash index of a directory from the root down to the leaf block
+ * that holds (or would hold) names with the given hash.
+ *
+ * Errors:
+ *   EIO  the index is corrupted.
+ *
+ * @param dir     the directory inode.
+ * @param hash    name hash.
+ * @param frames  array of A1FS_DX_MAX_LEVELS + 1 frames that receives the path.
+ * @param depth   pointer to the variable that receives the number of frames.
+ * @return        logical block number of the leaf on success; -errno on error.
+ */
+long dx_descend(a1fs_inode *dir, uint32_t hash, dx_frame *frames, int *depth) {
+	a1fs_dx_node *node = (a1fs_dx_node *)get_file_block(dir, 0);
+	for (int d = 0; d <= A1FS_DX_MAX_LEVELS; d++) {
+		if (node == NULL || node->count == 0 || node->count > A1FS_DX_LIMIT) {return -EIO;}
+		// Binary search for the last entry with entry hash <= hash
+		uint32_t lo = 0, hi = node->count;
+		while (hi - lo > 1) {
+			uint32_t mid = lo + (hi - lo) / 2;
+			if (node->entries[mid].hash <= hash) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+		frames[d].node = node;
+		frames[d].pos = lo;
+		if (node->levels == 0) {
+			*depth = d + 1;
+			return node->entries[lo].block;
+		}
+		node = (a1fs_dx_node *)get_file_block(dir, node->entries[lo].block);
+	}
+	return -EIO;
+}
+
+/**
+ * Move the entries of a full root one level down into a new index node, so
+ * that the root has room again. The path in frames is updated accordingly.
+ *
+ * @param dir         the directory inode.
+ * @param frames      path from the root, as returned by dx_descend().
+ * @param depth       pointer to the number of frames; incremented.
+ * @param next_block  pointer to the next reserved logical block number.
+ */
+void dx_grow_root(a1fs_inode *dir, dx_frame *frames, int *depth, uint32_t *next_block) {
+	a1fs_dx_node *root = frames[0].node;
+	uint32_t child_blk = (*next_block)++;
+	a1fs_dx_node *child = (a1fs_dx_node *)get_file_block(dir, child_blk);
+	memcpy(child, root, A1FS_BLOCK_SIZE);
+	root->levels++;
+	root->count = 1;
+	root->entries[0].hash = 0;
+	root->entries[0].block = child_blk;
+
+	for (int i = *depth; i > 0; i--) {
+		frames[i] = frames[i - 1];
+	}
+	frames[0].pos = 0;
+	frames[1].node = child;
+	(*depth)++;
+}
+
+/**
+ * Insert an index entry right after the entry followed down from a node,
+ * splitting full nodes on the way up. The root must not be full.
+ *
+ * The caller must have reserved enough new blocks (see dx_blocks_needed());
+ * they are taken from *next_block onwards.
+ *
+ * @param dir         the directory inode.
+ * @param frames      path from the root, as returned by dx_descend().
+ * @param f           index of the frame of the node to insert into.
+ * @param entry       the new entry.
+ * @param next_block  pointer to the next reserved logical block number.
+ */
+void dx_insert(a1fs_inode *dir, dx_frame *frames, int f, a1fs_dx_entry entry,
+               uint32_t *next_block) {
+	a1fs_dx_node *node = frames[f].node;
+	if (node->count == A1FS_DX_LIMIT) {
+		assert(f > 0);
+		// Split the node in two halves and link the new half from the parent
+		uint32_t sibling_blk = (*next_block)++;
+		a1fs_dx_node *sibling = (a1fs_dx_node *)get_file_block(dir, sibling_blk);
+		uint32_t half = node->count / 2;
+		sibling->levels = node->levels;
+		sibling->count = node->count - half;
+		sibling->reserved = 0;
+		memcpy(sibling->entries, &node->entries[half], sibling->count * sizeof(a1fs_dx_entry));
+		node->count = half;
+
+		a1fs_dx_entry link = { sibling->entries[0].hash, sibling_blk };
+		dx_insert(dir, frames, f - 1, link, next_block);
+		if (frames[f].pos >= half) {
+			frames[f].node = sibling;
+			frames[f].pos -= half;
+		}
+		node = frames[f].node;
+	}
+
+	uint32_t pos = frames[f].pos + 1;
+	memmove(&node->entries[pos + 1], &node->entries[pos], (node->count - pos) * sizeof(a1fs_dx_entry));
+	node->entries[pos] = entry;
+	node->count++;
+}
+
+// Number of new blocks needed to split a leaf and insert a link to the new
+// half into the index described by frames
+uint32_t dx_blocks_needed(dx_frame *frames, int depth) {
+	uint32_t needed = 1;
+	for (int f = depth - 1; f >= 0; f--) {
+		if (frames[f].node->count < A1FS_DX_LIMIT) {return needed;}
+		needed++;
+	}
+	// The root has to grow a level
+	return needed + 1;
+}
+
+// Compare dir_recs by hash, for qsort()
+int dir_rec_cmp(const void *a, const void *b) {
+	uint32_t ha = ((const dir_rec *)a)->hash, hb = ((const dir_rec *)b)->hash;
+	return (ha > hb) - (ha < hb);
+}
+
+/**
+ * Add an entry to a hash-indexed directory, splitting the leaf if it is full.
+ *
+ * Errors:
+ *   EIO     the index is corrupted.
+ *   ENOSPC  not enough free space in the file system, the index is full, or
+ *           the leaf is full of names with the same hash.
+ *
+ * @return  0 on success; -errno on error.
+ */
+int dx_add(a1fs_inode *dir, const char *name, uint32_t hash, a1fs_ino_t ino) {
+	dx_frame frames[A1FS_DX_MAX_LEVELS + 1];
+	int depth;
+	long leaf_blk = dx_descend(dir, hash, frames, &depth);
+	if (leaf_blk < 0) {return leaf_blk;}
+	char *leaf = get_file_block(dir, leaf_blk);
+	if (leaf == NULL) {return -EIO;}
+	if (dirblock_add(leaf, name, hash, ino)) {return 0;}
+
+	// The leaf is full: sort its entries and the new one by hash, and move the
+	// upper half (by space used) to a new leaf, without separating names with
+	// equal hashes
+	char old_leaf[A1FS_BLOCK_SIZE];
+	memcpy(old_leaf, leaf, A1FS_BLOCK_SIZE);
+	dir_rec recs[DIRBLOCK_MAX_RECS + 1];
+	uint32_t n = dirblock_list(old_leaf, recs);
+	recs[n].ino = ino;
+	recs[n].hash = hash;
+	recs[n].name = name;
+	n++;
+	qsort(recs, n, sizeof(dir_rec), dir_rec_cmp);
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		total += dirblock_rec_size(recs[i].name);
+	}
+	uint32_t split = 0, lower = 0;
+	while (split < n && lower < total / 2) {
+		lower += dirblock_rec_size(recs[split++].name);
+	}
+	if (split == n) {lower -= dirblock_rec_size(recs[--split].name);}
+	while (split < n && split > 0 && recs[split].hash == recs[split - 1].hash) {
+		lower += dirblock_rec_size(recs[split++].name);
+	}
+	while (split > 0 && (split == n || recs[split].hash == recs[split - 1].hash)) {
+		lower -= dirblock_rec_size(recs[--split].name);
+	}
+	if (split == 0 || lower > A1FS_BLOCK_SIZE || total - lower > A1FS_BLOCK_SIZE) {
+		return -ENOSPC;
+	}
+
+	uint32_t needed = dx_blocks_needed(frames, depth);
+	if (frames[0].node->levels + (needed > (uint32_t)depth ? 1 : 0) > A1FS_DX_MAX_LEVELS) {
+		return -ENOSPC;
+	}
+	// Reserve all the blocks up front so that the split cannot fail half way
+	long first = dir_grow(dir, needed);
+	if (first < 0) {return first;}
+	uint32_t next_block = first;
+
+	if (needed > (uint32_t)depth) {
+		// Every index node on the path is full
+		dx_grow_root(dir, frames, &depth, &next_block);
+	}
+	uint32_t new_leaf_blk = next_block++;
+	char *new_leaf = get_file_block(dir, new_leaf_blk);
+	dirblock_init(leaf);
+	for (uint32_t i = 0; i < n; i++) {
+		dirblock_add(i < split ? leaf : new_leaf, recs[i].name, recs[i].hash, recs[i].ino);
+	}
+	a1fs_dx_entry link = { recs[split].hash, new_leaf_blk };
+	dx_insert(dir, frames, depth - 1, link, &next_block);
+	return 0;
+}
+
+/**
+ * Convert a directory with a single full block into a hash-indexed directory.
+ *
+ * The entries are moved to a new leaf block and block 0 becomes the root of
+ * the index, with a single entry covering all hashes.
+ *
+ * @return  0 on success; -errno on error.
+ */
+int dx_convert(a1fs_inode *dir) {
+	long leaf_blk = dir_grow(dir, 1);
+	if (leaf_blk < 0) {return leaf_blk;}
+	char *root_block = get_file_block(dir, 0);
+	memcpy(get_file_block(dir, leaf_blk), root_block, A1FS_BLOCK_SIZE);
+
+	a1fs_dx_node *root = (a1fs_dx_node *)root_block;
+	memset(root, 0, A1FS_BLOCK_SIZE);
+	root->levels = 0;
+	root->count = 1;
+	root->entries[0].hash = 0;
+	root->entries[0].block = leaf_blk;
+	dir->flags |= A1FS_INODE_DIR_INDEX;
+	return 0;
+}
+
+// Look up a name in a directory, return its inode number or 0 if absent
+a1fs_ino_t dir_lookup(a1fs_inode *dir, const char *name) {
+	uint32_t hash = name_hash(name);
+	if (dir->flags & A1FS_INODE_DIR_INDEX) {
+		dx_frame frames[A1FS_DX_MAX_LEVELS + 1];
+		int depth;
+		long leaf_blk = dx_descend(dir, hash, frames, &depth);
+		if (leaf_blk < 0) {return 0;}
+		char *leaf = get_file_block(dir, leaf_blk);
+		return leaf == NULL ? 0 : dirblock_find(leaf, name, hash);
+	}
+
+	uint64_t nblocks = inode_nblocks(dir);
+	for (uint64_t i = 0; i < nblocks; i++) {
+		a1fs_ino_t ino = dirblock_find(get_file_block(dir, i), name, hash);
+		if (ino != 0) {return ino;}
+	}
+	return 0;
+}
+
+/**
+ * Add an entry to a directory.
+ *
+ * A directory whose only block is full is converted to a hash-indexed one if
+ * the file system has the dir_index feature; otherwise it grows by a block.
+ *
+ * Errors:
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @return  0 on success; -errno on error.
+ */
+int dir_add(a1fs_inode *dir, const char *name, a1fs_ino_t ino) {
+	fs_ctx *fs = get_fs();
+	a1fs_superblock *sb = (a1fs_superblock *)fs->image;
+	uint32_t hash = name_hash(name);
+	if (dir->flags & A1FS_INODE_DIR_INDEX) {
+		return dx_add(dir, name, hash, ino);
+	}
+
+	uint64_t nblocks = inode_nblocks(dir);
+	for (uint64_t i = 0; i < nblocks; i++) {
+		if (dirblock_add(get_file_block(dir, i), name, hash, ino)) {return 0;}
+	}
+	if (nblocks == 1 && (sb->s_features & A1FS_FEATURE_DIR_INDEX)) {
+		int ret = dx_convert(dir);
+		if (ret != 0) {return ret;}
+		return dx_add(dir, name, hash, ino);
+	}
+	long blk = dir_grow(dir, 1);
+	if (blk < 0) {return blk;}
+	dirblock_add(get_file_block(dir, blk), name, hash, ino);
+	return 0;
+}
+
+// Remove a name from a directory, return its inode number or 0 if absent
+a1fs_ino_t dir_remove(a1fs_inode *dir, const char *name) {
+	uint32_t hash = name_hash(name);
+	if (dir->flags & A1FS_INODE_DIR_INDEX) {
+		dx_frame frames[A1FS_DX_MAX_LEVELS + 1];
+		int depth;
+		long leaf_blk = dx_descend(dir, hash, frames, &depth);
+		if (leaf_blk < 0) {return 0;}
+		char *leaf = get_file_block(dir, leaf_blk);
+		return leaf == NULL ? 0 : dirblock_remove(leaf, name, hash);
+	}
+
+	uint64_t nblocks = inode_nblocks(dir);
+	for (uint64_t i = 0; i < nblocks; i++) {
+		a1fs_ino_t ino = dirblock_remove(get_file_block(dir, i), name, hash);
+		if (ino != 0) {return ino;}
+	}
+	return 0;
+}
+
+// Point the entry for a name in a directory to another inode, return the inode
+// number it had or 0 if the name is absent
+a1fs_ino_t dir_replace(a1fs_inode *dir, const char *name, a1fs_ino_t ino) {
+	uint32_t hash = name_hash(name);
+	if (dir->flags & A1FS_INODE_DIR_INDEX) {
+		dx_frame frames[A1FS_DX_MAX_LEVELS + 1];
+		int depth;
+		long leaf_blk = dx_descend(dir, hash, frames, &depth);
+		if (leaf_blk < 0) {return 0;}
+		char *leaf = get_file_block(dir, leaf_blk);
+		return leaf == NULL ? 0 : dirblock_replace(leaf, name, hash, ino);
+	}
+
+	uint64_t nblocks = inode_nblocks(dir);
+	for (uint64_t i = 0; i < nblocks; i++) {
+		a1fs_ino_t old = dirblock_replace(get_file_block(dir, i), name, hash, ino);
+		if (old != 0) {return old;}
+	}
+	return 0;
+}
+
+// Call filler() for every entry in the subtree of an index node
+void dx_fill(a1fs_inode *dir, a1fs_dx_node *node, void *buf, fuse_fill_dir_t filler) {
+	for (uint32_t i = 0; i < node->count && i < A1FS_DX_LIMIT; i++) {
+		char *child = get_file_block(dir, node->entries[i].block);
+		if (child == NULL) {continue;}
+		if (node->levels > 0) {
+			dx_fill(dir, (a1fs_dx_node *)child, buf, filler);
+			continue;
+		}
+		dir_rec recs[DIRBLOCK_MAX_RECS];
+		uint32_t n = dirblock_list(child, recs);
+		for (uint32_t j = 0; j < n; j++) {
+			filler(buf, recs[j].name, NULL, 0);
+		}
+	}
+}
+
+// Call filler() for every entry in a directory
+void dir_fill(a1fs_inode *dir, void *buf, fuse_fill_dir_t filler) {
+	if (dir->flags & A1FS_INODE_DIR_INDEX) {
+		a1fs_dx_node *root = (a1fs_dx_node *)get_file_block(dir, 0);
+		if (root != NULL) {dx_fill(dir, root, buf, filler);}
+		return;
+	}
+
+	uint64_t nblocks = inode_nblocks(dir);
+	for (uint64_t i = 0; i < nblocks; i++) {
+		dir_rec recs[DIRBLOCK_MAX_RECS];
+		uint32_t n = dirblock_list(get_file_block(dir, i), recs);
+		for (uint32_t j = 0; j < n; j++) {
+			filler(buf, recs[j].name, NULL, 0);
+		}
+	}
+}
+
+
+// Get the mode of an inode that may be modified concurrently (see seqcount.h)
+__attribute__((no_sanitize_thread))
+mode_t inode_mode_racy(const a1fs_inode *inode) {
+	return inode->mode;
+}
+
+/**
+ * Get inode number by absolute path.
+ *
+ * If cached_only is true, no locks are taken and only the dentry cache is
+ * used: the path is resolved if it is cached as a whole, and found not to
+ * exist if a component is cached as not existing. The caller validates the
+ * result with the ns_lock sequence counter (see fs_ctx.h).
+ * 
+ * Errors:
+ *   ENAMETOOLONG  the path or one of its components is too long.
+ *   ENOENT        a component of the path does not exist.
+ *   ENOTDIR       a component of the path prefix is not a directory.
+ *   EAGAIN        cached_only is true and the path is not cached.
+ * 
+ * @param path         path to any file in the file syste.
+ * @param cached_only  whether to give up instead of searching directories.
+ * @return             inode number represented by the path on success; -errno on error;
+ */
+long resolve_path(const char *path, bool cached_only) {
+	
+	if (strlen(path) >= A1FS_PATH_MAX) {
+		return -ENAMETOOLONG;
+	}
+
+	// path is just "/"
+	if (strcmp(path, "/") == 0) {
+		// Root inode number is 1
+		return 1;
+	}
+
+	// Continuing from here, path = "/..."
+
+	// get the address to the beginning of file system
+	fs_ctx *fs = get_fs();
+
+	// Taken first, so that the path is not cached if it is removed meanwhile
+	uint64_t snapshot = dcache_path_snapshot(&fs->dcache);
+	a1fs_ino_t cached_ino;
+	if (dcache_lookup_path(&fs->dcache, path, &cached_ino)) {
+		return cached_ino;
+	}
+
+	// Start with the Root inode
+	a1fs_ino_t  curr_ino_t = 1;
+	a1fs_inode  *curr_inode;
+
+	// Make of a copy to the path, since strtok_r is destructive
+	char cpy_path[strlen(path) + 1];
+	strcpy(cpy_path, path);
+	char delim[] = "/";
+	char *saveptr;
+	char *pathComponent = strtok_r(cpy_path, delim, &saveptr);
+	// Using do-while loop since curr_inode would be root inode initially, thus
+	// iterating at least once.
+	do {
+		curr_inode = get_inode(curr_ino_t);
+		// If the path prefix is not a dir
+		mode_t mode = cached_only ? inode_mode_racy(curr_inode) : curr_inode->mode;
+		if ((mode & __S_IFDIR) <= 0) {
+			return -ENOTDIR;
+		}
+		size_t compo_len = strlen(pathComponent);
+		if (compo_len >= A1FS_NAME_MAX) {
+			return -ENAMETOOLONG;
+		}
+		// Try the dentry cache before scanning the directory
+		if (dcache_lookup(&fs->dcache, curr_ino_t, pathComponent, compo_len, &cached_ino)) {
+			// Negative entry, the name is known not to exist
+			if (cached_ino == 0) {
+				return -ENOENT;
+			}
+			curr_ino_t = cached_ino;
+			pathComponent = strtok_r(NULL, delim, &saveptr);
+			continue;
+		}
+		if (cached_only) {
+			return -EAGAIN;
+		}
+		// Cache the result while the directory cannot change under us
+		fs_lock_inode(fs, curr_ino_t, false);
+		a1fs_ino_t found = dir_lookup(curr_inode, pathComponent);
+		dcache_insert(&fs->dcache, curr_ino_t, pathComponent, compo_len, found);
+		fs_unlock_inode(fs, curr_ino_t);
+		if (found == 0) {
+			// The miss is remembered, creating the name replaces the entry
+			return -ENOENT;
+		}
+		curr_ino_t = found;
+
+		pathComponent = strtok_r(NULL, delim, &saveptr);
+		
+	} while (pathComponent != NULL);
+
+	// The full path can only be cached safely with the locks held
+	if (cached_only) {
+		return -EAGAIN;
+	}
+	dcache_insert_path(&fs->dcache, path, curr_ino_t, snapshot);
+	return (long) curr_ino_t;
+}
+
+// Get inode number by absolute path; see resolve_path()
+long get_ino_num_by_path(const char *path) {
+	return resolve_path(path, false);
+}
+
+// Return the parent directory's inode number
+long get_parent_dir_ino_num_by_path(const char *path) {
+
+	// cut the last component which is the directory name we want to create
+	char parent_path[strlen(path) + 1];
+	strcpy(parent_path, path);
+	char *ptr = strrchr(parent_path, '/');
+	if (ptr != parent_path){
+		ptr[0] = '\0';
+	} else {
+		ptr[1] = '\0';
+	}
+
+	return (long) get_ino_num_by_path(parent_path);
+}
+
+/**
+ * Resolve a path and lock its inode, with the directory tree locked by the
+ * caller.
+ *
+ * The inode may be removed (see kill_inode()) after the path is resolved and
+ * before it is locked; the path is then resolved again. The operation that
+ * removed it dropped the cached path before unlocking the inode, so this finds
+ * the file that replaced it, if any, or that the path does not exist.
+ *
+ * Errors: as for resolve_path().
+ *
+ * @param path   path to a file or directory.
+ * @param write  whether to lock the inode for writing.
+ * @return       inode number on success; -errno on error.
+ */
+long lock_path(const char *path, bool write) {
+	fs_ctx *fs = get_fs();
+	for (;;) {
+		long ino = get_ino_num_by_path(path);
+		if (ino < 0) {return ino;}
+		fs_lock_inode(fs, ino, write);
+		if (get_inode(ino)->links != 0) {return ino;}
+		fs_unlock_inode(fs, ino);
+	}
+}
+
+/**
+ * Get file system statistics.
+ *
+ * Implements the statvfs() system call. See "man 2 statvfs" for details.
+ * The f_bfree and f_bavail fields should be set to the same value.
+ * The f_ffree and f_favail fields should be set to the same value.
+ * The f_fsid and f_flag fields are ignored.
+ *
+ * @param path  path to any file in the file system. Can be ignored.
+ * @param st    pointer to the struct statvfs that receives the result.
+ * @return      0 on success; -errno on error.
+ */
+
+static int a1fs_statfs(const char *path, struct statvfs *st)
+{
+	(void)path;// unused
+	fs_ctx *fs = get_fs();
+
+	memset(st, 0, sizeof(*st));
+	st->f_bsize   = A1FS_BLOCK_SIZE;
+	st->f_frsize  = A1FS_BLOCK_SIZE;
+	a1fs_superblock *sb = fs->image;
+	st->f_blocks = sb->size / A1FS_BLOCK_SIZE;
+	// Blocks reserved for buffered data are as good as used
+	st->f_bfree = group_avail_blocks(&fs->groups);
+	st->f_files = sb->s_inodes_count;
+	// Removed inodes are as good as free
+	pthread_mutex_lock(&fs->dead_lock);
+	st->f_ffree = sb->s_free_inodes_count + fs->dead_count;
+	pthread_mutex_unlock(&fs->dead_lock);
+	st->f_namemax = A1FS_NAME_MAX;
+
+	return 0;
+}
+
+// Fill in the attributes of an inode. The inode may be modified concurrently
+// if it is not locked; the caller then validates the copy (see seqcount.h).
+__attribute__((no_sanitize_thread))
+void inode_read_attrs(const a1fs_inode *inode, struct stat *st) {
+	st->st_mode = inode->mode;
+	st->st_nlink = (nlink_t)(inode->links);
+	blkcnt_t sectors_used = (blkcnt_t)(inode->size / 512);
+	if (inode->size % 512 != 0)
+		sectors_used++;
+	// Holes and data stored in the inode take no space
+	if (inode->flags & A1FS_INODE_INLINE_DATA) {
+		sectors_used = 0;
+	} else if (inode->hole_blocks != 0) {
+		uint64_t blocks = (inode->size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+		sectors_used = (blocks > inode->hole_blocks) ? (blocks - inode->hole_blocks) * (A1FS_BLOCK_SIZE / 512) : 0;
+	}
+	st->st_blocks = sectors_used;
+	st->st_mtime = inode->mtime.tv_sec;
+	st->st_size = inode->size;
+}
+
+/**
+ * Get file or directory attributes without taking any locks.
+ *
+ * The path is resolved through the dentry cache and the attributes are copied
+ * under the inode's sequence counter; the result is thrown away if a writer
+ * changed the directory tree or the inode in the meantime. Gives up if a name
+ * is not cached or writers keep getting in the way.
+ *
+ * @param path  path to a file or directory.
+ * @param st    pointer to the struct stat that receives the result.
+ * @param ret   pointer to the variable that receives 0 or -errno.
+ * @return      true if the result is valid; false if the caller must fall
+ *              back to locking.
+ */
+bool getattr_lockless(const char *path, struct stat *st, int *ret) {
+	fs_ctx *fs = get_fs();
+
+	for (int attempt = 0; attempt < A1FS_SEQ_RETRIES; attempt++) {
+		uint32_t ns_start = seqcount_read_begin(&fs->ns_seq);
+		long ino = resolve_path(path, true);
+		if (ino == -EAGAIN) {
+			return false;
+		}
+		if (ino > 0) {
+			a1fs_inode *inode = get_inode(ino);
+			seqcount *seq = fs_inode_seq(fs, ino);
+			uint32_t start = seqcount_read_begin(seq);
+			inode_read_attrs(inode, st);
+			if (seqcount_read_retry(seq, start)) {
+				continue;
+			}
+			// Removed after the path was resolved; see lock_path()
+			if (st->st_nlink == 0) {
+				return false;
+			}
+		}
+		if (!seqcount_read_retry(&fs->ns_seq, ns_start)) {
+			*ret = (ino < 0) ? (int)ino : 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Get file or directory attributes.
+ *
+ * Implements the stat() system call. See "man 2 stat" for details.
+ * The st_dev, st_blksize, and st_ino fields are ignored.
+ *
+ * NOTE: the st_blocks field is measured in 512-byte units (disk sectors).
+ *
+ * Errors:
+ *   ENAMETOOLONG  the path or one of its components is too long.
+ *   ENOENT        a component of the path does not exist.
+ *   ENOTDIR       a component of the path prefix is not a directory.
+ *
+ * @param path  path to a file or directory.
+ * @param st    pointer to the struct stat that receives the result.
+ * @return      0 on success; -errno on error;
+ */
+static int a1fs_getattr(const char *path, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	fs_ctx *fs = get_fs();
+
+	int ret;
+	if (getattr_lockless(path, st, &ret)) {
+		return ret;
+	}
+
+	fs_lock_ns(fs, false);
+	long curr_ino_num = lock_path(path, false);
+	if (curr_ino_num < 0) {
+		fs_unlock_ns(fs);
+		return curr_ino_num;
+	}
+	a1fs_ino_t curr_ino_t = (a1fs_ino_t) curr_ino_num;
+
+	a1fs_inode *curr_inode = get_inode(curr_ino_t);
+	inode_read_attrs(curr_inode, st);
+	fs_unlock_inode(fs, curr_ino_t);
+	fs_unlock_ns(fs);
+	return 0;
+
+}
+
+/**
+ * Read a directory.
+ *
+ * Implements the readdir() system call. Should call filler() for each directory
+ * entry. See fuse.h in libfuse source code for details.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a directory.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a filler() call failed).
+ *
+ * @param path    path to the directory.
+ * @param buf     buffer that receives the result.
+ * @param filler  function that needs to be called for each directory entry.
+ *                Pass 0 as offset (4th argument). 3rd argument can be NULL.
+ * @param offset  unused.
+ * @param fi      unused.
+ * @return        0 on success; -errno on error.
+ */
+static int a1fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                        off_t offset, struct fuse_file_info *fi)
+{
+	(void)offset;// unused
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+
+	
+	fs_lock_ns(fs, false);
+	long curr_ino_num = lock_path(path, false);
+	if (curr_ino_num < 0) {
+		fs_unlock_ns(fs);
+		return curr_ino_num;
+	}
+	a1fs_inode *curr_inode = get_inode(curr_ino_num);
+	filler(buf, ".", NULL, 0);
+	filler(buf, "..", NULL, 0);
+	dir_fill(curr_inode, buf, filler);
+	fs_unlock_inode(fs, curr_ino_num);
+	fs_unlock_ns(fs);
+	return 0;
+}
+
+/**
+ * Create a new inode for the given mode, returns the new inode number.
+ *
+ * Directories are placed with group_for_dir() and start an inode table block
+ * of their own; anything else goes to the group of its parent directory, next
+ * to the parent's inode (see group_alloc_inode()). The new inode gets the
+ * allocation hints of the parent, and goes to its hinted group if it has one.
+ *
+ * The parent must be locked for writing.
+ */
+long init_new_inode(mode_t mode, a1fs_ino_t parent) {
+	fs_ctx *fs = get_fs();
+	a1fs_inode *parent_inode = get_inode(parent);
+	long hint = hint_group(parent_inode);
+	uint32_t goal;
+	if (hint >= 0) {
+		goal = (uint32_t) hint;
+	} else {
+		goal = S_ISDIR(mode) ? group_for_dir(&fs->groups, parent) : group_of_inode(&fs->groups, parent);
+	}
+	long new_inode_num = group_alloc_inode(&fs->groups, goal, parent, S_ISDIR(mode));
+	// out of inodes to allocate, return ENOSPC
+	if (new_inode_num < 0) { return -ENOSPC; }
+	if (S_ISDIR(mode)) { group_count_dir(&fs->groups, new_inode_num, 1); }
+	a1fs_inode *new_inode = get_inode(new_inode_num);
+	
+	new_inode->mode = (mode | 0777);
+	if (S_ISDIR(mode)) {
+		new_inode->links = 2;
+	} else if (S_ISREG(mode)) {
+		new_inode->links = 1;
+	}
+	new_inode->size = 0;
+	clock_gettime(CLOCK_REALTIME, &(new_inode->mtime));
+	new_inode->extentcount = 0;
+	new_inode->entry_count = 0;
+	new_inode->flags = (fs->inline_extents > 0) ? A1FS_INODE_INLINE_EXTENTS : 0;
+	new_inode->frag_offset = 0;
+	new_inode->hint_size_order = parent_inode->hint_size_order;
+	new_inode->hint_contig = parent_inode->hint_contig;
+	new_inode->hint_group = parent_inode->hint_group;
+	new_inode->hole_blocks = 0;
+	memset(a1fs_inode_extents(new_inode), 0, fs->inode_size - sizeof(a1fs_inode));
+	// Regular files start out with their (empty) data in the inode
+	if (S_ISREG(mode) && (fs->inline_data > 0)) {
+		new_inode->flags = A1FS_INODE_INLINE_DATA;
+	}
+	return new_inode_num;
+}
+
+// Insert a new inode num to the parent directory's entries and update metadata accordingly
+int add_new_inode_to_parent_dir(a1fs_inode *parent_inode, a1fs_ino_t new_ino_num, const char *entryname) {
+	fs_ctx *fs = get_fs();
+	int ret = dir_add(parent_inode, entryname, new_ino_num);
+	if (ret != 0) { return ret; }
+
+	clock_gettime(CLOCK_REALTIME, &(parent_inode->mtime));
+	parent_inode->entry_count++;
+	// A subdirectory's ".." entry links to the parent
+	a1fs_inode *new_inode = get_inode(new_ino_num);
+	if (S_ISDIR(new_inode->mode)) {
+		(parent_inode->links)++;
+	}
+	dcache_insert(&fs->dcache, get_ino_num(parent_inode), entryname, strlen(entryname), new_ino_num);
+	return 0;
+}
+
+// Throw away the delayed allocation buffer of an inode being deleted
+void discard_delalloc(a1fs_ino_t ino) {
+	fs_ctx *fs = get_fs();
+	delalloc_buf *da = delalloc_get(&fs->delalloc, ino);
+	if (da == NULL) { return; }
+	group_unreserve_blocks(&fs->groups, da->nblocks);
+	delalloc_drop(&fs->delalloc, ino);
+}
+
+// Free the data of an inode, and drop what is cached or set aside for it
+void free_inode_data(a1fs_ino_t ino_num) {
+	fs_ctx *fs = get_fs();
+	a1fs_inode *curr_inode = get_inode(ino_num);
+	// set bit off for the data blocks and the extent table on data bitmap
+	if (curr_inode->flags & A1FS_INODE_FRAGMENT) {
+		free_fragment(curr_inode->extentblock, curr_inode->frag_offset, curr_inode->size);
+		curr_inode->flags &= ~A1FS_INODE_FRAGMENT;
+	} else {
+		free_file_blocks(curr_inode, 0);
+	}
+	curr_inode->size = 0;
+	emap_invalidate(&fs->emaps, ino_num);
+	discard_delalloc(ino_num);
+	rsv_release(&fs->rsv, ino_num);
+}
+
+// Free an inode that no operation can be using
+void rm_inode(a1fs_ino_t ino_num){
+	fs_ctx *fs = get_fs();
+	a1fs_inode *curr_inode = get_inode(ino_num);
+	free_inode_data(ino_num);
+	// set bit off for inode on inode bitmap
+	if (S_ISDIR(curr_inode->mode)) { group_count_dir(&fs->groups, ino_num, -1); }
+	group_free_inode(&fs->groups, ino_num);
+}
+
+/**
+ * Free an inode that was removed from the directory tree. Operations that
+ * resolved a path to it before it was removed may still hold its number (see
+ * lock_path()), so only its data is freed now, and the inode is left with no
+ * links; the number is freed by reap_inodes().
+ *
+ * The inode must be locked for writing.
+ *
+ * @param ino_num  the inode number.
+ * @return         true if reap_inodes() should be called once the caller has
+ *                 dropped its locks.
+ */
+bool kill_inode(a1fs_ino_t ino_num) {
+	fs_ctx *fs = get_fs();
+	a1fs_inode *curr_inode = get_inode(ino_num);
+	free_inode_data(ino_num);
+	curr_inode->links = 0;
+	return fs_queue_dead(fs, ino_num);
+}
+
+/**
+ * Free the inodes queued by kill_inode(). Takes the directory tree lock for
+ * writing, so that no operation holds any of their numbers.
+ *
+ * @param fs  the context.
+ * @return    true if any inode was freed.
+ */
+bool reap_inodes(fs_ctx *fs) {
+	fs_lock_ns(fs, true);
+	// Inodes are only queued with the tree locked for reading, so the list
+	// does not change meanwhile; the lock is for statfs
+	pthread_mutex_lock(&fs->dead_lock);
+	uint32_t count = fs->dead_count;
+	fs->dead_count = 0;
+	pthread_mutex_unlock(&fs->dead_lock);
+	for (uint32_t i = 0; i < count; i++) {
+		rm_inode(fs->dead[i]);
+	}
+	fs_unlock_ns(fs);
+	return count > 0;
+}
+
+/**
+ * Create a new inode and link it into its parent directory at path.
+ *
+ * The parent directory stays write-locked from the check that the name is
+ * free until the new entry is added, so concurrent creates of the same name
+ * cannot both succeed. If there are no free inodes, the numbers of removed
+ * inodes are freed (see reap_inodes()) and the create is tried again.
+ *
+ * Errors:
+ *   EEXIST  path already exists.
+ *   ENOENT  the parent directory was removed.
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the file or directory to create.
+ * @param mode  file mode bits of the new inode.
+ * @return      0 on success; -errno on error.
+ */
+int create_inode_at_path(const char *path, mode_t mode) {
+	fs_ctx *fs = get_fs();
+
+	for (bool reaped = false; ; reaped = true) {
+		fs_lock_ns(fs, false);
+		long parent_ino_num = get_parent_dir_ino_num_by_path(path);
+		if (parent_ino_num < 0) {
+			fs_unlock_ns(fs);
+			return parent_ino_num;
+		}
+		a1fs_inode *parent_inode = get_inode(parent_ino_num);
+		const char *entryname = strrchr(path, '/') + 1;
+
+		fs_lock_inode(fs, parent_ino_num, true);
+		long ret = -EEXIST;
+		if (parent_inode->links == 0) {
+			ret = -ENOENT;
+		} else if (dir_lookup(parent_inode, entryname) == 0) {
+			ret = init_new_inode(mode, parent_ino_num);
+		}
+		if (ret > 0) {
+			a1fs_ino_t new_ino_num = (a1fs_ino_t) ret;
+			ret = add_new_inode_to_parent_dir(parent_inode, new_ino_num, entryname);
+			if (ret != 0) { rm_inode(new_ino_num); }
+		}
+		fs_unlock_inode(fs, parent_ino_num);
+		fs_unlock_ns(fs);
+		if ((ret != -ENOSPC) || reaped || !reap_inodes(fs)) {
+			return ret;
+		}
+	}
+}
+
+/**
+ * Create a directory.
+ *
+ * Implements the mkdir() system call.
+ *
+ * NOTE: the mode argument may not have the type specification bits set, i.e.
+ * S_ISDIR(mode) can be false. To obtain the correct directory type bits use
+ * "mode | S_IFDIR".
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" doesn't exist.
+ *   The parent directory of "path" exists and is a directory.
+ *   "path" and its components are not too long.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).ini
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the directory to create.  /local/kkk/mydir
+ * @param mode  file mode bits.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_mkdir(const char *path, mode_t mode)
+{
+	// mode unused
+	(void)mode;
+	return create_inode_at_path(path, __S_IFDIR);
+}
+
+// Remove the entry "name" of the child inode from the parent directory and update metadata accordingly
+void rm_inode_from_parent_directory(a1fs_ino_t parent_ino_num, a1fs_ino_t child_ino_num, const char *name){
+	fs_ctx *fs = get_fs();
+	a1fs_inode *parent_inode = get_inode(parent_ino_num);
+	a1fs_inode *child_inode = get_inode(child_ino_num);
+	if (dir_remove(parent_inode, name) == 0) { return; }
+
+	if (S_ISDIR(child_inode->mode)) {
+		parent_inode->links --;
+	}
+	parent_inode->entry_count--;
+	clock_gettime(CLOCK_REALTIME, &(parent_inode->mtime));
+	// The name is now known not to exist in the parent
+	dcache_insert(&fs->dcache, parent_ino_num, name, strlen(name), 0);
+}
+
+// Check that a locked directory still has the entry name for inode ino (or
+// that the name is absent, if ino is 0), as when the path was resolved
+bool entry_is(a1fs_ino_t dir_ino, const char *name, a1fs_ino_t ino) {
+	a1fs_inode *dir = get_inode(dir_ino);
+	return (dir->links != 0) && (dir_lookup(dir, name) == ino);
+}
+
+/**
+ * Remove a file or an empty directory.
+ *
+ * The parent directory and the inode are locked (see fs_ctx.h). The path may
+ * have been removed or renamed after it was resolved, so the entry is looked
+ * up again with the locks held, and the path is resolved again if it changed.
+ *
+ * Errors:
+ *   ENOENT     path does not exist.
+ *   ENOTEMPTY  path is a directory that is not empty.
+ *
+ * @param path  path to the file or directory to remove.
+ * @return      0 on success; -errno on error.
+ */
+int remove_entry_at_path(const char *path) {
+	fs_ctx *fs = get_fs();
+	const char *name = strrchr(path, '/') + 1;
+
+	for (;;) {
+		fs_lock_ns(fs, false);
+		long ino_num = get_ino_num_by_path(path);
+		long parent_ino_num = (ino_num < 0) ? ino_num : get_parent_dir_ino_num_by_path(path);
+		if (parent_ino_num < 0) {
+			fs_unlock_ns(fs);
+			return parent_ino_num;
+		}
+		a1fs_ino_t locked[] = {(a1fs_ino_t)parent_ino_num, (a1fs_ino_t)ino_num};
+		fs_lock_inodes(fs, locked, 2);
+		if (!entry_is(parent_ino_num, name, ino_num)) {
+			fs_unlock_inodes(fs, locked, 2);
+			fs_unlock_ns(fs);
+			continue;
+		}
+
+		a1fs_inode *inode = get_inode(ino_num);
+		int ret = 0;
+		bool reap = false;
+		if (S_ISDIR(inode->mode) && (inode->entry_count > 0)) {
+			ret = -ENOTEMPTY;
+		} else {
+			rm_inode_from_parent_directory(parent_ino_num, ino_num, name);
+			dcache_remove_path(&fs->dcache, path);
+			reap = kill_inode(ino_num);
+		}
+		fs_unlock_inodes(fs, locked, 2);
+		fs_unlock_ns(fs);
+		if (reap) { reap_inodes(fs); }
+		return ret;
+	}
+}
+
+/**
+ * Remove a directory.
+ *
+ * Implements the rmdir() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a directory.
+ *
+ * Errors:
+ *   ENOTEMPTY  the directory is not empty.
+ *
+ * @param path  path to the directory to remove.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_rmdir(const char *path)
+{
+	return remove_entry_at_path(path);
+}
+
 /**
- * Create a directory.
- *
- * Implements the mkdir() system call.
+ * Create a file.
  *
- * NOTE: the mode argument may not have the type specification bits set, i.e.
- * S_ISDIR(mode) can be false. To obtain the correct directory type bits use
- * "mode | S_IFDIR".
+ * Implements the open()/creat() system call.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
  *   "path" doesn't exist.
@@ -630,589 +2625,1151 @@ int add_new_inode_to_parent_dir(a1fs_inode *parent_inode, a1fs_ino_t new_ino_num
  *   "path" and its components are not too long.
  *
  * Errors:
- *   ENOMEM  not enough memory (e.g. a malloc() call failed).ini
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
  *   ENOSPC  not enough free space in the file system.
  *
- * @param path  path to the directory to create.  /local/kkk/mydir
+ * @param path  path to the file to create.
  * @param mode  file mode bits.
+ * @param fi    unused.
  * @return      0 on success; -errno on error.
  */
-static int a1fs_mkdir(const char *path, mode_t mode)
+static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
-	// mode unused
-	(void)mode;
-	printf("\nEntered into mkdir\n");
+	(void)fi;// unused
+	assert(S_ISREG(mode));
+	return create_inode_at_path(path, mode);
+}
+
+/**
+ * Remove a file.
+ *
+ * Implements the unlink() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * @param path  path to the file to remove.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_unlink(const char *path)
+{
+	return remove_entry_at_path(path);
+}
+
+/**
+ * Move the entry at path from to path to, with the directory tree locked by
+ * the caller. The parent directories and the inode being replaced, if any, are
+ * locked (see fs_ctx.h); as in remove_entry_at_path(), the entries are looked
+ * up again with the locks held. The new entry is added before the old one is
+ * removed, so that the file is never without a name.
+ *
+ * Errors: as for a1fs_rename(), and
+ *   EAGAIN  the paths changed after they were resolved, or *alone is false
+ *           and a directory is moved to another parent; sets *alone then.
+ *           The caller drops its locks and tries again.
+ *
+ * @param from   original file path.
+ * @param to     new file path.
+ * @param alone  whether the directory tree is locked for writing.
+ * @param reap   set to true if reap_inodes() should be called.
+ * @return       0 on success; -errno on error.
+ */
+int rename_entry(const char *from, const char *to, bool *alone, bool *reap) {
 	fs_ctx *fs = get_fs();
+	const char *from_name = strrchr(from, '/') + 1;
+	const char *to_name = strrchr(to, '/') + 1;
+
+	long from_ino = get_ino_num_by_path(from);
+	if (from_ino < 0) { return from_ino; }
+	long from_parent = get_parent_dir_ino_num_by_path(from);
+	if (from_parent < 0) { return from_parent; }
+	long to_parent = get_parent_dir_ino_num_by_path(to);
+	if (to_parent < 0) { return to_parent; }
+	long to_ino = get_ino_num_by_path(to);
+	if (to_ino == -ENOENT) {
+		to_ino = 0;
+	} else if (to_ino < 0) {
+		return to_ino;
+	}
+	if (to_ino == from_ino) { return 0; }
 
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *) image;
+	bool is_dir = S_ISDIR(get_inode(from_ino)->mode);
+	// Moving directories to other parents concurrently could make a loop
+	if (is_dir && (from_parent != to_parent) && !*alone) {
+		*alone = true;
+		return -EAGAIN;
+	}
+	// A directory cannot be moved under itself
+	size_t from_len = strlen(from);
+	if (is_dir && (strncmp(to, from, from_len) == 0) && (to[from_len] == '/')) {
+		return -EINVAL;
+	}
 
-	// get parent directory inode number
-	long parent_directory_ino_num = get_parent_dir_ino_num_by_path(path);
-	if (parent_directory_ino_num < 0) {
-		fprintf(stderr, "Mkdir ERRORRRRRRRRR\n");
-		return parent_directory_ino_num;
+	a1fs_ino_t locked[] = {(a1fs_ino_t)from_parent, (a1fs_ino_t)to_parent, (a1fs_ino_t)to_ino};
+	fs_lock_inodes(fs, locked, 3);
+	int ret = -EAGAIN;
+	if (!entry_is(from_parent, from_name, from_ino) || !entry_is(to_parent, to_name, to_ino)) {
+		goto out;
 	}
-	parent_directory_ino_num = (a1fs_ino_t) parent_directory_ino_num;
 
-	// set up a new inode
-	long new_inode_num = init_new_inode(__S_IFDIR);
-	if (new_inode_num < 0) {
-		return new_inode_num;
+	a1fs_inode *to_parent_inode = get_inode(to_parent);
+	if (to_ino == 0) {
+		ret = add_new_inode_to_parent_dir(to_parent_inode, from_ino, to_name);
+		if (ret != 0) { goto out; }
+	} else {
+		a1fs_inode *target = get_inode(to_ino);
+		if (is_dir && !S_ISDIR(target->mode)) { ret = -ENOTDIR; goto out; }
+		if (!is_dir && S_ISDIR(target->mode)) { ret = -EISDIR; goto out; }
+		if (is_dir && (target->entry_count > 0)) { ret = -ENOTEMPTY; goto out; }
+		// The entry of the replaced file is taken over; a directory replaces
+		// a directory, so the parent's link count stays the same
+		dir_replace(to_parent_inode, to_name, from_ino);
+		clock_gettime(CLOCK_REALTIME, &(to_parent_inode->mtime));
+		dcache_insert(&fs->dcache, to_parent, to_name, strlen(to_name), from_ino);
+		*reap = kill_inode(to_ino);
+	}
+	rm_inode_from_parent_directory(from_parent, from_ino, from_name);
+	// Paths under a directory now resolve differently
+	if (is_dir) {
+		dcache_invalidate_paths(&fs->dcache);
+	} else {
+		dcache_remove_path(&fs->dcache, from);
+		dcache_remove_path(&fs->dcache, to);
 	}
-	new_inode_num = (a1fs_blk_t) new_inode_num;
+	ret = 0;
+out:
+	fs_unlock_inodes(fs, locked, 3);
+	return ret;
+}
+
+/**
+ * Rename a file or directory.
+ *
+ * Implements the rename() system call. If "to" exists, it is replaced.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "from" exists.
+ *   The parent directory of "to" exists and is a directory.
+ *
+ * Errors:
+ *   EINVAL     "from" is a directory and "to" is under it.
+ *   EISDIR     "to" is a directory and "from" is not.
+ *   ENOENT     "from" does not exist.
+ *   ENOSPC     not enough free space in the file system.
+ *   ENOTDIR    "from" is a directory and "to" is not.
+ *   ENOTEMPTY  "to" is a directory that is not empty.
+ *
+ * @param from  original file path.
+ * @param to    new file path.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_rename(const char *from, const char *to)
+{
+	fs_ctx *fs = get_fs();
+	bool alone = false;
+	bool reap = false;
+	int ret;
+	do {
+		fs_lock_ns(fs, alone);
+		ret = rename_entry(from, to, &alone, &reap);
+		fs_unlock_ns(fs);
+	} while (ret == -EAGAIN);
+	if (reap) { reap_inodes(fs); }
+	return ret;
+}
+
+
+/**
+ * Change the access and modification times of a file or directory.
+ *
+ * Implements the utimensat() system call. See "man 2 utimensat" for details.
+ *
+ * NOTE: You only have to implement the setting of modification time (mtime).
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists.
+ *
+ * @param path  path to the file or directory.
+ * @param tv    timestamps array. See "man 2 utimensat" for details.
+ * @return      0 on success; -errno on failure.
+ */
+static int a1fs_utimens(const char *path, const struct timespec tv[2])
+{
+	fs_ctx *fs = get_fs();
 	
-	a1fs_inode *parent_directory_ino = (a1fs_inode *)(image + sb->bg_inode_table * A1FS_BLOCK_SIZE + (parent_directory_ino_num - 1) * sizeof(a1fs_inode));
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, true);
+	if (ret < 0) {
+		fs_unlock_ns(fs);
+		return ret;
+	}
+	a1fs_ino_t ino_num = (a1fs_ino_t) ret;
+	a1fs_inode *inode = get_inode(ino_num);
+	inode->mtime.tv_sec = tv[1].tv_sec;
+	inode->mtime.tv_nsec = tv[1].tv_nsec;
+	fs_unlock_inode(fs, ino_num);
+	fs_unlock_ns(fs);
+	return 0;
+}
+
+/**
+ * Find a place for the data of a regular file that is about to have a new
+ * size, and move the data there: the inode if it fits (A1FS_INODE_INLINE_DATA),
+ * otherwise a fragment (A1FS_INODE_FRAGMENT) if the file is small enough,
+ * otherwise data blocks. Only files whose data is in the inode or in a
+ * fragment, or that are empty, are moved; files in blocks stay there.
+ *
+ * Bytes past the new size in the inode or the fragment are zeroed; the file
+ * size itself is left to the caller. On failure the data stays where it is.
+ *
+ * Errors:
+ *   ENOSPC  no free block for the data.
+ *
+ * @param inode  the file inode, locked for writing.
+ * @param size   new file size in bytes.
+ * @return       0 on success; -errno on error.
+ */
+int place_small_file(a1fs_inode *inode, uint64_t size) {
+	fs_ctx *fs = get_fs();
+	char *old = small_file_data(inode);
+	bool empty = S_ISREG(inode->mode) && (inode->size == 0) && (inode->extentcount == 0);
+	if ((old == NULL) && !empty) { return 0; }
+
+	uint16_t old_place = inode->flags & (A1FS_INODE_INLINE_DATA | A1FS_INODE_FRAGMENT);
+	uint16_t new_place = 0;
+	if ((fs->inline_data > 0) && (size <= fs->inline_data)) {
+		new_place = A1FS_INODE_INLINE_DATA;
+	} else if ((size > 0) && (size <= fs->frag_max)) {
+		new_place = A1FS_INODE_FRAGMENT;
+	}
+	uint64_t keep = (size < inode->size) ? size : inode->size;
+
+	// Bytes past EOF are kept zeroed, in the inode and in fragments
+	if (new_place == old_place) {
+		if (new_place == 0) { return 0; }
+		if (new_place == A1FS_INODE_INLINE_DATA) {
+			pad_zeroes(old + keep, inode->size - keep);
+			return 0;
+		}
+		uint32_t old_units = frag_units(inode->size), new_units = frag_units(size);
+		pad_zeroes(old + keep, inode->size - keep);
+		if (frag_resize(&fs->frags, inode->extentblock, inode->frag_offset, old_units, new_units)) {
+			if (new_units > old_units) {
+				pad_zeroes(old + old_units * A1FS_FRAG_UNIT, (new_units - old_units) * A1FS_FRAG_UNIT);
+			}
+			return 0;
+		}
+	}
+
+	char data[A1FS_BLOCK_SIZE];
+	if (keep > 0) { memcpy(data, old, keep); }
+	a1fs_blk_t old_block = inode->extentblock;
+	uint16_t old_offset = inode->frag_offset;
+	uint64_t old_size = inode->size;
+
+	if (new_place == A1FS_INODE_FRAGMENT) {
+		uint32_t goal = group_of_inode(&fs->groups, get_ino_num(inode));
+		long block = frag_alloc(&fs->frags, goal, frag_units(size), &inode->frag_offset);
+		if ((block < 0) && rsv_release_all(&fs->rsv)) {
+			block = frag_alloc(&fs->frags, goal, frag_units(size), &inode->frag_offset);
+		}
+		if (block < 0) {
+			inode->frag_offset = old_offset;
+			return -ENOSPC;
+		}
+		inode->extentblock = (a1fs_blk_t)block;
+	} else if (new_place == 0) {
+		// Into a data block, as an empty file with an extent table
+		inode->extentblock = 0;
+		inode->extentcount = 0;
+		inode->flags &= ~(A1FS_INODE_INLINE_DATA | A1FS_INODE_FRAGMENT);
+		if (fs->inline_extents > 0) { inode->flags |= A1FS_INODE_INLINE_EXTENTS; }
+		pad_zeroes(a1fs_inode_data(inode), fs->inode_size - sizeof(a1fs_inode));
+		int ret = (keep > 0) ? alloc_file_blocks(inode, 1, 0) : 0;
+		if (ret != 0) {
+			inode->flags = (inode->flags & ~A1FS_INODE_INLINE_EXTENTS) | old_place;
+			inode->extentblock = old_block;
+			if (old_place == A1FS_INODE_INLINE_DATA) { memcpy(a1fs_inode_data(inode), data, keep); }
+			return ret;
+		}
+		if (keep > 0) { memcpy(get_file_block(inode, 0), data, keep); }
+	}
+
+	// The new place is set up; let go of the old one
+	if (old_place == A1FS_INODE_FRAGMENT) { free_fragment(old_block, old_offset, old_size); }
+	if (new_place == 0) { return 0; }
+
+	inode->flags = (inode->flags & ~(A1FS_INODE_INLINE_DATA | A1FS_INODE_FRAGMENT | A1FS_INODE_INLINE_EXTENTS)) | new_place;
+	pad_zeroes(a1fs_inode_data(inode), fs->inode_size - sizeof(a1fs_inode));
+	if (new_place == A1FS_INODE_FRAGMENT) {
+		pad_zeroes(small_file_data(inode), frag_units(size) * A1FS_FRAG_UNIT);
+	} else {
+		inode->extentblock = 0;
+	}
+	char *dst = small_file_data(inode);
+	if (keep > 0) { memcpy(dst, data, keep); }
+	return 0;
+}
+
+/**
+ * Change the size of a file given its inode.
+ *
+ * Growing adds a hole for the new blocks, so that no blocks are allocated
+ * until they are written to, and zeroes the bytes between the old EOF and the
+ * end of its block, so that the new range reads as zeros. Data stored in the
+ * inode or in a fragment stays there as long as it fits (see
+ * place_small_file()).
+ *
+ * Errors:
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param inode  the file inode.
+ * @param size   new file size in bytes.
+ * @return       0 on success; -errno on error.
+ */
+// Zero the rest of the last block past EOF, before the file grows
+void zero_tail(a1fs_inode *inode) {
+	// Stale bytes may remain past EOF in the last block after a shrink
+	uint32_t tail = inode->size % A1FS_BLOCK_SIZE;
+	extent_cursor cur;
+	if ((tail != 0) && seek_cursor(inode, inode->size, &cur) && !cursor_zeroed(&cur)) {
+		char *eof;
+		if (cursor_run(&cur, &eof) != 0) { pad_zeroes(eof, A1FS_BLOCK_SIZE - tail); }
+	}
+}
 
-	char *entryname = strrchr(path, '/');
-	entryname += 1;
-	// helper function to add a new inode under parent directory's inode
-	int ret = add_new_inode_to_parent_dir(parent_directory_ino, new_inode_num, entryname);
+int resize_inode(a1fs_inode *inode, uint64_t size) {
+	clock_gettime(CLOCK_REALTIME, &(inode->mtime));
+	int ret = place_small_file(inode, size);
 	if (ret != 0) { return ret; }
+	if (small_file_data(inode) != NULL) {
+		inode->size = size;
+		return 0;
+	}
+	uint64_t old_blocks = (inode->size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+	uint64_t new_blocks = (size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+
+	if (size < inode->size) {
+		free_file_blocks(inode, new_blocks);
+	} else if (size > inode->size) {
+		zero_tail(inode);
+		ret = add_hole(inode, new_blocks - old_blocks);
+		if (ret != 0) { return ret; }
+	}
+	inode->size = size;
 	return 0;
 }
 
 /**
- * Check if a directory is empty or not.
+ * Allocate blocks for the delayed allocation buffer of a file, if it has one,
+ * and write the buffer out to them (see delalloc.h).
+ *
+ * Errors:
+ *   ENOSPC  not enough free blocks or extent slots; the buffer is kept.
+ *
+ * @param inode  the file inode, locked for writing.
+ * @return       0 on success; -errno on error.
+ */
+int flush_delalloc(a1fs_inode *inode) {
+	fs_ctx *fs = get_fs();
+	a1fs_ino_t ino = get_ino_num(inode);
+	delalloc_buf *da = delalloc_get(&fs->delalloc, ino);
+	if (da == NULL) { return 0; }
+	int ret = alloc_file_blocks(inode, da->nblocks, ALLOC_RESERVED);
+	if (ret != 0) { return ret; }
+
+	// The new blocks start right where the buffer does
+	size_t len = (size_t)da->nblocks * A1FS_BLOCK_SIZE;
+	size_t copied = 0;
+	extent_cursor cur;
+	if ((len > 0) && seek_cursor(inode, da->first * A1FS_BLOCK_SIZE, &cur)) {
+		while (copied < len) {
+			char *run;
+			size_t n = cursor_run(&cur, &run);
+			if (n == 0) { break; }
+			if (n > len - copied) { n = len - copied; }
+			memcpy(run, da->data + copied, n);
+			copied += n;
+			cursor_advance(&cur, n);
+		}
+	}
+	__atomic_add_fetch(&fs->delalloc.flushes, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&fs->delalloc.blocks, da->nblocks, __ATOMIC_RELAXED);
+	delalloc_drop(&fs->delalloc, ino);
+	return (copied == len) ? 0 : -EIO;
+}
+
+// Write out the delayed allocation buffers of all files, on unmount
+static void flush_all_delalloc(fs_ctx *fs) {
+	delalloc_buf *da;
+	while ((da = delalloc_any(&fs->delalloc)) != NULL) {
+		a1fs_ino_t ino = da->ino;
+		a1fs_inode *inode = get_inode(ino);
+		if (flush_delalloc(inode) != 0) {
+			fprintf(stderr, "Failed to write out buffered data of inode %u\n", ino);
+			discard_delalloc(ino);
+		}
+	}
+}
+
+/**
+ * Write to a file past the end of its blocks on disk through its delayed
+ * allocation buffer, which is created if needed. Only free space is reserved
+ * for the buffered blocks. The part of the write that falls into blocks on
+ * disk is written in place.
+ *
+ * Errors:
+ *   EAGAIN  the buffer cannot take the write (it would grow too large, or out
+ *           of memory); the caller should flush it and write in place.
+ *   ENOSPC  not enough free blocks.
+ *
+ * On error the buffer and the reservation are left as they were.
+ *
+ * @param inode   the file inode, locked for writing.
+ * @param da      the inode's buffer; NULL if it has none.
+ * @param buf     pointer to the data.
+ * @param size    number of bytes to write.
+ * @param offset  file offset; offset + size is past the blocks on disk.
+ * @return        number of bytes written on success; -errno on error.
+ */
+int write_delalloc(a1fs_inode *inode, delalloc_buf *da, const char *buf, size_t size, off_t offset) {
+	fs_ctx *fs = get_fs();
+	uint64_t first = da ? da->first : (inode->size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+	uint64_t disk_end = first * A1FS_BLOCK_SIZE;
+	uint64_t end = offset + size;
+	uint64_t need = (end + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE - first;
+	if (need > A1FS_DELALLOC_MAX_BLOCKS) { return -EAGAIN; }
+
+	uint32_t had = da ? da->nblocks : 0;
+	bool created = (da == NULL);
+	if (need > had) {
+		if (!group_reserve_blocks(&fs->groups, need - had)) { return -ENOSPC; }
+		if (da == NULL) { da = delalloc_create(&fs->delalloc, get_ino_num(inode), first); }
+		if ((da == NULL) || !delalloc_grow(da, need)) {
+			group_unreserve_blocks(&fs->groups, need - had);
+			return -EAGAIN;
+		}
+	}
+	if (inode->size < disk_end) { zero_tail(inode); }
+
+	size_t in_place = 0;
+	int ret = 0;
+	if ((uint64_t)offset < disk_end) {
+		in_place = disk_end - offset;
+		ret = prepare_write(inode, offset, in_place);
+		extent_cursor cur;
+		if ((ret == 0) && !seek_cursor(inode, offset, &cur)) { ret = -EIO; }
+		size_t bytes_wrote = 0;
+		while ((ret == 0) && (bytes_wrote < in_place)) {
+			char *run;
+			size_t len = cursor_run(&cur, &run);
+			if (len == 0) { ret = -EIO; break; }
+			if (len > in_place - bytes_wrote) { len = in_place - bytes_wrote; }
+			memcpy(run, buf + bytes_wrote, len);
+			bytes_wrote += len;
+			cursor_advance(&cur, len);
+		}
+	}
+	if (ret != 0) {
+		// The file keeps its size, so the buffer must not run past its end
+		if (created) {
+			delalloc_drop(&fs->delalloc, get_ino_num(inode));
+		} else {
+			da->nblocks = had;
+		}
+		if (need > had) { group_unreserve_blocks(&fs->groups, need - had); }
+		return ret;
+	}
+	memcpy(da->data + (offset + in_place - disk_end), buf + in_place, size - in_place);
+	if (end > inode->size) { inode->size = end; }
+	clock_gettime(CLOCK_REALTIME, &(inode->mtime));
+	return size;
+}
+
+/**
+ * Change the size of a file.
+ *
+ * Implements the truncate() system call. Supports both extending and shrinking.
+ * If the file is extended, future reads from the new uninitialized range must
+ * return zero data.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the file to set the size.
+ * @param size  new file size in bytes.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_truncate(const char *path, off_t size)
+{
+	fs_ctx *fs = get_fs();
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, true);
+	if (ret < 0) {
+		fs_unlock_ns(fs);
+		return ret;
+	}
+	a1fs_ino_t ino_num = (a1fs_ino_t) ret;
+	a1fs_inode *curr_inode = get_inode(ino_num);
+	ret = flush_delalloc(curr_inode);
+	if (ret == 0) {
+		ret = resize_inode(curr_inode, (uint64_t)size);
+	}
+	fs_unlock_inode(fs, ino_num);
+	fs_unlock_ns(fs);
+	return ret;
+}
+
+
+// Read up to size bytes at offset from a file, see a1fs_read()
+int read_file(a1fs_inode *file_ino, char *buf, size_t size, off_t offset) {
+	// If file is empty or the offset is beyond EOF, substitude the rest of the data with 0
+	if ((uint64_t)offset >= file_ino->size) {
+		pad_zeroes(buf, size);
+		return 0;
+	}
+	size_t bytes_in_file = file_ino->size - offset;
+	if (bytes_in_file > size) {bytes_in_file = size;}
+
+	// Small files are read straight from the inode or their fragment
+	char *data = small_file_data(file_ino);
+	if (data != NULL) {
+		memcpy(buf, data + offset, bytes_in_file);
+		pad_zeroes(buf + bytes_in_file, size - bytes_in_file);
+		return bytes_in_file;
+	}
+
+	// Copy whole contiguous runs, moving to the next extent without reseeking
+	size_t bytes_read = 0;
+	extent_cursor cur;
+	if (seek_cursor(file_ino, offset, &cur)) {
+		while (bytes_read < bytes_in_file) {
+			char *run;
+			size_t len = cursor_run(&cur, &run);
+			if (len == 0) {break;}
+			if (len > bytes_in_file - bytes_read) {len = bytes_in_file - bytes_read;}
+			if (cursor_zeroed(&cur)) {
+				pad_zeroes(buf + bytes_read, len);
+			} else {
+				memcpy(buf + bytes_read, run, len);
+			}
+			bytes_read += len;
+			cursor_advance(&cur, len);
+		}
+	}
+	// The rest up to EOF may still be in the delayed allocation buffer
+	delalloc_buf *da = (bytes_read < bytes_in_file) ? delalloc_get(&get_fs()->delalloc, get_ino_num(file_ino)) : NULL;
+	if ((da != NULL) && (offset + bytes_read >= da->first * A1FS_BLOCK_SIZE)) {
+		memcpy(buf + bytes_read, da->data + (offset + bytes_read - da->first * A1FS_BLOCK_SIZE), bytes_in_file - bytes_read);
+		bytes_read = bytes_in_file;
+	}
+	// Only the part past EOF (or not backed by any extent) reads as zeros
+	pad_zeroes(buf + bytes_read, size - bytes_read);
+	return bytes_in_file;
+}
+
+/**
+ * Read data from a file.
+ *
+ * Implements the pread() system call. Should return exactly the number of bytes
+ * requested except on EOF (end of file) or error, otherwise the rest of the
+ * data will be substituted with zeros. Reads from file ranges that have not
+ * been written to must return zero data.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * @param path    path to the file to read from.
+ * @param buf     pointer to the buffer that receives the data.
+ * @param size    buffer size - number of bytes requested.
+ * @param offset  offset from the beginning of the file to read from.
+ * @param fi      unused.
+ * @return        number of bytes read on success; 0 if offset is beyond EOF;
+ *                -errno on error.
+ */
+static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi)
+{
+	// unused
+	(void)fi;
+	fs_ctx *fs = get_fs();
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, false);
+	if (ret >= 0) {
+		a1fs_ino_t file_ino_num = (a1fs_ino_t) ret;
+		a1fs_inode *file_ino = get_inode(file_ino_num);
+		ret = read_file(file_ino, buf, size, offset);
+		fs_unlock_inode(fs, file_ino_num);
+	}
+	fs_unlock_ns(fs);
+	return ret;
+}
+
+// Write size bytes at offset to a file, see a1fs_write()
+int write_file(a1fs_inode *file_ino, const char *buf, size_t size, off_t offset) {
+	// Nothing to write
+	if (size == 0) {return 0;}
+	fs_ctx *fs = get_fs();
+
+	// Small files are written straight to the inode or their fragment, until
+	// they outgrow it
+	if ((fs->inline_data > 0) || (fs->frag_max > 0)) {
+		uint64_t end = (offset + size > file_ino->size) ? offset + size : file_ino->size;
+		int ret = place_small_file(file_ino, end);
+		if (ret != 0) {return ret;}
+		char *data = small_file_data(file_ino);
+		if (data != NULL) {
+			memcpy(data + offset, buf, size);
+			file_ino->size = end;
+			clock_gettime(CLOCK_REALTIME, &(file_ino->mtime));
+			return size;
+		}
+	}
+
+	// Writes past the blocks on disk are buffered if possible
+	delalloc_buf *da = delalloc_get(&fs->delalloc, get_ino_num(file_ino));
+	uint64_t disk_blocks = da ? da->first : (file_ino->size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+	if (!fs->opts->nodelalloc && (offset + size > disk_blocks * A1FS_BLOCK_SIZE)) {
+		// Whole blocks skipped past the end of the data become a hole instead
+		// of zeros in the buffer
+		uint64_t hole_end = offset / A1FS_BLOCK_SIZE;
+		if ((da != NULL) && (hole_end > da->first + da->nblocks)) {
+			int ret = flush_delalloc(file_ino);
+			if (ret != 0) {return ret;}
+			da = NULL;
+		}
+		if ((da == NULL) && (hole_end * A1FS_BLOCK_SIZE > file_ino->size)) {
+			int ret = resize_inode(file_ino, hole_end * A1FS_BLOCK_SIZE);
+			if (ret != 0) {return ret;}
+		}
+		int ret = write_delalloc(file_ino, da, buf, size, offset);
+		// A full buffer is written out and a new one started
+		if ((ret == -EAGAIN) && (da != NULL)) {
+			ret = flush_delalloc(file_ino);
+			if (ret == 0) {ret = write_delalloc(file_ino, NULL, buf, size, offset);}
+		}
+		if (ret != -EAGAIN) {return ret;}
+		ret = flush_delalloc(file_ino);
+		if (ret != 0) {return ret;}
+	}
+
+	// Now size > 0 we have something to write
+	// Grow the file once for the whole request, if needed
+	if (offset + size > file_ino->size) {
+		int ret = resize_inode(file_ino, offset + size);
+		if (ret < 0) {return ret;}
+	} else {
+		clock_gettime(CLOCK_REALTIME, &(file_ino->mtime));
+	}
+
+	// Copy into whole contiguous runs, moving to the next extent without reseeking
+	int ret = prepare_write(file_ino, offset, size);
+	if (ret != 0) {return ret;}
+	extent_cursor cur;
+	if (!seek_cursor(file_ino, offset, &cur)) {return -EIO;}
+	size_t bytes_wrote = 0;
+	while (bytes_wrote < size) {
+		char *run;
+		size_t len = cursor_run(&cur, &run);
+		if (len == 0) {return -EIO;}
+		if (len > size - bytes_wrote) {len = size - bytes_wrote;}
+		memcpy(run, buf + bytes_wrote, len);
+		bytes_wrote += len;
+		cursor_advance(&cur, len);
+	}
+	return bytes_wrote;
+}
+
+/**
+ * Write data to a file.
+ *
+ * Implements the pwrite() system call. Should return exactly the number of
+ * bytes requested except on error. If the offset is beyond EOF (end of file),
+ * the file must be extended. If the write creates a "hole" of uninitialized
+ * data, future reads from the "hole" must return zero data.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a directory.
+ *   "path" exists and is a file.
  *
- * @param path  path to the directory to remove.
- * @return      0 if the directory is empty; 1 if the directory is not empty.
+ * @param path    path to the file to write to.
+ * @param buf     pointer to the buffer containing the data.
+ * @param size    buffer size - number of bytes requested.
+ * @param offset  offset from the beginning of the file to write to.
+ * @param fi      unused.
+ * @return        number of bytes written on success; -errno on error.
  */
-int check_dir_empty(const char *path) {
-	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *) image;
-	a1fs_ino_t curr_ino_num = (a1fs_ino_t) get_ino_num_by_path(path);
-	a1fs_inode *curr_inode = (image + A1FS_BLOCK_SIZE*(sb->bg_inode_table) + sizeof(a1fs_inode)*(curr_ino_num - 1));
-	return curr_inode->size > 0;
-}
-
-void rm_inode(a1fs_ino_t ino_num){
+static int a1fs_write(const char *path, const char *buf, size_t size,
+                      off_t offset, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
 	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *) image;
-	a1fs_inode *curr_inode = (image + A1FS_BLOCK_SIZE*(sb->bg_inode_table) + sizeof(a1fs_inode)*(ino_num - 1));
-	uint32_t *block_bitmap = (uint32_t *) (image + sb->bg_block_bitmap * A1FS_BLOCK_SIZE);
-	uint32_t *inode_bitmap = (uint32_t *) (image + sb->bg_inode_bitmap * A1FS_BLOCK_SIZE);
-	// set bit off for extent block and dentry block on data bitmap
-	if (curr_inode->extentcount > 0){
-
-		a1fs_extent *curr_extent;
-		// Free each extent's block
-		for (uint32_t i = 0; i < curr_inode->extentblock; i++) {
-			curr_extent = (a1fs_extent *)(image + A1FS_BLOCK_SIZE * curr_inode->extentblock + sizeof(a1fs_extent) * i);
-			for (uint32_t i = 0; i < curr_extent->count; i++) {
-				setBitOff(block_bitmap, curr_extent->start + i - sb->bg_data_block);
-				sb->s_free_blocks_count++;
-			}
-		}
-		// Free the inode's extent block
-		a1fs_blk_t extent_block_on_bitmap = curr_inode->extentblock - sb->bg_data_block;
-		setBitOff(block_bitmap, extent_block_on_bitmap);
-		sb->s_free_blocks_count++;
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, true);
+	if (ret >= 0) {
+		a1fs_ino_t file_ino_num = (a1fs_ino_t) ret;
+		a1fs_inode *file_ino = get_inode(file_ino_num);
+		ret = write_file(file_ino, buf, size, offset);
+		fs_unlock_inode(fs, file_ino_num);
 	}
-	// set bit off for inode on inode bitmap
-	a1fs_blk_t inode_on_bitmap = ino_num - 1;
-	setBitOff(inode_bitmap, inode_on_bitmap);
-	sb->s_free_inodes_count ++;
+	fs_unlock_ns(fs);
+	return ret;
 }
 
-void rm_inode_from_parent_directory(a1fs_ino_t parent_ino_num, a1fs_ino_t child_ino_num){
-	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *) image;
-	a1fs_inode *parent_inode = (image + A1FS_BLOCK_SIZE*(sb->bg_inode_table) + sizeof(a1fs_inode)*(parent_ino_num - 1));
-	parent_inode->links --;
-	parent_inode->size -= (sizeof(a1fs_dentry));
-	clock_gettime(CLOCK_REALTIME, &(parent_inode->mtime));
 
-	uint64_t i = 0;
-	a1fs_dentry *cur_dir;
-	off_t offset = 0;
-	// change dentry ino to 0
-	while (i < parent_inode->dentry_count){
-		cur_dir = (a1fs_dentry *) seekbyte(parent_inode, offset);
-		if (cur_dir->ino == child_ino_num){
-			cur_dir->ino = 0;
-			cur_dir->name[0] = '\0';
-			break;
-		}
-		offset += sizeof(a1fs_dentry);
-		i++;
+// Write out the delayed allocation buffer of the file at path, and close its
+// reservation window (see rsv.h) if it is being released
+int flush_path(const char *path, bool release) {
+	fs_ctx *fs = get_fs();
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, true);
+	if (ret >= 0) {
+		a1fs_ino_t file_ino_num = (a1fs_ino_t) ret;
+		a1fs_inode *file_ino = get_inode(file_ino_num);
+		ret = flush_delalloc(file_ino);
+		if (release) { rsv_release(&fs->rsv, file_ino_num); }
+		fs_unlock_inode(fs, file_ino_num);
 	}
+	fs_unlock_ns(fs);
+	return ret;
 }
 
 /**
- * Remove a directory.
+ * Flush cached data of an open file.
  *
- * Implements the rmdir() system call.
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a directory.
+ * Called on each close() of a file descriptor. Allocates blocks for the data
+ * buffered by delayed allocation and writes it out to them.
  *
  * Errors:
- *   ENOTEMPTY  the directory is not empty.
+ *   ENOSPC  not enough free space in the file system.
  *
- * @param path  path to the directory to remove.
+ * @param path  path to the file.
+ * @param fi    unused.
  * @return      0 on success; -errno on error.
  */
-static int a1fs_rmdir(const char *path)
+static int a1fs_flush(const char *path, struct fuse_file_info *fi)
 {
-	if (check_dir_empty(path) == 1) {return -ENOTEMPTY;}
-	long curr_ino_num = get_ino_num_by_path(path);
-	rm_inode((a1fs_ino_t)curr_ino_num);
-	long parent_ino_num = get_parent_dir_ino_num_by_path(path);
-	rm_inode_from_parent_directory((a1fs_ino_t)parent_ino_num, (a1fs_ino_t)curr_ino_num);
-	return 0;
+	(void)fi;// unused
+	return flush_path(path, false);
 }
 
 /**
- * Create a file.
- *
- * Implements the open()/creat() system call.
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" doesn't exist.
- *   The parent directory of "path" exists and is a directory.
- *   "path" and its components are not too long.
+ * Release an open file.
  *
- * Errors:
- *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
+ * Called when the last file descriptor of an open file is closed. Writes out
+ * any data buffered since the last flush and gives back the blocks set aside
+ * for the file's appends; errors cannot be reported here.
  *
- * @param path  path to the file to create.
- * @param mode  file mode bits.
+ * @param path  path to the file.
  * @param fi    unused.
- * @return      0 on success; -errno on error.
+ * @return      0.
  */
-static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+static int a1fs_release(const char *path, struct fuse_file_info *fi)
 {
 	(void)fi;// unused
-	assert(S_ISREG(mode));
-	fs_ctx *fs = get_fs();
-
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *) image;
-	// Insufficent amount of free inode for the new file
-	if (sb->s_free_inodes_count < 1) {
-		return -ENOSPC;
-	}
-
-	long parent_dir_ino_num = get_parent_dir_ino_num_by_path(path);
-	// Error checking
-	if (parent_dir_ino_num < 0) { return (int) parent_dir_ino_num; };
-	a1fs_inode *parent_inode = (a1fs_inode *) (image + A1FS_BLOCK_SIZE * (sb->bg_inode_table) + sizeof(a1fs_inode) * (parent_dir_ino_num - 1));
-	
-	// Init a new inode for the empty file
-	long new_inode_num = init_new_inode(mode);
-	if (new_inode_num < 0) { return new_inode_num; }
-	new_inode_num = (a1fs_ino_t) new_inode_num;
-
-	char *entryname = strrchr(path, '/');
-	entryname+=1;
-	int ret = add_new_inode_to_parent_dir(parent_inode, new_inode_num, entryname);
-	if (ret != 0) { return ret; }	
+	flush_path(path, true);
 	return 0;
 }
 
 /**
- * Remove a file.
+ * Synchronize file contents.
  *
- * Implements the unlink() system call.
+ * Implements the fsync() system call. Writes out the data buffered by delayed
+ * allocation and syncs the image file to disk.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
+ * Errors:
+ *   ENOSPC  not enough free space in the file system.
+ *   EIO     msync() failed.
  *
- * @param path  path to the file to remove.
- * @return      0 on success; -errno on error.
+ * @param path      path to the file.
+ * @param datasync  unused.
+ * @param fi        unused.
+ * @return          0 on success; -errno on error.
  */
-static int a1fs_unlink(const char *path)
+static int a1fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
 {
-	long curr_ino_num = get_ino_num_by_path(path);
-	rm_inode((a1fs_ino_t)curr_ino_num);
-	long parent_ino_num = get_parent_dir_ino_num_by_path(path);
-	rm_inode_from_parent_directory((a1fs_ino_t)parent_ino_num, (a1fs_ino_t)curr_ino_num);
+	(void)datasync;// unused
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+	int ret = flush_path(path, false);
+	if (ret != 0) return ret;
+	if (msync(fs->image, fs->size, MS_SYNC) < 0) {
+		perror("msync");
+		return -EIO;
+	}
 	return 0;
 }
 
 /**
- * Rename a file or directory.
+ * Allocate space for a file.
  *
- * Implements the rename() system call.
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "from" exists.
- *   The parent directory of "to" exists and is a directory.
+ * Implements the fallocate() system call in the default mode: makes sure the
+ * range [offset, offset + length) is allocated, filling the holes in it and
+ * extending the file if needed. The new blocks are unwritten extents, so they
+ * are not zeroed and allocating any amount of space takes about the same
+ * time; they read as zeros until they are written to. If there is not enough
+ * space, the file keeps its size.
  *
  * Errors:
- *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
+ *   EOPNOTSUPP  mode is not 0 (e.g. FALLOC_FL_KEEP_SIZE, FALLOC_FL_PUNCH_HOLE).
+ *   EINVAL      invalid offset or length.
+ *   ENOSPC      not enough free space in the file system.
  *
- * @param from  original file path.
- * @param to    new file path.
- * @return      0 on success; -errno on error.
+ * @param path    path to the file.
+ * @param mode    fallocate() mode flags.
+ * @param offset  start of the range.
+ * @param length  length of the range.
+ * @param fi      unused.
+ * @return        0 on success; -errno on error.
  */
-static int a1fs_rename(const char *from, const char *to)
+static int a1fs_fallocate(const char *path, int mode, off_t offset, off_t length,
+                          struct fuse_file_info *fi)
 {
+	(void)fi;// unused
+	if (mode != 0) return -EOPNOTSUPP;
+	if ((offset < 0) || (length <= 0)) return -EINVAL;
 	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *)image;
-
-	a1fs_ino_t from_ino_num = (a1fs_ino_t) get_ino_num_by_path(from);
-	a1fs_ino_t from_parent_ino_num = (a1fs_ino_t) get_parent_dir_ino_num_by_path(from);
-
-	long to_ino_num = get_ino_num_by_path(to);
-	char *entryname = strrchr(from, '/') + 1;
-	// last component does not exists, move "from" to parent dir of "to", then rename "from " to last component of dir
-	if (to_ino_num <= 0) {
-		to_ino_num = get_parent_dir_ino_num_by_path(to);
-		entryname = strrchr(to, '/') + 1;
-	}
-	// Move "from" inode under "to"
-	a1fs_inode *to_ino = (a1fs_inode *)(image + A1FS_BLOCK_SIZE * sb->bg_inode_table + sizeof(a1fs_inode) *((a1fs_ino_t)to_ino_num-1));
-	rm_inode_from_parent_directory(from_parent_ino_num, from_ino_num);
-	int ret = add_new_inode_to_parent_dir(to_ino, from_ino_num, entryname);
-	if (ret != 0) { return ret; }
-	return 0;
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, true);
+	if (ret >= 0) {
+		a1fs_ino_t file_ino_num = (a1fs_ino_t) ret;
+		a1fs_inode *file_ino = get_inode(file_ino_num);
+		uint64_t old_size = file_ino->size;
+		uint64_t end = (uint64_t)offset + length;
+		ret = flush_delalloc(file_ino);
+		if ((ret == 0) && (end > old_size)) {
+			ret = resize_inode(file_ino, end);
+		}
+		if (ret == 0) {
+			ret = fill_holes(file_ino, offset / A1FS_BLOCK_SIZE, (end + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE);
+			if ((ret != 0) && (end > old_size)) { resize_inode(file_ino, old_size); }
+		}
+		fs_unlock_inode(fs, file_ino_num);
+	}
+	fs_unlock_ns(fs);
+	return ret;
 }
 
-
 /**
- * Change the access and modification times of a file or directory.
+ * Find the first data byte or the first hole of a file at or after an offset.
+ * Unwritten extents count as holes, and so does the end of the file.
  *
- * Implements the utimensat() system call. See "man 2 utimensat" for details.
+ * @param inode   the file inode, locked.
+ * @param offset  offset to start from.
+ * @param hole    whether to look for a hole rather than data.
+ * @return        the offset found on success; -ENXIO if offset is not before
+ *                EOF, or there is no data past it.
+ */
+int64_t seek_data_hole(a1fs_inode *inode, uint64_t offset, bool hole) {
+	if (offset >= inode->size) {return -ENXIO;}
+	uint64_t pos = offset;
+	extent_cursor cur;
+	if (seek_cursor(inode, offset, &cur)) {
+		while (pos < inode->size) {
+			char *run;
+			size_t len = cursor_run(&cur, &run);
+			if (len == 0) {break;}
+			if (cursor_zeroed(&cur) == hole) {return pos;}
+			pos += len;
+			cursor_advance(&cur, len);
+		}
+	}
+	// Anything between the extents and EOF is in the delayed allocation buffer
+	if (hole) {return inode->size;}
+	return (pos < inode->size) ? (int64_t)pos : -ENXIO;
+}
+
+/**
+ * Control a file.
  *
- * NOTE: You only have to implement the setting of modification time (mtime).
+ * Implements the ioctl() system call for A1FS_IOC_SEEK_DATA and
+ * A1FS_IOC_SEEK_HOLE (see a1fs.h), so that tools can copy sparse files
+ * without reading their holes.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists.
+ * Errors:
+ *   ENOTTY  unknown command.
+ *   ENXIO   see seek_data_hole().
  *
- * @param path  path to the file or directory.
- * @param tv    timestamps array. See "man 2 utimensat" for details.
- * @return      0 on success; -errno on failure.
+ * @param path   path to the file.
+ * @param cmd    ioctl command.
+ * @param arg    unused.
+ * @param fi     unused.
+ * @param flags  FUSE_IOCTL_* flags.
+ * @param data   the int64_t offset argument, replaced with the result.
+ * @return       0 on success; -errno on error.
  */
-static int a1fs_utimens(const char *path, const struct timespec tv[2])
+static int a1fs_ioctl(const char *path, int cmd, void *arg,
+                      struct fuse_file_info *fi, unsigned int flags, void *data)
 {
+	(void)arg;// unused
+	(void)fi;// unused
+	if (flags & FUSE_IOCTL_COMPAT) return -ENOSYS;
+	unsigned int op = (unsigned int)cmd;
+	if ((op != A1FS_IOC_SEEK_DATA) && (op != A1FS_IOC_SEEK_HOLE)) return -ENOTTY;
+	int64_t *offset = data;
+	if (*offset < 0) return -ENXIO;
+
 	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *)image;
-	
-	a1fs_ino_t ino_num = get_ino_num_by_path(path);
-	a1fs_inode *inode = (a1fs_inode *) (image + A1FS_BLOCK_SIZE * sb->bg_inode_table + sizeof(a1fs_inode) * (ino_num - 1));
-	inode->mtime.tv_sec = tv[1].tv_sec;
-	inode->mtime.tv_nsec = tv[1].tv_nsec;
-	return 0;
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, false);
+	if (ret >= 0) {
+		a1fs_ino_t file_ino_num = (a1fs_ino_t) ret;
+		a1fs_inode *file_ino = get_inode(file_ino_num);
+		int64_t found = seek_data_hole(file_ino, *offset, op == A1FS_IOC_SEEK_HOLE);
+		fs_unlock_inode(fs, file_ino_num);
+		if (found >= 0) {
+			*offset = found;
+			ret = 0;
+		} else {
+			ret = found;
+		}
+	}
+	fs_unlock_ns(fs);
+	return ret;
+}
+
+// Names of the allocation hint extended attributes, in listxattr() order
+static const char *const hint_attrs[] = {
+	A1FS_XATTR_SIZE, A1FS_XATTR_CONTIGUOUS, A1FS_XATTR_GROUP,
+};
+
+// Check whether an extended attribute name is one of the allocation hints
+static bool is_hint_attr(const char *name)
+{
+	for (size_t i = 0; i < sizeof(hint_attrs) / sizeof(hint_attrs[0]); i++) {
+		if (strcmp(name, hint_attrs[i]) == 0) return true;
+	}
+	return false;
+}
+
+// Get the value of an allocation hint extended attribute of an inode; false
+// if the hint is not set (or name is not a hint)
+static bool get_hint_attr(const a1fs_inode *inode, const char *name, uint64_t *value)
+{
+	if (strcmp(name, A1FS_XATTR_SIZE) == 0) {
+		uint8_t order = inode->hint_size_order;
+		if ((order == 0) || (order > A1FS_HINT_SIZE_ORDER_MAX)) return false;
+		*value = (UINT64_C(1) << (order - 1)) * A1FS_BLOCK_SIZE;
+	} else if (strcmp(name, A1FS_XATTR_CONTIGUOUS) == 0) {
+		if ((inode->hint_contig != A1FS_HINT_CONTIG_YES) && (inode->hint_contig != A1FS_HINT_CONTIG_NO)) return false;
+		*value = (inode->hint_contig == A1FS_HINT_CONTIG_YES);
+	} else if (strcmp(name, A1FS_XATTR_GROUP) == 0) {
+		long group = hint_group(inode);
+		if (group < 0) return false;
+		*value = group;
+	} else {
+		return false;
+	}
+	return true;
 }
 
-// return 0 if there are enough free extents, otherwise return 1
-int if_extent_can_hold_length(uint32_t *bitmap, uint32_t limit, uint32_t len, a1fs_inode *inode){
+// Set (or clear, if value is NULL) an allocation hint of an inode
+static int set_hint_attr(a1fs_inode *inode, const char *name, const uint64_t *value)
+{
 	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	uint32_t remaining = len;
-	int extent_need = 0;
-	while (remaining > 0){
-		uint32_t longest = find_largest_chunk(bitmap, limit);
-		if (longest > remaining){
-			extent_need ++;
-			remaining = 0;
-		} else{
-			extent_need ++;
-			remaining -= longest;
-		}
-	}
-	unsigned short extent_count = inode->extentcount;
-	a1fs_extent *new_extent_block;
-	unsigned short i = 0;
-	while (i < extent_count){
-		if (extent_need == 0){break;}
-		new_extent_block = (a1fs_extent *) (image + A1FS_BLOCK_SIZE * inode->extentblock + (a1fs_blk_t)i * A1FS_BLOCK_SIZE);
-		if (new_extent_block->count == 0){
-			extent_need --;
+	if (strcmp(name, A1FS_XATTR_SIZE) == 0) {
+		uint8_t order = 0;
+		if (value != NULL) {
+			uint64_t blocks = *value / A1FS_BLOCK_SIZE + (*value % A1FS_BLOCK_SIZE != 0);
+			if ((blocks == 0) || (blocks > UINT64_C(1) << (A1FS_HINT_SIZE_ORDER_MAX - 1))) return -EINVAL;
+			for (order = 1; (UINT64_C(1) << (order - 1)) < blocks; order++);
 		}
-		i++;
+		inode->hint_size_order = order;
+	} else if (strcmp(name, A1FS_XATTR_CONTIGUOUS) == 0) {
+		if ((value != NULL) && (*value > 1)) return -EINVAL;
+		inode->hint_contig = (value == NULL) ? 0 : (*value ? A1FS_HINT_CONTIG_YES : A1FS_HINT_CONTIG_NO);
+	} else if (strcmp(name, A1FS_XATTR_GROUP) == 0) {
+		if ((value != NULL) && (*value >= fs->groups.count)) return -EINVAL;
+		inode->hint_group = (value == NULL) ? 0 : *value + 1;
+	} else {
+		return -ENOTSUP;
 	}
-	if (extent_need == 0){
-		return 0;
+	return 0;
+}
+
+// Parse a decimal extended attribute value (not null-terminated)
+static bool parse_attr_value(const char *value, size_t size, uint64_t *number)
+{
+	// Some tools count the terminating null character
+	if ((size > 0) && (value[size - 1] == '\0')) size--;
+	if (size == 0) return false;
+	*number = 0;
+	for (size_t i = 0; i < size; i++) {
+		if ((value[i] < '0') || (value[i] > '9')) return false;
+		unsigned digit = value[i] - '0';
+		if (*number > (UINT64_MAX - digit) / 10) return false;
+		*number = *number * 10 + digit;
 	}
-	return 1;
+	return true;
 }
 
-// pad the buf with size many zeroes
-void pad_zeroes(char *buf, size_t size) {
-	memset(buf, 0, size);
+// Copy an extended attribute value (or name list) to a caller's buffer; with
+// size 0, only its length is returned
+static int copy_attr_out(char *buf, size_t size, const char *data, size_t len)
+{
+	if (size == 0) return len;
+	if (size < len) return -ERANGE;
+	memcpy(buf, data, len);
+	return len;
 }
 
 /**
- * Change the size of a file.
- *
- * Implements the truncate() system call. Supports both extending and shrinking.
- * If the file is extended, future reads from the new uninitialized range must
- * return zero data.
+ * Set an extended attribute of a file or directory.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
+ * Implements the setxattr() system call. See "man 2 setxattr" for details.
+ * Only the allocation hint attributes (A1FS_XATTR_*) are supported; they take
+ * effect for the data allocated from then on, and are copied to the files and
+ * directories created in a directory.
  *
  * Errors:
- *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
+ *   ENOTSUP  name is not an allocation hint.
+ *   EINVAL   the value is out of range.
+ *   EEXIST   XATTR_CREATE was given and the hint is set.
+ *   ENODATA  XATTR_REPLACE was given and the hint is not set.
  *
- * @param path  path to the file to set the size.
- * @param size  new file size in bytes.
- * @return      0 on success; -errno on error.
+ * @param path   path to the file or directory.
+ * @param name   attribute name.
+ * @param value  attribute value, not null-terminated.
+ * @param size   size of the value.
+ * @param flags  XATTR_CREATE, XATTR_REPLACE or 0.
+ * @return       0 on success; -errno on error.
  */
-static int a1fs_truncate(const char *path, off_t size)
+static int a1fs_setxattr(const char *path, const char *name, const char *value,
+                         size_t size, int flags)
 {
+	if (!is_hint_attr(name)) return -ENOTSUP;
+	uint64_t number;
+	if (!parse_attr_value(value, size, &number)) return -EINVAL;
+
 	fs_ctx *fs = get_fs();
-	printf("\nEntered into truncate\n");
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *) image;
-	a1fs_ino_t ino_num = get_ino_num_by_path(path);
-	a1fs_inode *curr_inode = (image + A1FS_BLOCK_SIZE*(sb->bg_inode_table) + sizeof(a1fs_inode)*(ino_num - 1));
-	uint32_t *data_bitmap = (uint32_t *) (image + sb->bg_block_bitmap * A1FS_BLOCK_SIZE);
-	clock_gettime(CLOCK_REALTIME, &(curr_inode->mtime));
-	if(curr_inode->size == (uint64_t)size) {return 0;}
-	// shrinking
-	else if (curr_inode->size > (uint64_t)size){
-		curr_inode->size = (uint64_t)size;
-		uint32_t num_block_need = ceil_divide((uint32_t)size, A1FS_BLOCK_SIZE);
-		uint32_t num_block_old = ceil_divide((uint32_t)curr_inode->size, A1FS_BLOCK_SIZE);
-		uint32_t num_block_delete = num_block_old - num_block_need;
-		a1fs_extent *extent_block;
-		unsigned short extent_count = curr_inode->extentcount;
-		sb->s_free_blocks_count += num_block_delete;
-		while (num_block_delete > 0){
-			extent_block = (a1fs_extent *) (image + A1FS_BLOCK_SIZE * curr_inode->extentblock + (a1fs_blk_t)extent_count * A1FS_BLOCK_SIZE);
-			if (extent_block->count >= num_block_delete){
-				a1fs_blk_t old_count = extent_block->count;
-				extent_block->count -= num_block_delete;
-				for (uint32_t i = 0; i < num_block_delete; i++){
-					setBitOff(data_bitmap, extent_block->start + old_count - i - sb->s_free_blocks_count);
-				}
-				num_block_delete = 0;
-			} 
-			else if (extent_block->count < num_block_delete && extent_block->count > 0){ 
-				a1fs_blk_t old_count = extent_block->count;
-				extent_block->count = 0;
-				for (uint32_t i = 0; i < old_count; i++){
-					setBitOff(data_bitmap, extent_block->start + old_count - i - sb->s_free_blocks_count);
-				}
-				num_block_delete -= old_count;
-			}
-			extent_count --;
-		}
-	}
-	// extending
-	else if (curr_inode->size < (uint64_t)size){
-		uint32_t num_block_need = ceil_divide((uint32_t)size, A1FS_BLOCK_SIZE) - ceil_divide(curr_inode->size, A1FS_BLOCK_SIZE);
-		printf("%d\n", num_block_need);
-		if (num_block_need > sb->s_free_blocks_count){ return -ENOSPC;}
-		if (curr_inode->extentcount == 0){ alloc_extent_block(curr_inode);}
-		long result = find_free_entry_of_length_in_bitmap(data_bitmap, sb->data_block_count, num_block_need);
-		// find a continuous block 
-		if (result > 0){
-			// inode has no extent initialized
-			if (curr_inode->extentcount == 0){
-				a1fs_extent *new_extent_block = (a1fs_extent *) (image + A1FS_BLOCK_SIZE * curr_inode->extentblock);
-				new_extent_block->start = (a1fs_blk_t)result + sb->bg_data_block;
-				new_extent_block->count = num_block_need;
-				for (uint32_t j = 0; j < num_block_need; j++){
-					setBitOn(data_bitmap, (uint32_t)result + j);
-				}
-				curr_inode->extentcount = 512;
-				a1fs_extent *curr_extent_block; 
-				for (uint32_t i = 1; i < A1FS_BLOCK_SIZE / sizeof(a1fs_extent); i++) {
-					curr_extent_block = (a1fs_extent *)(image + A1FS_BLOCK_SIZE * curr_inode->extentblock + sizeof(a1fs_extent) * i);
-					curr_extent_block->count = 0;
-				}
-				char * new_data_block = (char *) (image + A1FS_BLOCK_SIZE * new_extent_block->start);
-				pad_zeroes(new_data_block, new_extent_block->count * A1FS_BLOCK_SIZE);
-				curr_inode->size = (uint64_t)size;
-				sb->s_free_blocks_count -= num_block_need;
-			}
-			else if (curr_inode->extentcount > 0){
-				unsigned short i = 0;
-				while (i < curr_inode->extentcount){
-					a1fs_extent * new_extent_block = (a1fs_extent *) (image + A1FS_BLOCK_SIZE * curr_inode->extentblock + (a1fs_blk_t)i * A1FS_BLOCK_SIZE);
-					if (new_extent_block->count == 0){
-						new_extent_block->start = (a1fs_blk_t) result + sb->bg_data_block;
-						new_extent_block->count = num_block_need;
-						for (uint32_t j = 0; j < num_block_need; j++){
-							setBitOn(data_bitmap, (uint32_t)result + j);
-						}
-						curr_inode->size = (uint64_t)size;
-						sb->s_free_blocks_count -= num_block_need;
-						char * new_data_block = (char *) (image + A1FS_BLOCK_SIZE * new_extent_block->start);
-						pad_zeroes(new_data_block, new_extent_block->count * A1FS_BLOCK_SIZE);
-						break;
-					}
-					i ++;
-				}
-			}
-		}else if (result < 0){
-			if (curr_inode->extentcount == 0){ alloc_extent_block(curr_inode);}
-			if (curr_inode->extentcount == 0){
-				curr_inode->extentcount = 512;
-				a1fs_extent * new_extent_block;
-				for (uint32_t i = 0; i < A1FS_BLOCK_SIZE / sizeof(a1fs_extent); i++) {
-					new_extent_block = (a1fs_extent *)(image + A1FS_BLOCK_SIZE * curr_inode->extentblock + sizeof(a1fs_extent) * i);
-					new_extent_block->count = 0;
-				}
-			}
-			if (if_extent_can_hold_length(data_bitmap, sb->data_block_count, num_block_need, curr_inode) == 1){return -ENOSPC;}
-			curr_inode->size = (uint64_t)size;
-			sb->s_free_blocks_count -= num_block_need;
-			while (num_block_need > 0){
-				uint32_t longest = find_largest_chunk(data_bitmap, sb->data_block_count);
-				if (longest >= num_block_need){ 
-					result = find_free_entry_of_length_in_bitmap(data_bitmap, sb->data_block_count, longest);
-					unsigned short extent_count = curr_inode->extentcount;
-					a1fs_extent *new_extent_block; 
-					unsigned short i = 0;
-					while (i < extent_count){
-						new_extent_block = (a1fs_extent *) (image + A1FS_BLOCK_SIZE * curr_inode->extentblock + (a1fs_blk_t)i * A1FS_BLOCK_SIZE);
-						if (new_extent_block->count == 0){
-							new_extent_block->start = (a1fs_blk_t)result + sb->bg_data_block;
-							new_extent_block->count = num_block_need;
-							for (uint32_t j = 0; j < num_block_need; j++){
-									setBitOn(data_bitmap, (uint32_t)result + j);
-							}
-							char * new_data_block = (char *) (image + A1FS_BLOCK_SIZE * new_extent_block->start);
-							pad_zeroes(new_data_block, new_extent_block->count * A1FS_BLOCK_SIZE);
-							break;
-						}
-						i ++;
-					}
-					num_block_need = 0;
-				}
-				else if (longest < num_block_need){
-					result = find_free_entry_of_length_in_bitmap(data_bitmap, sb->data_block_count, longest);
-					unsigned short extent_count = curr_inode->extentcount;
-					unsigned short i = 0;
-					a1fs_extent * new_extent_block;
-					while (i < extent_count){
-						new_extent_block = (a1fs_extent *) (image + A1FS_BLOCK_SIZE * curr_inode->extentblock + (a1fs_blk_t)i * A1FS_BLOCK_SIZE);
-						if (new_extent_block->count == 0){
-							new_extent_block->start = (a1fs_blk_t)result + sb->bg_data_block;
-							new_extent_block->count = longest;
-							for (uint32_t j = 0; j < longest; j++){
-								setBitOn(data_bitmap, (uint32_t)result + j);
-							}
-							char * new_data_block = (char *) (image + A1FS_BLOCK_SIZE * new_extent_block->start);
-							pad_zeroes(new_data_block, new_extent_block->count * A1FS_BLOCK_SIZE);
-							num_block_need -= longest;
-							break;
-						}
-						i ++;
-					}
-				}
-			}
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, true);
+	if (ret >= 0) {
+		a1fs_ino_t ino_num = (a1fs_ino_t) ret;
+		a1fs_inode *inode = get_inode(ino_num);
+		uint64_t old;
+		bool exists = get_hint_attr(inode, name, &old);
+		if ((flags & XATTR_CREATE) && exists) {
+			ret = -EEXIST;
+		} else if ((flags & XATTR_REPLACE) && !exists) {
+			ret = -ENODATA;
+		} else {
+			ret = set_hint_attr(inode, name, &number);
 		}
+		fs_unlock_inode(fs, ino_num);
 	}
-
-	return 0;
+	fs_unlock_ns(fs);
+	return ret;
 }
 
-
 /**
- * Read data from a file.
+ * Get an extended attribute of a file or directory.
  *
- * Implements the pread() system call. Should return exactly the number of bytes
- * requested except on EOF (end of file) or error, otherwise the rest of the
- * data will be substituted with zeros. Reads from file ranges that have not
- * been written to must return zero data.
+ * Implements the getxattr() system call. See "man 2 getxattr" for details. The
+ * expected size hint reads back rounded up to a power of 2 blocks.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
+ * Errors:
+ *   ENODATA  the attribute is not set.
+ *   ERANGE   the buffer is too small for the value.
  *
- * @param path    path to the file to read from.
- * @param buf     pointer to the buffer that receives the data.
- * @param size    buffer size - number of bytes requested.
- * @param offset  offset from the beginning of the file to read from.
- * @param fi      unused.
- * @return        number of bytes read on success; 0 if offset is beyond EOF;
- *                -errno on error.
+ * @param path   path to the file or directory.
+ * @param name   attribute name.
+ * @param value  buffer for the value.
+ * @param size   size of the buffer; 0 to only get the size of the value.
+ * @return       size of the value on success; -errno on error.
  */
-static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
-                     struct fuse_file_info *fi)
+static int a1fs_getxattr(const char *path, const char *name, char *value, size_t size)
 {
-	// unused
-	(void)fi;
 	fs_ctx *fs = get_fs();
-	void *image = fs->image;
-	a1fs_superblock *sb = (a1fs_superblock *)image;
-	a1fs_ino_t file_ino_num = (a1fs_ino_t) get_ino_num_by_path(path);
-	a1fs_inode *file_ino = (a1fs_inode *)(image + A1FS_BLOCK_SIZE * sb->bg_inode_table + sizeof(a1fs_inode) * (file_ino_num-1));
-	// If file is empty or the offset is beyond EOF, substitude the rest of the data with 0
-	char *currbyte;
-	if (file_ino->size == 0 || (currbyte = (char *)seekbyte(file_ino, offset)) == NULL) {
-		pad_zeroes(buf, size);
-		return 0;
-	}
-	uint64_t bytes_read = 0;
-	while (size > 0) {
-		if (bytes_read == file_ino->size - offset) {
-			pad_zeroes(buf, size);
-			break;
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, false);
+	if (ret >= 0) {
+		a1fs_ino_t ino_num = (a1fs_ino_t) ret;
+		a1fs_inode *inode = get_inode(ino_num);
+		uint64_t number;
+		bool exists = get_hint_attr(inode, name, &number);
+		fs_unlock_inode(fs, ino_num);
+		if (exists) {
+			char buf[24];
+			int len = snprintf(buf, sizeof(buf), "%" PRIu64, number);
+			ret = copy_attr_out(value, size, buf, len);
+		} else {
+			ret = -ENODATA;
 		}
-		memcpy(buf, currbyte, 1);
-		buf++;
-		bytes_read++;
-		currbyte = (char *)seekbyte(file_ino, offset+bytes_read);
-		size--;
 	}
-	return bytes_read;
+	fs_unlock_ns(fs);
+	return ret;
 }
 
 /**
- * Write data to a file.
+ * List the extended attributes of a file or directory: the allocation hints
+ * that are set.
  *
- * Implements the pwrite() system call. Should return exactly the number of
- * bytes requested except on error. If the offset is beyond EOF (end of file),
- * the file must be extended. If the write creates a "hole" of uninitialized
- * data, future reads from the "hole" must return zero data.
+ * Implements the listxattr() system call. See "man 2 listxattr" for details.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
+ * Errors:
+ *   ERANGE  the buffer is too small for the list.
  *
- * @param path    path to the file to write to.
- * @param buf     pointer to the buffer containing the data.
- * @param size    buffer size - number of bytes requested.
- * @param offset  offset from the beginning of the file to write to.
- * @param fi      unused.
- * @return        number of bytes written on success; -errno on error.
+ * @param path  path to the file or directory.
+ * @param list  buffer for the null-terminated names.
+ * @param size  size of the buffer; 0 to only get the size of the list.
+ * @return      size of the list on success; -errno on error.
  */
-static int a1fs_write(const char *path, const char *buf, size_t size,
-                      off_t offset, struct fuse_file_info *fi)
+static int a1fs_listxattr(const char *path, char *list, size_t size)
 {
-	(void)fi;// unused
 	fs_ctx *fs = get_fs();
-	void *image = fs->image; 
-	a1fs_superblock *sb = (a1fs_superblock *) image;
-	a1fs_ino_t file_ino_num = get_ino_num_by_path(path);
-	a1fs_inode *file_ino = (a1fs_inode *) (image + A1FS_BLOCK_SIZE * sb->bg_inode_table + sizeof(a1fs_inode) * (file_ino_num-1));
-
-	// Nothing to write
-	if (size == 0) {return 0;}
-
-	// Now size > 0 we have something to write
-	// Check whether file size is enough, if not, allocate more as needed
-	if ((file_ino->size == 0) || (offset+size > file_ino->size)) {
-		int ret = a1fs_truncate(path, offset+size);
-		if (ret < 0) {return ret;}
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, false);
+	if (ret >= 0) {
+		a1fs_ino_t ino_num = (a1fs_ino_t) ret;
+		a1fs_inode *inode = get_inode(ino_num);
+		char buf[64];
+		size_t len = 0;
+		for (size_t i = 0; i < sizeof(hint_attrs) / sizeof(hint_attrs[0]); i++) {
+			uint64_t number;
+			if (!get_hint_attr(inode, hint_attrs[i], &number)) continue;
+			size_t n = strlen(hint_attrs[i]) + 1;
+			memcpy(buf + len, hint_attrs[i], n);
+			len += n;
+		}
+		fs_unlock_inode(fs, ino_num);
+		ret = copy_attr_out(list, size, buf, len);
 	}
-	char *currbyte = (char *)seekbyte(file_ino, offset);
-	uint64_t bytes_wrote = 0;
-	while (size > 0) {
-		memcpy(currbyte, buf, 1);
-		buf++;
-		bytes_wrote++;
-		currbyte = (char *)seekbyte(file_ino, offset+bytes_wrote);
-		size--;
+	fs_unlock_ns(fs);
+	return ret;
+}
+
+/**
+ * Remove an extended attribute of a file or directory, clearing the
+ * allocation hint.
+ *
+ * Implements the removexattr() system call. See "man 2 removexattr" for
+ * details.
+ *
+ * Errors:
+ *   ENODATA  the attribute is not set.
+ *
+ * @param path  path to the file or directory.
+ * @param name  attribute name.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_removexattr(const char *path, const char *name)
+{
+	fs_ctx *fs = get_fs();
+	fs_lock_ns(fs, false);
+	long ret = lock_path(path, true);
+	if (ret >= 0) {
+		a1fs_ino_t ino_num = (a1fs_ino_t) ret;
+		a1fs_inode *inode = get_inode(ino_num);
+		uint64_t number;
+		ret = get_hint_attr(inode, name, &number) ? set_hint_attr(inode, name, NULL) : -ENODATA;
+		fs_unlock_inode(fs, ino_num);
 	}
-	return bytes_wrote;
+	fs_unlock_ns(fs);
+	return ret;
 }
 
 
@@ -1230,6 +3787,15 @@ static struct fuse_operations a1fs_ops = {
 	.truncate = a1fs_truncate,
 	.read     = a1fs_read,
 	.write    = a1fs_write,
+	.flush    = a1fs_flush,
+	.release  = a1fs_release,
+	.fsync    = a1fs_fsync,
+	.fallocate = a1fs_fallocate,
+	.ioctl    = a1fs_ioctl,
+	.setxattr = a1fs_setxattr,
+	.getxattr = a1fs_getxattr,
+	.listxattr = a1fs_listxattr,
+	.removexattr = a1fs_removexattr,
 };
 
 int main(int argc, char *argv[])
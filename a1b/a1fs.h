@@ -19,8 +19,10 @@
 #pragma once
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <limits.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 
 
@@ -42,6 +44,9 @@ typedef uint32_t a1fs_blk_t;
 /** Inode number type. */
 typedef uint32_t a1fs_ino_t;
 
+/** Inode number of the root directory. */
+#define A1FS_ROOT_INO 1
+
 
 /** Magic value that can be used to identify an a1fs image. */
 #define A1FS_MAGIC 0xC5C369A1C5C369A1ul
@@ -51,11 +56,88 @@ typedef uint32_t a1fs_ino_t;
 typedef struct a1fs_extent {
 	/** Starting block of the extent. */
 	a1fs_blk_t start;
-	/** Number of blocks in the extent. */
+	/**
+	 * Number of blocks in the extent, or'ed with A1FS_EXTENT_UNWRITTEN if the
+	 * extent is unwritten. Use a1fs_extent_len() to get the length.
+	 */
 	a1fs_blk_t count;
 
 } a1fs_extent;
 
+/**
+ * The blocks of the extent are allocated, but their contents are undefined
+ * and read as zeros (e.g. after fallocate()). Writing to an unwritten extent
+ * converts the written part into a normal one.
+ */
+#define A1FS_EXTENT_UNWRITTEN 0x80000000u
+
+/** Get the number of blocks in an extent. */
+static inline a1fs_blk_t a1fs_extent_len(const a1fs_extent *ext)
+{
+	return ext->count & ~A1FS_EXTENT_UNWRITTEN;
+}
+
+/** Check if an extent is unwritten. */
+static inline bool a1fs_extent_unwritten(const a1fs_extent *ext)
+{
+	return (ext->count & A1FS_EXTENT_UNWRITTEN) != 0;
+}
+
+/**
+ * Check if an extent is a hole: a range of the file with no blocks on disk
+ * that reads as zeros. Holes have start == 0, which is never a data block
+ * (block 0 is the superblock).
+ */
+static inline bool a1fs_extent_hole(const a1fs_extent *ext)
+{
+	return ext->start == 0;
+}
+
+
+/** Number of extent slots in an extent block (or extent tree leaf). */
+#define A1FS_EXTENTS_PER_BLOCK (A1FS_BLOCK_SIZE / sizeof(a1fs_extent))
+
+/** Extent tree index entry. */
+typedef struct a1fs_extent_idx {
+	/** First logical block covered by the child. */
+	uint64_t lblk;
+	/** Block number of the child. */
+	a1fs_blk_t block;
+	/** Number of extent slots in use in the child, if it is a leaf. */
+	uint32_t count;
+
+} a1fs_extent_idx;
+
+/**
+ * Node of the extent tree of a file (A1FS_INODE_EXTENT_TREE).
+ *
+ * Files with more extents than fit in one extent block have an extent tree:
+ * the extent block of the inode is the root index node, and the leaves are
+ * blocks of extent slots laid out like the extent block of other files. The
+ * entries of a node are sorted by logical block; a child covers the logical
+ * blocks from its lblk up to the lblk of the next entry. Entries of nodes
+ * with levels == 0 point to leaves, otherwise to other index nodes one level
+ * down.
+ */
+typedef struct a1fs_extent_node {
+	/** Number of index levels below this node. */
+	uint16_t levels;
+	/** Number of entries in use. */
+	uint16_t count;
+	uint32_t reserved[3];
+	/** Index entries. */
+	a1fs_extent_idx entries[(A1FS_BLOCK_SIZE - 16) / sizeof(a1fs_extent_idx)];
+
+} a1fs_extent_node;
+
+static_assert(sizeof(a1fs_extent_node) == A1FS_BLOCK_SIZE, "invalid extent node size");
+
+/** Maximum number of entries in an extent tree node. */
+#define A1FS_EXTENT_IDX_LIMIT ((A1FS_BLOCK_SIZE - 16) / sizeof(a1fs_extent_idx))
+
+/** Maximum number of index levels below the root of an extent tree. */
+#define A1FS_EXTENT_MAX_LEVELS 2
+
 
 /** a1fs inode. */
 typedef struct a1fs_inode {
@@ -72,15 +154,75 @@ typedef struct a1fs_inode {
 	 * when the file (or directory) is created, written to, or its size changes.
 	 */
 	struct timespec mtime; // 32
-	//number of extents
+	//number of extents; number of root entries with A1FS_INODE_EXTENT_TREE
 	unsigned short extentcount; // 4
 	//extent block
 	a1fs_blk_t extentblock; // 4
-	//directory entry count
-	uint64_t dentry_count; // 8
-	char padding[10]; // 10
+	//number of entries of a directory, not counting "." and ".."
+	uint64_t entry_count; // 8
+	//inode flags (A1FS_INODE_*)
+	uint16_t flags; // 2
+	//byte offset of the data in the fragment block (A1FS_INODE_FRAGMENT)
+	uint16_t frag_offset; // 2
+	//expected size hint: 2^(hint_size_order - 1) blocks; 0 if none
+	uint8_t hint_size_order; // 1
+	//contiguity hint (A1FS_HINT_CONTIG_*); 0 if none
+	uint8_t hint_contig; // 1
+	//placement hint: allocation group number + 1; 0 if none
+	uint16_t hint_group; // 2
+	//number of blocks of the file in holes
+	uint64_t hole_blocks; // 8
 } a1fs_inode;
 
+/** The directory is hash-indexed; its block 0 is the root of the index. */
+#define A1FS_INODE_DIR_INDEX 0x1
+/** The extent block is the root of an extent tree (see a1fs_extent_node). */
+#define A1FS_INODE_EXTENT_TREE 0x2
+/**
+ * The extents are stored in the inode itself, right after the a1fs_inode
+ * fields (see A1FS_FEATURE_INLINE_EXTENTS); extentblock is unused.
+ */
+#define A1FS_INODE_INLINE_EXTENTS 0x4
+
+/**
+ * The data of the file (size bytes) is stored in the inode itself, in place of
+ * the inline extents (see A1FS_FEATURE_INLINE_DATA); it has no extents.
+ */
+#define A1FS_INODE_INLINE_DATA 0x8
+
+/**
+ * The data of the file (size bytes) is stored in a fragment: a run of units of
+ * a fragment block shared with other small files (see a1fs_frag_header).
+ * extentblock is the fragment block and frag_offset the byte offset of the
+ * run in it; the file has no extents.
+ */
+#define A1FS_INODE_FRAGMENT 0x10
+
+/*
+ * Allocation hints (hint_* fields of an inode) are set with the user.a1fs.*
+ * extended attributes and copied to the files and directories created in a
+ * directory. They only steer where data is placed, so a hint that is out of
+ * range (e.g. left over in an image written before hints existed) is ignored.
+ */
+/** The file's data should be kept in as few extents as possible. */
+#define A1FS_HINT_CONTIG_YES 1
+/** The file's data need not be contiguous (no reservation windows). */
+#define A1FS_HINT_CONTIG_NO 2
+/** Largest expected size hint, as a hint_size_order. */
+#define A1FS_HINT_SIZE_ORDER_MAX 32
+
+/** Get the extent slots stored in a large inode (A1FS_INODE_INLINE_EXTENTS). */
+static inline a1fs_extent *a1fs_inode_extents(a1fs_inode *inode)
+{
+	return (a1fs_extent *)(inode + 1);
+}
+
+/** Get the data stored in a large inode (A1FS_INODE_INLINE_DATA). */
+static inline char *a1fs_inode_data(a1fs_inode *inode)
+{
+	return (char *)(inode + 1);
+}
+
 // A single block must fit an integral number of inodes
 static_assert(A1FS_BLOCK_SIZE % sizeof(a1fs_inode) == 0, "invalid inode size");
 
@@ -104,13 +246,134 @@ typedef struct a1fs_superblock {
 	unsigned int   inode_table_count;   /* Inodes table count */
 	a1fs_blk_t     bg_data_block;       /* First data block number */
 	unsigned int   data_block_count;    /* Data block count */
+	uint32_t       s_features;          /* Optional features (A1FS_FEATURE_*) */
+	uint32_t       s_hash_seed;         /* Directory name hash seed */
+	a1fs_blk_t     bg_group_desc;       /* Group descriptor table block number */
+	unsigned int   s_groups_count;      /* Allocation group count; 0 if none */
+	unsigned int   s_blocks_per_group;  /* Data blocks per allocation group */
+	unsigned int   s_inodes_per_group;  /* Inodes per allocation group */
+	uint32_t       s_inode_size;        /* Inode size in bytes; 0 if sizeof(a1fs_inode) */
 } a1fs_superblock;
 
+/** Directories that outgrow one block are converted to hash-indexed ones. */
+#define A1FS_FEATURE_DIR_INDEX 0x1
+/** Directory blocks hold variable length a1fs_dirent records. */
+#define A1FS_FEATURE_COMPACT_DIRENT 0x2
+/**
+ * The size of a directory is the bytes of its blocks and entry_count counts
+ * its entries. Always set by mkfs; the directories of images made before it
+ * (with 256 bytes of size per entry and 16 in entry_count per block) are
+ * converted at mount time.
+ */
+#define A1FS_FEATURE_DIR_SIZE 0x4
+/**
+ * Inodes are s_inode_size bytes and new files keep their first extents in the
+ * space after the a1fs_inode fields, until they need more than fit there.
+ */
+#define A1FS_FEATURE_INLINE_EXTENTS 0x8
+/**
+ * Inodes are s_inode_size bytes and regular files keep their data in the space
+ * after the a1fs_inode fields, until they grow past it.
+ */
+#define A1FS_FEATURE_INLINE_DATA 0x10
+/**
+ * Regular files of up to A1FS_FRAG_MAX bytes that do not fit in their inode
+ * keep their data in a fragment of a block shared with other small files.
+ */
+#define A1FS_FEATURE_TAIL_PACKING 0x20
+
+/** All the features this version knows; images with others are not mounted. */
+#define A1FS_FEATURE_ALL (A1FS_FEATURE_DIR_INDEX | A1FS_FEATURE_COMPACT_DIRENT | \
+                          A1FS_FEATURE_DIR_SIZE | A1FS_FEATURE_INLINE_EXTENTS | \
+                          A1FS_FEATURE_INLINE_DATA | A1FS_FEATURE_TAIL_PACKING)
+
+/** Default inode size of file systems with inline extents or data. */
+#define A1FS_LARGE_INODE_SIZE 128
+
+/** Get the size of the inodes in the inode table. */
+static inline uint32_t a1fs_inode_size(const a1fs_superblock *sb)
+{
+	return (sb->s_inode_size != 0) ? sb->s_inode_size : sizeof(a1fs_inode);
+}
+
 // Superblock must fit into a single block
 static_assert(sizeof(a1fs_superblock) <= A1FS_BLOCK_SIZE,
               "superblock is too large");
 
 
+/**
+ * Allocation group descriptor.
+ *
+ * The data region and the inode table are split into allocation groups:
+ * group g owns data blocks [g * s_blocks_per_group, (g + 1) * s_blocks_per_group)
+ * (relative to bg_data_block) and inodes [g * s_inodes_per_group + 1,
+ * (g + 1) * s_inodes_per_group]; the last group may be shorter. Each group
+ * owns the matching slices of the data and inode bitmaps, so allocations in
+ * different groups touch disjoint metadata. Both per-group counts are
+ * multiples of 64, so every slice starts at a 64-bit bitmap word.
+ */
+typedef struct a1fs_group_desc {
+	/** Free data blocks in the group. */
+	uint32_t free_blocks_count;
+	/** Free inodes in the group. */
+	uint32_t free_inodes_count;
+
+} a1fs_group_desc;
+
+/** Default number of data blocks per allocation group (one bitmap block). */
+#define A1FS_BLOCKS_PER_GROUP BITS_PER_BLOCK
+
+
+/** Size of the units fragment blocks are split into. */
+#define A1FS_FRAG_UNIT 64
+/** Number of units in a fragment block, including the header. */
+#define A1FS_FRAG_UNITS (A1FS_BLOCK_SIZE / A1FS_FRAG_UNIT)
+/** Largest file stored in a fragment. */
+#define A1FS_FRAG_MAX (A1FS_BLOCK_SIZE / 2)
+
+/**
+ * Header of a fragment block (A1FS_FEATURE_TAIL_PACKING), in its first unit.
+ * The other units hold the data of small files, each file in a run of
+ * consecutive units (see A1FS_INODE_FRAGMENT). The block is freed when its
+ * last fragment is.
+ */
+typedef struct a1fs_frag_header {
+	/** Occupancy map: bit i is set if unit i is in use; unit 0 is the header. */
+	uint64_t map;
+	char padding[A1FS_FRAG_UNIT - 8];
+} a1fs_frag_header;
+
+// The occupancy map must cover every unit of a block
+static_assert(A1FS_FRAG_UNITS == 64, "invalid fragment unit size");
+static_assert(sizeof(a1fs_frag_header) == A1FS_FRAG_UNIT, "invalid fragment header size");
+
+
+/**
+ * ioctl() commands to find data and holes in a sparse file, like lseek() with
+ * SEEK_DATA and SEEK_HOLE. The argument is an int64_t file offset; it is
+ * replaced by the offset of the first data byte (or hole) at or after it. The
+ * end of the file counts as a hole. Unwritten extents count as holes.
+ *
+ * Errors:
+ *   ENXIO  the offset is at or past EOF, or there is no data after it.
+ */
+#define A1FS_IOC_SEEK_DATA _IOWR('a', 1, int64_t)
+#define A1FS_IOC_SEEK_HOLE _IOWR('a', 2, int64_t)
+
+/**
+ * Extended attributes that set the allocation hints of a file or directory
+ * (the hint_* fields of a1fs_inode). Values are decimal numbers:
+ *   A1FS_XATTR_SIZE        expected file size in bytes; rounded up to a power
+ *                          of 2 blocks.
+ *   A1FS_XATTR_CONTIGUOUS  1 if the data should be contiguous, 0 if it need not.
+ *   A1FS_XATTR_GROUP       allocation group to place inodes and data in.
+ */
+#define A1FS_XATTR_PREFIX "user.a1fs."
+#define A1FS_XATTR_SIZE A1FS_XATTR_PREFIX "size"
+#define A1FS_XATTR_CONTIGUOUS A1FS_XATTR_PREFIX "contiguous"
+#define A1FS_XATTR_GROUP A1FS_XATTR_PREFIX "group"
+
+
 /** Maximum file name (path component) length. Includes the null terminator. */
 #define A1FS_NAME_MAX 252
 
@@ -127,3 +390,93 @@ typedef struct a1fs_dentry {
 } a1fs_dentry;
 
 static_assert(sizeof(a1fs_dentry) == 256, "invalid dentry size");
+
+/**
+ * Variable length directory entry, used instead of a1fs_dentry if the file
+ * system has A1FS_FEATURE_COMPACT_DIRENT.
+ *
+ * The records of a directory block tile the whole block: each rec_len leads
+ * to the next record. A record with ino == 0 is free space, and so is the
+ * slack at the end of a record that is longer than its name needs.
+ */
+typedef struct a1fs_dirent {
+	/** Inode number; 0 if the record is free. */
+	a1fs_ino_t ino;
+	/** Length of the whole record in bytes, a multiple of 4. */
+	uint16_t rec_len;
+	/** Length of the name, not including the null terminator. */
+	uint8_t name_len;
+	uint8_t reserved;
+	/** Name hash (a1fs_name_hash()), to reject most names without strcmp. */
+	uint32_t hash;
+	/** File name. A null-terminated string. */
+	char name[];
+
+} a1fs_dirent;
+
+static_assert(sizeof(a1fs_dirent) == 12, "invalid dirent size");
+
+/** Smallest record length that fits a name of the given length. */
+#define A1FS_DIRENT_LEN(name_len) \
+	((sizeof(a1fs_dirent) + (name_len) + 1 + 3) & ~(size_t)3)
+
+
+/**
+ * Hash of a file name, used to place directory entries in hash-indexed
+ * directories. This is part of the on-disk format and must not change.
+ *
+ * The seed is picked at random by mkfs, so that names that collide cannot be
+ * worked out in advance.
+ *
+ * @param name  the name.
+ * @param seed  hash seed of the file system (s_hash_seed).
+ */
+static inline uint32_t a1fs_name_hash(const char *name, uint32_t seed)
+{
+	// 32-bit FNV-1a of the seed bytes (if any) followed by the name
+	uint32_t h = 0x811c9dc5u;
+	for (int i = 0; (seed != 0) && (i < 4); i++) {
+		h = (h ^ ((seed >> (8 * i)) & 0xff)) * 0x01000193u;
+	}
+	for (; *name != '\0'; name++) {
+		h = (h ^ (unsigned char)*name) * 0x01000193u;
+	}
+	return h;
+}
+
+/** Directory index entry. */
+typedef struct a1fs_dx_entry {
+	/** Lowest name hash stored under the block. */
+	uint32_t hash;
+	/** Logical block number of the child within the directory. */
+	uint32_t block;
+
+} a1fs_dx_entry;
+
+/**
+ * Node of the hash index of a directory (htree).
+ *
+ * The root is block 0 of the directory. Entries are sorted by hash and the
+ * first entry always has hash 0; a name is stored under the last entry whose
+ * hash is not greater than the name hash. Entries of nodes with levels == 0
+ * point to leaf blocks holding the directory entries, otherwise to other
+ * index nodes one level down.
+ */
+typedef struct a1fs_dx_node {
+	/** Number of index levels below this node. */
+	uint16_t levels;
+	/** Number of entries in use. */
+	uint16_t count;
+	uint32_t reserved;
+	/** Index entries. */
+	a1fs_dx_entry entries[(A1FS_BLOCK_SIZE - 8) / sizeof(a1fs_dx_entry)];
+
+} a1fs_dx_node;
+
+static_assert(sizeof(a1fs_dx_node) == A1FS_BLOCK_SIZE, "invalid dx node size");
+
+/** Maximum number of entries in an index node. */
+#define A1FS_DX_LIMIT ((A1FS_BLOCK_SIZE - 8) / sizeof(a1fs_dx_entry))
+
+/** Maximum number of index levels below the root. */
+#define A1FS_DX_MAX_LEVELS 2
@@ -0,0 +1,701 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs tests.
+ *
+ * Calls the file system operations directly on a formatted image, without
+ * mounting it, and checks the results and the on-disk state. The image should
+ * be freshly formatted with at least 4096 inodes and 16 MB; test.sh runs the
+ * tests on images with each set of optional features.
+ *
+ * Usage: ./a1fs_test image
+ */
+
+// The driver is compiled into the test so that the tests can reach its
+// internal functions and check its state
+#define main a1fs_main
+#include "a1fs.c"
+#undef main
+
+#include <linux/falloc.h>
+
+#include "free_extents.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                           \
+	do {                                                                  \
+		if (!(cond)) {                                                \
+			fprintf(stderr, "%s:%d: check failed: %s\n",          \
+			        __FILE__, __LINE__, #cond);                   \
+			__atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);   \
+		}                                                             \
+	} while (0)
+
+static a1fs_opts opts;
+static fs_ctx fs;
+static struct fuse_file_info fi;
+
+static unsigned char data[1 << 18];
+// One byte more than data, to check that reads stop at EOF
+static unsigned char buf[sizeof(data) + 1];
+
+// The operations get the file system context from FUSE; there is no FUSE
+// session here, so the context is the file system under test
+static struct fuse_context context = { .private_data = &fs };
+
+struct fuse_context *fuse_get_context(void)
+{
+	return &context;
+}
+
+// Mount the image; also used to remount it after a1fs_destroy()
+static bool mount_image(void)
+{
+	memset(&fs, 0, sizeof(fs));
+	return a1fs_init(&fs, &opts);
+}
+
+// Get the inode of a path
+static a1fs_inode *path_inode(const char *path)
+{
+	long ino = get_ino_num_by_path(path);
+	if (ino <= 0) return NULL;
+	return get_inode(ino);
+}
+
+// Count the entries of a directory
+static int count_filler(void *count, const char *name, const struct stat *st, off_t off)
+{
+	(void)name;// unused
+	(void)st;// unused
+	(void)off;// unused
+	(*(int*)count)++;
+	return 0;
+}
+
+static int count_entries(const char *path)
+{
+	int count = 0;
+	CHECK(a1fs_ops.readdir(path, &count, count_filler, 0, &fi) == 0);
+	return count;
+}
+
+static fsblkcnt_t free_blocks(void)
+{
+	struct statvfs st;
+	CHECK(a1fs_ops.statfs("/", &st) == 0);
+	return st.f_bfree;
+}
+
+static fsfilcnt_t free_inodes(void)
+{
+	struct statvfs st;
+	CHECK(a1fs_ops.statfs("/", &st) == 0);
+	return st.f_ffree;
+}
+
+// Write a file and flush it, so that its data is in its final place
+static bool write_and_flush(const char *path, const void *src, size_t size, off_t offset)
+{
+	if (a1fs_ops.write(path, src, size, offset, &fi) != (int)size) return false;
+	return a1fs_ops.flush(path, &fi) == 0;
+}
+
+// Check that a file holds exactly the given bytes
+static bool file_equals(const char *path, const void *expected, size_t size)
+{
+	memset(buf, 0xAA, size + 1);
+	if (a1fs_ops.read(path, (char*)buf, size + 1, 0, &fi) != (int)size) return false;
+	return memcmp(buf, expected, size) == 0;
+}
+
+static int64_t seek(const char *path, unsigned int cmd, int64_t offset)
+{
+	int ret = a1fs_ops.ioctl(path, cmd, NULL, &fi, 0, &offset);
+	return (ret < 0) ? ret : offset;
+}
+
+/**
+ * Check that the allocation groups agree with the bitmaps: the free counts
+ * in the group descriptors and the superblock, and the in-memory free extent
+ * index of each group.
+ */
+static void check_groups(void)
+{
+	a1fs_superblock *sb = fs.image;
+	uint32_t total_blocks = 0, total_inodes = 0;
+
+	for (uint32_t g = 0; g < fs.groups.count; g++) {
+		alloc_group *grp = &fs.groups.groups[g];
+
+		uint32_t nblocks = 0;
+		for (uint32_t i = 0; i < grp->nblocks; i++) {
+			nblocks += !bitmap_test(fs.groups.data_bitmap, grp->first_block + i);
+		}
+		uint32_t ninodes = 0;
+		for (uint32_t i = 0; i < grp->ninodes; i++) {
+			ninodes += !bitmap_test(fs.groups.inode_bitmap, grp->first_inode + i);
+		}
+		CHECK(grp->desc->free_blocks_count == nblocks);
+		CHECK(grp->desc->free_inodes_count == ninodes);
+		total_blocks += nblocks;
+		total_inodes += ninodes;
+
+		free_extent_index fe;
+		CHECK(fext_init(&fe, fs.groups.data_bitmap + grp->first_block / 32, grp->nblocks));
+		uint32_t start, index_start;
+		CHECK(grp->free_blocks.count == fe.count);
+		CHECK(fext_largest(&grp->free_blocks, &index_start) == fext_largest(&fe, &start));
+		fext_destroy(&fe);
+	}
+	CHECK(sb->s_free_blocks_count == total_blocks);
+	CHECK(sb->s_free_inodes_count == total_inodes);
+}
+
+/** Files: reads and writes across blocks, truncate, and space accounting. */
+static void test_files(void)
+{
+	struct stat st;
+
+	// The first entry allocates the root directory, which does not shrink
+	CHECK(a1fs_ops.create("/file", S_IFREG | 0644, &fi) == 0);
+	fsblkcnt_t bfree = free_blocks();
+	for (size_t i = 0; i < sizeof(data); i++) data[i] = rand();
+
+	// Unaligned writes, each spanning a block boundary
+	for (size_t off = 0; off < sizeof(data); off += 5000) {
+		size_t len = (off + 5000 > sizeof(data)) ? sizeof(data) - off : 5000;
+		CHECK(a1fs_ops.write("/file", (char*)data + off, len, off, &fi) == (int)len);
+	}
+	CHECK(a1fs_ops.flush("/file", &fi) == 0);
+	CHECK(a1fs_ops.getattr("/file", &st) == 0);
+	CHECK((st.st_size == (off_t)sizeof(data)) && (st.st_blocks == (blkcnt_t)sizeof(data) / 512));
+	CHECK(file_equals("/file", data, sizeof(data)));
+
+	// Shrink, then grow again with zeros
+	CHECK(a1fs_ops.truncate("/file", 10000) == 0);
+	CHECK(a1fs_ops.truncate("/file", 20000) == 0);
+	memset(data + 10000, 0, 10000);
+	CHECK(file_equals("/file", data, 20000));
+
+	CHECK(a1fs_ops.unlink("/file") == 0);
+	CHECK(a1fs_ops.getattr("/file", &st) == -ENOENT);
+	CHECK(free_blocks() == bfree);
+}
+
+/**
+ * Directories: add, look up and remove entries across leaf splits, so that
+ * a directory with dir_index is indexed and one without it spans several
+ * blocks.
+ */
+static void test_dirs(void)
+{
+	enum { N = 600 };
+	a1fs_superblock *sb = fs.image;
+	char path[64];
+	struct stat st;
+
+	CHECK(a1fs_ops.mkdir("/dir", 0755) == 0);
+	for (int i = 0; i < N; i++) {
+		snprintf(path, sizeof(path), "/dir/entry_%04d_with_a_longer_name", i);
+		CHECK(a1fs_ops.create(path, S_IFREG | 0644, &fi) == 0);
+	}
+	CHECK(a1fs_ops.mkdir("/dir/sub", 0755) == 0);
+
+	a1fs_inode *dir = path_inode("/dir");
+	CHECK(dir != NULL);
+	if (dir == NULL) return;
+	if (sb->s_features & A1FS_FEATURE_DIR_INDEX) {
+		CHECK(dir->flags & A1FS_INODE_DIR_INDEX);
+	}
+	uint64_t nblocks = inode_nblocks(dir);
+	CHECK(nblocks >= 3);
+	CHECK(dir->entry_count == N + 1);
+	CHECK(a1fs_ops.getattr("/dir", &st) == 0);
+	CHECK((uint64_t)st.st_size == nblocks * A1FS_BLOCK_SIZE);
+	CHECK(st.st_nlink == 3);
+	CHECK(count_entries("/dir") == N + 3);
+
+	for (int i = 0; i < N; i++) {
+		snprintf(path, sizeof(path), "/dir/entry_%04d_with_a_longer_name", i);
+		CHECK((a1fs_ops.getattr(path, &st) == 0) && S_ISREG(st.st_mode));
+	}
+	CHECK(a1fs_ops.getattr("/dir/entry_with_no_number", &st) == -ENOENT);
+	CHECK(a1fs_ops.rmdir("/dir") == -ENOTEMPTY);
+
+	// Remove every other entry, then add them back into the freed space
+	for (int i = 0; i < N; i += 2) {
+		snprintf(path, sizeof(path), "/dir/entry_%04d_with_a_longer_name", i);
+		CHECK(a1fs_ops.unlink(path) == 0);
+	}
+	for (int i = 0; i < N; i++) {
+		snprintf(path, sizeof(path), "/dir/entry_%04d_with_a_longer_name", i);
+		CHECK(a1fs_ops.getattr(path, &st) == ((i % 2) ? 0 : -ENOENT));
+	}
+	CHECK(dir->entry_count == N / 2 + 1);
+	CHECK(count_entries("/dir") == N / 2 + 3);
+	for (int i = 0; i < N; i += 2) {
+		snprintf(path, sizeof(path), "/dir/entry_%04d_with_a_longer_name", i);
+		CHECK(a1fs_ops.create(path, S_IFREG | 0644, &fi) == 0);
+	}
+	CHECK(inode_nblocks(dir) == nblocks);
+	CHECK(count_entries("/dir") == N + 3);
+
+	for (int i = 0; i < N; i++) {
+		snprintf(path, sizeof(path), "/dir/entry_%04d_with_a_longer_name", i);
+		CHECK(a1fs_ops.unlink(path) == 0);
+	}
+	CHECK(a1fs_ops.rmdir("/dir/sub") == 0);
+	CHECK(dir->entry_count == 0);
+	CHECK(count_entries("/dir") == 2);
+	CHECK(a1fs_ops.rmdir("/dir") == 0);
+	CHECK(a1fs_ops.getattr("/dir", &st) == -ENOENT);
+}
+
+/** Rename: moves, replacing an existing target, and the error cases. */
+static void test_rename(void)
+{
+	fsblkcnt_t bfree = free_blocks();
+	fsfilcnt_t ffree = free_inodes();
+	struct stat st;
+
+	CHECK(a1fs_ops.mkdir("/a", 0755) == 0);
+	CHECK(a1fs_ops.mkdir("/b", 0755) == 0);
+	CHECK(a1fs_ops.create("/a/one", S_IFREG | 0644, &fi) == 0);
+	CHECK(write_and_flush("/a/one", "one", 3, 0));
+	CHECK(a1fs_ops.create("/b/two", S_IFREG | 0644, &fi) == 0);
+	CHECK(write_and_flush("/b/two", "twotwo", 6, 0));
+
+	// Replacing a file in another directory
+	CHECK(a1fs_ops.rename("/a/one", "/b/two") == 0);
+	CHECK(a1fs_ops.getattr("/a/one", &st) == -ENOENT);
+	CHECK((a1fs_ops.getattr("/b/two", &st) == 0) && (st.st_size == 3));
+	CHECK(file_equals("/b/two", "one", 3));
+	CHECK(count_entries("/b") == 3);
+	CHECK(a1fs_ops.rename("/b/two", "/b/two") == 0);
+
+	CHECK(a1fs_ops.mkdir("/a/empty", 0755) == 0);
+	CHECK(a1fs_ops.mkdir("/b/full", 0755) == 0);
+	CHECK(a1fs_ops.create("/b/full/x", S_IFREG | 0644, &fi) == 0);
+	CHECK(a1fs_ops.rename("/b/two", "/a/empty") == -EISDIR);
+	CHECK(a1fs_ops.rename("/a/empty", "/b/two") == -ENOTDIR);
+	CHECK(a1fs_ops.rename("/a/empty", "/b/full") == -ENOTEMPTY);
+	CHECK(a1fs_ops.rename("/a", "/a/empty/a") == -EINVAL);
+	CHECK(a1fs_ops.rename("/a/none", "/b/none") == -ENOENT);
+
+	// Replacing an empty directory moves the link count of the parent
+	CHECK(a1fs_ops.unlink("/b/full/x") == 0);
+	CHECK(a1fs_ops.rename("/a/empty", "/b/full") == 0);
+	CHECK((a1fs_ops.getattr("/a", &st) == 0) && (st.st_nlink == 2));
+	CHECK((a1fs_ops.getattr("/b", &st) == 0) && (st.st_nlink == 3));
+	CHECK(a1fs_ops.create("/b/full/y", S_IFREG | 0644, &fi) == 0);
+
+	// Moving a directory moves what is below it
+	CHECK(a1fs_ops.rename("/b", "/a/b") == 0);
+	CHECK(a1fs_ops.getattr("/b/full/y", &st) == -ENOENT);
+	CHECK(a1fs_ops.getattr("/a/b/full/y", &st) == 0);
+	CHECK(file_equals("/a/b/two", "one", 3));
+
+	CHECK(a1fs_ops.unlink("/a/b/full/y") == 0);
+	CHECK(a1fs_ops.rmdir("/a/b/full") == 0);
+	CHECK(a1fs_ops.unlink("/a/b/two") == 0);
+	CHECK(a1fs_ops.rmdir("/a/b") == 0);
+	CHECK(a1fs_ops.rmdir("/a") == 0);
+	CHECK(free_blocks() == bfree);
+	CHECK(free_inodes() == ffree);
+}
+
+/**
+ * Directories of images made before A1FS_FEATURE_DIR_SIZE get their size and
+ * entry count converted at mount time.
+ */
+static void test_dir_size_conversion(void)
+{
+	a1fs_superblock *sb = fs.image;
+	struct stat st;
+
+	// Only the features older than A1FS_FEATURE_DIR_SIZE can be faked away
+	if (sb->s_features & ~(A1FS_FEATURE_DIR_INDEX | A1FS_FEATURE_COMPACT_DIRENT | A1FS_FEATURE_DIR_SIZE)) {
+		return;
+	}
+	CHECK(a1fs_ops.mkdir("/old", 0755) == 0);
+	CHECK(a1fs_ops.create("/old/a", S_IFREG | 0644, &fi) == 0);
+	CHECK(a1fs_ops.mkdir("/old/b", 0755) == 0);
+	a1fs_inode *dir = path_inode("/old");
+	uint64_t nblocks = inode_nblocks(dir);
+
+	// The old format: 256 bytes of size per entry, 16 entries per block
+	dir->size = 2 * sizeof(a1fs_dentry);
+	dir->entry_count = nblocks * (A1FS_BLOCK_SIZE / sizeof(a1fs_dentry));
+	sb->s_features &= ~A1FS_FEATURE_DIR_SIZE;
+	a1fs_destroy(&fs);
+	CHECK(mount_image());
+
+	sb = fs.image;
+	CHECK(sb->s_features & A1FS_FEATURE_DIR_SIZE);
+	dir = path_inode("/old");
+	CHECK(dir->entry_count == 2);
+	CHECK((a1fs_ops.getattr("/old", &st) == 0) && ((uint64_t)st.st_size == nblocks * A1FS_BLOCK_SIZE));
+	CHECK(a1fs_ops.rmdir("/old") == -ENOTEMPTY);
+	CHECK(a1fs_ops.unlink("/old/a") == 0);
+	CHECK(a1fs_ops.rmdir("/old/b") == 0);
+	CHECK(a1fs_ops.rmdir("/old") == 0);
+}
+
+/** fallocate() and the A1FS_IOC_SEEK_DATA and A1FS_IOC_SEEK_HOLE ioctls. */
+static void test_fallocate_seek(void)
+{
+	const int64_t size = 1 << 20;
+	fsblkcnt_t bfree = free_blocks();
+	struct stat st;
+
+	CHECK(a1fs_ops.create("/falloc", S_IFREG | 0644, &fi) == 0);
+	CHECK(a1fs_ops.fallocate("/falloc", FALLOC_FL_KEEP_SIZE, 0, 4096, &fi) == -EOPNOTSUPP);
+	CHECK(a1fs_ops.fallocate("/falloc", 0, 0, 0, &fi) == -EINVAL);
+
+	// Preallocated blocks read as zeros and are holes until written; there are
+	// enough of them that a write splits the extent rather than zeroing it all
+	const int64_t prealloc = 4 * UNWRITTEN_ZEROOUT_BLOCKS * A1FS_BLOCK_SIZE;
+	CHECK(a1fs_ops.fallocate("/falloc", 0, 0, prealloc, &fi) == 0);
+	CHECK(a1fs_ops.getattr("/falloc", &st) == 0);
+	CHECK((st.st_size == prealloc) && (st.st_blocks == prealloc / 512));
+	CHECK(bfree - free_blocks() >= (fsblkcnt_t)(prealloc / A1FS_BLOCK_SIZE));
+	memset(data, 0, prealloc);
+	CHECK(file_equals("/falloc", data, prealloc));
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_DATA, 0) == -ENXIO);
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_HOLE, 0) == 0);
+
+	// Writing into them uses no more space
+	fsblkcnt_t used = free_blocks();
+	CHECK(write_and_flush("/falloc", "data", 4, 2 * A1FS_BLOCK_SIZE + 10));
+	memcpy(data + 2 * A1FS_BLOCK_SIZE + 10, "data", 4);
+	CHECK(file_equals("/falloc", data, prealloc));
+	CHECK(free_blocks() == used);
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_DATA, 0) == 2 * A1FS_BLOCK_SIZE);
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_HOLE, 2 * A1FS_BLOCK_SIZE) == 3 * A1FS_BLOCK_SIZE);
+
+	// Sparse data past the preallocated blocks
+	CHECK(a1fs_ops.truncate("/falloc", size) == 0);
+	CHECK(write_and_flush("/falloc", "more", 4, size / 2 + 100));
+	int64_t block = (size / 2 + 100) / A1FS_BLOCK_SIZE * A1FS_BLOCK_SIZE;
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_DATA, 3 * A1FS_BLOCK_SIZE) == block);
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_HOLE, block) == block + A1FS_BLOCK_SIZE);
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_DATA, block + A1FS_BLOCK_SIZE) == -ENXIO);
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_HOLE, size - 1) == size - 1);
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_HOLE, size) == -ENXIO);
+	CHECK(seek("/falloc", A1FS_IOC_SEEK_DATA, -1) == -ENXIO);
+
+	// Filling the holes allocates them; running out of space changes nothing
+	CHECK(a1fs_ops.fallocate("/falloc", 0, 0, size, &fi) == 0);
+	CHECK((a1fs_ops.getattr("/falloc", &st) == 0) && (st.st_blocks == size / 512));
+	used = free_blocks();
+	CHECK(a1fs_ops.fallocate("/falloc", 0, size, (int64_t)(used + 1) * A1FS_BLOCK_SIZE, &fi) == -ENOSPC);
+	CHECK((a1fs_ops.getattr("/falloc", &st) == 0) && (st.st_size == size));
+	CHECK(free_blocks() == used);
+	memset(buf, 0xAA, 8);
+	CHECK((a1fs_ops.read("/falloc", (char*)buf, 8, size / 2 + 98, &fi) == 8) &&
+	      (memcmp(buf, "\0\0more\0\0", 8) == 0));
+
+	CHECK(a1fs_ops.unlink("/falloc") == 0);
+	CHECK(free_blocks() == bfree);
+}
+
+// Where the data of a file of the given size is expected to be
+static unsigned int expected_placement(size_t size)
+{
+	if ((fs.inline_data > 0) && (size <= fs.inline_data)) return A1FS_INODE_INLINE_DATA;
+	if ((size > 0) && (size <= fs.frag_max)) return A1FS_INODE_FRAGMENT;
+	return 0;
+}
+
+static unsigned int placement(const char *path)
+{
+	return path_inode(path)->flags & (A1FS_INODE_INLINE_DATA | A1FS_INODE_FRAGMENT);
+}
+
+/**
+ * Small files: data moves from the inode (inline_data) to a fragment
+ * (tail_packing) to blocks as a file grows, and back to a fragment after it
+ * is truncated.
+ */
+static void test_small_files(void)
+{
+	const size_t sizes[] = { 40, 100, 1000, 2000, 10000 };
+	fsblkcnt_t bfree = free_blocks();
+
+	for (size_t i = 0; i < 10000; i++) data[i] = rand();
+	CHECK(a1fs_ops.create("/small", S_IFREG | 0644, &fi) == 0);
+	CHECK(placement("/small") == expected_placement(0));
+
+	size_t size = 0;
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		CHECK(write_and_flush("/small", data + size, sizes[i] - size, size));
+		size = sizes[i];
+		CHECK(placement("/small") == expected_placement(size));
+		CHECK(file_equals("/small", data, size));
+	}
+
+	CHECK(a1fs_ops.truncate("/small", 0) == 0);
+	CHECK(write_and_flush("/small", data, 1000, 0));
+	CHECK(placement("/small") == expected_placement(1000));
+	CHECK(file_equals("/small", data, 1000));
+
+	CHECK(a1fs_ops.unlink("/small") == 0);
+	CHECK(free_blocks() == bfree);
+	CHECK(fs.frags.count == 0);
+}
+
+/**
+ * Remount: the fragment blocks, the group free counts and extent indexes are
+ * rebuilt from the image, and inodes unlinked but not released before an
+ * unclean unmount are released at the next mount.
+ */
+static void test_remount(void)
+{
+	enum { N = 100 };
+	char path[32];
+
+	for (size_t i = 0; i < sizeof(data); i++) data[i] = rand();
+	for (int i = 0; i < N; i++) {
+		snprintf(path, sizeof(path), "/r%d", i);
+		CHECK(a1fs_ops.create(path, S_IFREG | 0644, &fi) == 0);
+		CHECK(write_and_flush(path, data + i, 100 + i * 97, 0));
+	}
+	// Leave holes in the fragment blocks and in the groups
+	for (int i = 0; i < N; i += 3) {
+		snprintf(path, sizeof(path), "/r%d", i);
+		CHECK(a1fs_ops.unlink(path) == 0);
+	}
+	CHECK(reap_inodes(&fs));
+	check_groups();
+
+	fsblkcnt_t bfree = free_blocks();
+	fsfilcnt_t ffree = free_inodes();
+	uint32_t nfrags = fs.frags.count;
+	CHECK((fs.frag_max == 0) || (nfrags > 0));
+	a1fs_blk_t *frags = malloc((nfrags + 1) * sizeof(a1fs_blk_t));
+	CHECK(frags != NULL);
+	if (frags == NULL) return;
+	if (nfrags > 0) memcpy(frags, fs.frags.blocks, nfrags * sizeof(a1fs_blk_t));
+
+	a1fs_destroy(&fs);
+	CHECK(mount_image());
+	CHECK(fs.frags.count == nfrags);
+	if ((nfrags > 0) && (fs.frags.count == nfrags)) {
+		CHECK(memcmp(fs.frags.blocks, frags, nfrags * sizeof(a1fs_blk_t)) == 0);
+	}
+	free(frags);
+	check_groups();
+	CHECK(free_blocks() == bfree);
+	CHECK(free_inodes() == ffree);
+	for (int i = 0; i < N; i++) {
+		snprintf(path, sizeof(path), "/r%d", i);
+		if (i % 3 == 0) {
+			struct stat st;
+			CHECK(a1fs_ops.getattr(path, &st) == -ENOENT);
+		} else {
+			CHECK(file_equals(path, data + i, 100 + i * 97));
+		}
+	}
+
+	// Unmount without releasing an unlinked inode, as after a crash
+	a1fs_superblock *sb = fs.image;
+	uint32_t sb_ffree = sb->s_free_inodes_count;
+	CHECK(a1fs_ops.unlink("/r1") == 0);
+	CHECK(fs.dead_count == 1);
+	flush_all_delalloc(&fs);
+	munmap(fs.image, fs.size);
+	fs_ctx_destroy(&fs);
+	CHECK(mount_image());
+	sb = fs.image;
+	CHECK(fs.dead_count == 1);
+	CHECK(free_inodes() == ffree + 1);
+	CHECK(reap_inodes(&fs));
+	CHECK(sb->s_free_inodes_count == sb_ffree + 1);
+	check_groups();
+
+	for (int i = 2; i < N; i++) {
+		if (i % 3 == 0) continue;
+		snprintf(path, sizeof(path), "/r%d", i);
+		CHECK(a1fs_ops.unlink(path) == 0);
+	}
+	CHECK(fs.frags.count == 0);
+}
+
+// Check that the free extent index of every group is valid
+static bool indexes_valid(void)
+{
+	for (uint32_t g = 0; g < fs.groups.count; g++) {
+		if (!fs.groups.groups[g].free_blocks.valid) return false;
+	}
+	return true;
+}
+
+/**
+ * Reservation windows: allocations and other windows near a block of an open
+ * window go elsewhere, and leave the free extent indexes valid.
+ */
+static void test_windows(void)
+{
+	fsblkcnt_t bfree = free_blocks();
+	uint32_t gen, other_gen;
+
+	uint32_t len = 16;
+	long start = group_window_open(&fs.groups, 0, &len, 1, &gen);
+	CHECK(start >= 0);
+	if (start < 0) return;
+
+	uint32_t n = 4;
+	long bit = group_alloc_near(&fs.groups, start, &n, true);
+	CHECK((bit >= 0) && ((bit + n <= start) || (bit >= start + len)));
+	CHECK(indexes_valid());
+	if (bit >= 0) group_free_blocks(&fs.groups, bit, n);
+
+	n = 4;
+	long other = group_window_open(&fs.groups, start + 1, &n, 1, &other_gen);
+	CHECK((other >= 0) && ((other + n <= start) || (other >= start + len)));
+	CHECK(indexes_valid());
+	if (other >= 0) group_window_close(&fs.groups, other, n, other_gen);
+
+	group_window_close(&fs.groups, start, len, gen);
+	check_groups();
+	CHECK(free_blocks() == bfree);
+}
+
+enum { THREADS = 4, ROUNDS = 200 };
+
+// Write files in a directory of its own and move each to the same name in a
+// shared directory, replacing the one moved there before
+static void *churn_files(void *arg)
+{
+	int id = (int)(intptr_t)arg;
+	char path[32], shared[32], out[32], in[sizeof(out)];
+
+	snprintf(shared, sizeof(shared), "/shared/t%d", id);
+	for (int i = 0; i < ROUNDS; i++) {
+		snprintf(path, sizeof(path), "/t%d/f%d", id, i % 8);
+		int len = snprintf(out, sizeof(out), "thread %d round %d", id, i);
+		CHECK(a1fs_ops.create(path, S_IFREG | 0644, &fi) == 0);
+		CHECK(a1fs_ops.write(path, out, len, 0, &fi) == len);
+		CHECK(a1fs_ops.flush(path, &fi) == 0);
+		CHECK(a1fs_ops.rename(path, shared) == 0);
+		CHECK(a1fs_ops.read(shared, in, sizeof(in), 0, &fi) == len);
+		CHECK(memcmp(in, out, len) == 0);
+	}
+	CHECK(a1fs_ops.unlink(shared) == 0);
+	return NULL;
+}
+
+// Move a directory in and out of the shared directory while it is in use
+static void *churn_dirs(void *arg)
+{
+	(void)arg;
+	struct stat st;
+	for (int i = 0; i < ROUNDS; i++) {
+		CHECK(a1fs_ops.rename("/moving", "/shared/moving") == 0);
+		CHECK(a1fs_ops.getattr("/shared/moving/file", &st) == 0);
+		CHECK(a1fs_ops.rename("/shared/moving", "/moving") == 0);
+		CHECK(count_entries("/shared") >= 2);
+	}
+	return NULL;
+}
+
+/**
+ * Threads: creates, renames and unlinks in different directories run
+ * concurrently, and leave the file system as they found it.
+ */
+static void test_threads(void)
+{
+	fsblkcnt_t bfree = free_blocks();
+	fsfilcnt_t ffree = free_inodes();
+	pthread_t threads[THREADS + 1];
+	char path[32];
+
+	CHECK(a1fs_ops.mkdir("/shared", 0755) == 0);
+	CHECK(a1fs_ops.mkdir("/moving", 0755) == 0);
+	CHECK(a1fs_ops.create("/moving/file", S_IFREG | 0644, &fi) == 0);
+	for (int i = 0; i < THREADS; i++) {
+		snprintf(path, sizeof(path), "/t%d", i);
+		CHECK(a1fs_ops.mkdir(path, 0755) == 0);
+		CHECK(pthread_create(&threads[i], NULL, churn_files, (void *)(intptr_t)i) == 0);
+	}
+	CHECK(pthread_create(&threads[THREADS], NULL, churn_dirs, NULL) == 0);
+	for (int i = 0; i <= THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	CHECK(count_entries("/shared") == 2);
+	for (int i = 0; i < THREADS; i++) {
+		snprintf(path, sizeof(path), "/t%d", i);
+		CHECK(a1fs_ops.rmdir(path) == 0);
+	}
+	CHECK(a1fs_ops.unlink("/moving/file") == 0);
+	CHECK(a1fs_ops.rmdir("/moving") == 0);
+	CHECK(a1fs_ops.rmdir("/shared") == 0);
+	reap_inodes(&fs);
+	check_groups();
+	CHECK(free_blocks() == bfree);
+	CHECK(free_inodes() == ffree);
+}
+
+/** Extended attributes: only the allocation hints can be set. */
+static void test_xattrs(void)
+{
+	char value[32];
+
+	CHECK(a1fs_ops.create("/hints", S_IFREG | 0644, &fi) == 0);
+	CHECK(a1fs_ops.setxattr("/hints", "user.other", "1", 1, 0) == -ENOTSUP);
+	CHECK(a1fs_ops.setxattr("/hints", A1FS_XATTR_SIZE "x", "1", 1, 0) == -ENOTSUP);
+	CHECK(a1fs_ops.setxattr("/hints", A1FS_XATTR_SIZE "x", "junk", 4, 0) == -ENOTSUP);
+	CHECK(a1fs_ops.setxattr("/hints", A1FS_XATTR_SIZE, "8192", 4, 0) == 0);
+	int len = a1fs_ops.getxattr("/hints", A1FS_XATTR_SIZE, value, sizeof(value));
+	CHECK((len == 4) && (memcmp(value, "8192", 4) == 0));
+	CHECK(a1fs_ops.getxattr("/hints", "user.other", value, sizeof(value)) == -ENODATA);
+	CHECK(a1fs_ops.unlink("/hints") == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s image\n", argv[0]);
+		return 2;
+	}
+	opts.img_path = argv[1];
+	if (!mount_image()) {
+		fprintf(stderr, "Failed to mount the file system\n");
+		return 1;
+	}
+	srand(369);
+
+	test_files();
+	test_dirs();
+	test_rename();
+	test_dir_size_conversion();
+	test_fallocate_seek();
+	test_small_files();
+	test_remount();
+	test_windows();
+	test_threads();
+	test_xattrs();
+	check_groups();
+
+	a1fs_destroy(&fs);
+	if (failures > 0) {
+		fprintf(stderr, "%s: %d checks failed\n", opts.img_path, failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Bitmap search engine implementation.
+ */
+
+#include <stddef.h>
+
+#include "bitmap.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BITMAP_HAVE_AVX2 1
+#endif
+
+
+// Get the 64-bit word that holds bit i
+static inline uint64_t word64(const uint32_t *bm, uint32_t i)
+{
+	return ((const uint64_t *)bm)[i / 64];
+}
+
+// Mask of bits [lo, hi) within a 64-bit word, 0 <= lo < hi <= 64
+static inline uint64_t mask64(uint32_t lo, uint32_t hi)
+{
+	uint64_t m = (hi == 64) ? ~0ul : ((1ul << hi) - 1);
+	return m & ~((1ul << lo) - 1);
+}
+
+// Apply a set/clear to bits [start, start + len) one 64-bit word at a time
+static void update_range(uint32_t *bm, uint32_t start, uint32_t len, bool set)
+{
+	uint64_t *words = (uint64_t *)bm;
+	uint32_t end = start + len;
+	while (start < end) {
+		uint32_t lo = start % 64;
+		uint32_t hi = (end - start + lo < 64) ? end - start + lo : 64;
+		uint64_t m = mask64(lo, hi);
+		if (set) {
+			words[start / 64] |= m;
+		} else {
+			words[start / 64] &= ~m;
+		}
+		start += hi - lo;
+	}
+}
+
+void bitmap_set_range(uint32_t *bm, uint32_t start, uint32_t len)
+{
+	update_range(bm, start, len, true);
+}
+
+void bitmap_clear_range(uint32_t *bm, uint32_t start, uint32_t len)
+{
+	update_range(bm, start, len, false);
+}
+
+
+#ifdef BITMAP_HAVE_AVX2
+
+// Skip whole 256-bit chunks, starting at 64-bit word w, whose bits all equal
+// "ones"; return the index of the first word in a chunk that differs
+__attribute__((target("avx2")))
+static size_t skip_chunks_avx2(const uint64_t *words, size_t w, size_t nwords,
+                               bool ones)
+{
+	const __m256i all = _mm256_set1_epi64x(-1);
+	for (; w + 4 <= nwords; w += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(words + w));
+		int uniform = ones ? _mm256_testc_si256(v, all) : _mm256_testz_si256(v, v);
+		if (!uniform) break;
+	}
+	return w;
+}
+
+static bool have_avx2(void)
+{
+	static int cached = -1;
+	if (cached < 0) cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+	return cached;
+}
+
+#endif
+
+// Find the first bit in [from, limit) that differs from "value"; limit if none
+static uint32_t next_bit(const uint32_t *bm, uint32_t from, uint32_t limit,
+                         bool value)
+{
+	if (from >= limit) return limit;
+	const uint64_t *words = (const uint64_t *)bm;
+	const uint64_t flip = value ? ~0ul : 0;
+
+	// Partial first word
+	size_t w = from / 64;
+	uint64_t bits = (words[w] ^ flip) & mask64(from % 64, 64);
+	size_t nwords = ((size_t)limit + 63) / 64;
+	while (bits == 0) {
+		if (++w >= nwords) return limit;
+#ifdef BITMAP_HAVE_AVX2
+		if (have_avx2() && (w % 4 == 0)) {
+			w = skip_chunks_avx2(words, w, nwords, value);
+			if (w >= nwords) return limit;
+		}
+#endif
+		bits = words[w] ^ flip;
+	}
+	uint32_t bit = w * 64 + __builtin_ctzll(bits);
+	return (bit < limit) ? bit : limit;
+}
+
+long bitmap_next_clear(const uint32_t *bm, uint32_t from, uint32_t limit)
+{
+	uint32_t bit = next_bit(bm, from, limit, true);
+	return (bit < limit) ? (long)bit : -1;
+}
+
+uint32_t bitmap_next_set(const uint32_t *bm, uint32_t from, uint32_t limit)
+{
+	return next_bit(bm, from, limit, false);
+}
+
+long bitmap_find_clear_run(const uint32_t *bm, uint32_t from, uint32_t limit,
+                           uint32_t len)
+{
+	if (len == 0) len = 1;
+	while (from < limit && limit - from >= len) {
+		long start = bitmap_next_clear(bm, from, limit);
+		if ((start < 0) || (limit - start < len)) return -1;
+		// Only need to look as far as the end of a long enough run
+		uint32_t end = bitmap_next_set(bm, start, start + len);
+		if (end - start >= len) return start;
+		from = end;
+	}
+	return -1;
+}
+
+uint32_t bitmap_longest_clear_run(const uint32_t *bm, uint32_t limit,
+                                  uint32_t *start)
+{
+	uint32_t longest = 0, longest_start = 0;
+	uint32_t from = 0;
+	while (from < limit) {
+		long run = bitmap_next_clear(bm, from, limit);
+		if (run < 0) break;
+		// A longer run cannot fit in what is left
+		if (limit - run <= longest) break;
+		uint32_t end = bitmap_next_set(bm, run, limit);
+		if (end - run > longest) {
+			longest = end - run;
+			longest_start = run;
+		}
+		from = end;
+	}
+	if (start != NULL) *start = longest_start;
+	return longest;
+}
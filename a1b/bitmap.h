@@ -0,0 +1,87 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Bitmap search engine header file.
+ *
+ * Bitmaps are arrays of uint32_t words; bit i is bit (i % 32) of word i / 32,
+ * and a set bit marks an allocated block or inode. Searches look at 64 bits
+ * at a time, skip words that are entirely full (or empty) and locate runs with
+ * count-trailing-zeros; on x86-64 CPUs with AVX2 they skip 256 bits at a time.
+ *
+ * Bitmaps must be 8-byte aligned and the word order must be little-endian, so
+ * that each pair of uint32_t words can be read as one uint64_t.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Check if bit i is set. */
+static inline bool bitmap_test(const uint32_t *bm, uint32_t i)
+{
+	return (bm[i / 32] & (1u << (i % 32))) != 0;
+}
+
+/** Set bit i. */
+static inline void bitmap_set(uint32_t *bm, uint32_t i)
+{
+	bm[i / 32] |= 1u << (i % 32);
+}
+
+/** Clear bit i. */
+static inline void bitmap_clear(uint32_t *bm, uint32_t i)
+{
+	bm[i / 32] &= ~(1u << (i % 32));
+}
+
+/** Set bits [start, start + len). */
+void bitmap_set_range(uint32_t *bm, uint32_t start, uint32_t len);
+
+/** Clear bits [start, start + len). */
+void bitmap_clear_range(uint32_t *bm, uint32_t start, uint32_t len);
+
+/**
+ * Find the first clear bit in [from, limit).
+ *
+ * @return  index of the bit; -1 if all bits in the range are set.
+ */
+long bitmap_next_clear(const uint32_t *bm, uint32_t from, uint32_t limit);
+
+/**
+ * Find the first set bit in [from, limit).
+ *
+ * @return  index of the bit; limit if all bits in the range are clear.
+ */
+uint32_t bitmap_next_set(const uint32_t *bm, uint32_t from, uint32_t limit);
+
+/**
+ * Find the first run of len clear bits within [from, limit).
+ *
+ * @return  index of the first bit of the run; -1 if there is no such run.
+ */
+long bitmap_find_clear_run(const uint32_t *bm, uint32_t from, uint32_t limit,
+                           uint32_t len);
+
+/**
+ * Find the longest run of clear bits within [0, limit).
+ *
+ * @param start  pointer to the variable that receives the index of the first
+ *               bit of the run; may be NULL.
+ * @return       length of the run; 0 if all bits are set.
+ */
+uint32_t bitmap_longest_clear_run(const uint32_t *bm, uint32_t limit,
+                                  uint32_t *start);
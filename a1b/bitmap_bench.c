@@ -0,0 +1,131 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Bitmap search microbenchmark.
+ *
+ * Measures the scan throughput of the bitmap search engine against the
+ * original bit-at-a-time search over a mostly allocated bitmap, the worst case
+ * for the block allocator on a nearly full file system.
+ *
+ * Usage: bitmap_bench [size in MiB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitmap.h"
+
+
+// The original bit-at-a-time search for a run of len clear bits
+static long naive_find_clear_run(const uint32_t *bm, uint32_t limit, uint32_t len)
+{
+	for (uint32_t bit = 0; bit < limit; bit++) {
+		if (!bitmap_test(bm, bit)) {
+			bool all_clear = true;
+			for (uint32_t i = 0; i < len && bit + i < limit; i++) {
+				if (bitmap_test(bm, bit + i)) {
+					all_clear = false;
+					break;
+				}
+			}
+			if (all_clear) return bit;
+		}
+		if (limit - bit < len) return -1;
+	}
+	return -1;
+}
+
+// The original bit-at-a-time longest free run computation
+static uint32_t naive_longest_clear_run(const uint32_t *bm, uint32_t limit)
+{
+	uint32_t longest = 0, cur = 0;
+	for (uint32_t bit = 0; bit < limit; bit++) {
+		if (!bitmap_test(bm, bit)) {
+			if (++cur > longest) longest = cur;
+		} else {
+			cur = 0;
+		}
+	}
+	return longest;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Report throughput of scanning nbytes of bitmap iters times in secs seconds
+static void report(const char *name, size_t nbytes, int iters, double secs)
+{
+	printf("%-28s %8.3f GB/s\n", name, (double)nbytes * iters / secs / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t mib = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4;
+	size_t nbytes = mib << 20;
+	uint32_t limit = nbytes * 8;
+	uint32_t *bm = aligned_alloc(64, nbytes);
+	if (bm == NULL) {
+		perror("aligned_alloc");
+		return 1;
+	}
+
+	// Fully allocated except for a few scattered single free bits (which make
+	// the search for a run do some work) and a free run of 64 bits at the end
+	memset(bm, 0xff, nbytes);
+	for (uint32_t i = 4096 + 7; i < limit - 128; i += limit / 16) {
+		bitmap_clear(bm, i);
+	}
+	bitmap_clear_range(bm, limit - 64, 64);
+
+	volatile long sink = 0;
+	int iters = 3;
+	double t;
+
+	t = now();
+	for (int i = 0; i < iters; i++) sink += naive_find_clear_run(bm, limit, 16);
+	report("find run (bit-at-a-time)", nbytes, iters, now() - t);
+
+	iters = 200;
+	t = now();
+	for (int i = 0; i < iters; i++) sink += bitmap_find_clear_run(bm, 0, limit, 16);
+	report("find run (word-at-a-time)", nbytes, iters, now() - t);
+
+	iters = 3;
+	t = now();
+	for (int i = 0; i < iters; i++) sink += naive_longest_clear_run(bm, limit);
+	report("longest run (bit-at-a-time)", nbytes, iters, now() - t);
+
+	iters = 200;
+	t = now();
+	for (int i = 0; i < iters; i++) sink += bitmap_longest_clear_run(bm, limit, NULL);
+	report("longest run (word-at-a-time)", nbytes, iters, now() - t);
+
+	// Sanity check that both implementations agree
+	if (naive_find_clear_run(bm, limit, 16) != bitmap_find_clear_run(bm, 0, limit, 16) ||
+	    naive_longest_clear_run(bm, limit) != bitmap_longest_clear_run(bm, limit, NULL)) {
+		fprintf(stderr, "result mismatch\n");
+		return 1;
+	}
+
+	free(bm);
+	(void)sink;
+	return 0;
+}
@@ -0,0 +1,367 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory entry (dentry) cache implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcache.h"
+#include "util.h"
+
+
+// Approximate memory used by an average entry, used to size the hash table
+#define DCACHE_AVG_ENTRY_SIZE 128
+
+
+/*
+ * Epoch-based reclamation. A removed entry is stamped with the current epoch
+ * of its cache, which is then advanced; it can be freed once every thread in
+ * a lookup entered that lookup in a later epoch, since such lookups started
+ * after the entry was unlinked. Each thread announces the epoch its lookup
+ * started in in a reader slot of its own, on a separate cache line. Every
+ * cache has its own epoch and slots, so the lookups of one cache do not hold
+ * back the reclamation of another.
+ */
+
+// Release a thread's reader slot when the thread exits
+static void reader_release(void *slot)
+{
+	__atomic_store_n(&((dcache_reader *)slot)->used, false, __ATOMIC_RELEASE);
+}
+
+// Get the calling thread's reader slot; NULL if all slots are taken
+static dcache_reader *reader_get(dcache *dc)
+{
+	dcache_reader *slot = pthread_getspecific(dc->reader_key);
+	if (slot != NULL) return slot;
+	for (size_t i = 0; i < DCACHE_READERS; i++) {
+		bool unused = false;
+		if (__atomic_compare_exchange_n(&dc->readers[i].used, &unused, true, false,
+		                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			slot = &dc->readers[i];
+			pthread_setspecific(dc->reader_key, slot);
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+// The announcement, the loads of the hash chain links and their updates are
+// all sequentially consistent: a lookup either sees an entry's removal or is
+// seen by the reclamation that follows it
+static void reader_enter(dcache *dc, dcache_reader *slot)
+{
+	uint64_t epoch = __atomic_load_n(&dc->epoch, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&slot->epoch, epoch, __ATOMIC_SEQ_CST);
+}
+
+static void reader_exit(dcache_reader *slot)
+{
+	__atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// Oldest epoch a running lookup started in; UINT64_MAX if there are none
+static uint64_t oldest_reader(dcache *dc)
+{
+	uint64_t oldest = UINT64_MAX;
+	for (size_t i = 0; i < DCACHE_READERS; i++) {
+		uint64_t epoch = __atomic_load_n(&dc->readers[i].epoch, __ATOMIC_SEQ_CST);
+		if ((epoch != 0) && (epoch < oldest)) oldest = epoch;
+	}
+	return oldest;
+}
+
+
+// FNV-1a hash of (parent, name)
+static uint64_t dcache_hash(a1fs_ino_t parent, const char *name, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ul;
+	for (int i = 0; i < 4; i++) {
+		h = (h ^ ((parent >> (8 * i)) & 0xff)) * 0x100000001b3ul;
+	}
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)name[i]) * 0x100000001b3ul;
+	}
+	return h;
+}
+
+static size_t entry_size(const dcache_entry *e)
+{
+	return sizeof(dcache_entry) + e->len + 1;
+}
+
+static void lru_unlink(dcache_entry *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+}
+
+static void lru_push_front(dcache *dc, dcache_entry *e)
+{
+	e->prev = &dc->lru;
+	e->next = dc->lru.next;
+	dc->lru.next->prev = e;
+	dc->lru.next = e;
+}
+
+// Free the removed entries that no lookup can see anymore
+static void reclaim(dcache *dc)
+{
+	if (dc->retired == NULL) return;
+	uint64_t oldest = oldest_reader(dc);
+	for (dcache_entry **link = &dc->retired; *link != NULL;) {
+		dcache_entry *e = *link;
+		if (e->epoch < oldest) {
+			*link = e->next;
+			free(e);
+		} else {
+			link = &e->next;
+		}
+	}
+}
+
+// Unlink an entry from its bucket and the CLOCK list; it is freed once
+// lookups are done with it
+static void entry_free(dcache *dc, dcache_entry **link)
+{
+	dcache_entry *e = *link;
+	__atomic_store_n(link, e->hnext, __ATOMIC_SEQ_CST);
+	lru_unlink(e);
+	dc->mem -= entry_size(e);
+
+	e->epoch = __atomic_fetch_add(&dc->epoch, 1, __ATOMIC_SEQ_CST);
+	e->next = dc->retired;
+	dc->retired = e;
+}
+
+// Find the entry for (parent, name); NULL if not cached. Safe without the
+// cache lock inside a lookup.
+static dcache_entry *entry_lookup(dcache *dc, uint64_t hash, a1fs_ino_t parent,
+                                  const char *name, size_t len)
+{
+	dcache_entry *e = __atomic_load_n(&dc->buckets[hash & (dc->nbuckets - 1)], __ATOMIC_SEQ_CST);
+	for (; e != NULL; e = __atomic_load_n(&e->hnext, __ATOMIC_SEQ_CST)) {
+		if ((e->hash == hash) && (e->parent == parent) && (e->len == len) &&
+		    (memcmp(e->name, name, len) == 0))
+		{
+			return e;
+		}
+	}
+	return NULL;
+}
+
+// Find the link pointing to the entry for (parent, name); NULL if not cached
+static dcache_entry **entry_find(dcache *dc, uint64_t hash, a1fs_ino_t parent,
+                                 const char *name, size_t len)
+{
+	dcache_entry **link = &dc->buckets[hash & (dc->nbuckets - 1)];
+	for (; *link != NULL; link = &(*link)->hnext) {
+		dcache_entry *e = *link;
+		if ((e->hash == hash) && (e->parent == parent) && (e->len == len) &&
+		    (memcmp(e->name, name, len) == 0))
+		{
+			return link;
+		}
+	}
+	return NULL;
+}
+
+// Evict entries until the cache fits into its budget. Entries used since the
+// last pass are moved back to the front instead, once.
+static void evict(dcache *dc)
+{
+	while ((dc->mem > dc->budget) && (dc->lru.prev != &dc->lru)) {
+		dcache_entry *e = dc->lru.prev;
+		if (__atomic_exchange_n(&e->referenced, false, __ATOMIC_RELAXED)) {
+			lru_unlink(e);
+			lru_push_front(dc, e);
+			continue;
+		}
+		dcache_entry **link = entry_find(dc, e->hash, e->parent, e->name, e->len);
+		assert(link != NULL);
+		entry_free(dc, link);
+	}
+}
+
+
+bool dcache_init(dcache *dc, size_t budget)
+{
+	dc->nbuckets = 64;
+	while (dc->nbuckets * DCACHE_AVG_ENTRY_SIZE < budget) dc->nbuckets *= 2;
+	assert(is_powerof2(dc->nbuckets));
+	dc->buckets = calloc(dc->nbuckets, sizeof(dcache_entry*));
+	dc->lru.prev = dc->lru.next = &dc->lru;
+	dc->retired = NULL;
+	dc->mem = 0;
+	dc->budget = budget;
+	dc->path_gen = 0;
+	memset(dc->readers, 0, sizeof(dc->readers));
+	dc->epoch = 1;
+	if (dc->buckets == NULL) return false;
+	if (pthread_key_create(&dc->reader_key, reader_release) != 0) {
+		free(dc->buckets);
+		dc->buckets = NULL;
+		return false;
+	}
+	dc->path_changes = 0;
+	pthread_mutex_init(&dc->lock, NULL);
+	return true;
+}
+
+void dcache_destroy(dcache *dc)
+{
+	if (dc->buckets == NULL) return;
+	while (dc->lru.next != &dc->lru) {
+		dcache_entry *e = dc->lru.next;
+		lru_unlink(e);
+		free(e);
+	}
+	while (dc->retired != NULL) {
+		dcache_entry *e = dc->retired;
+		dc->retired = e->next;
+		free(e);
+	}
+	free(dc->buckets);
+	dc->buckets = NULL;
+	pthread_key_delete(dc->reader_key);
+	pthread_mutex_destroy(&dc->lock);
+}
+
+bool dcache_lookup(dcache *dc, a1fs_ino_t parent, const char *name, size_t len,
+                   a1fs_ino_t *ino)
+{
+	uint64_t hash = dcache_hash(parent, name, len);
+	dcache_reader *slot = reader_get(dc);
+	if (slot != NULL) {
+		reader_enter(dc, slot);
+	} else {
+		pthread_mutex_lock(&dc->lock);
+	}
+
+	bool found = false;
+	dcache_entry *e = entry_lookup(dc, hash, parent, name, len);
+	// Stale full path entries are dropped when replaced or evicted
+	if ((e != NULL) && ((parent != 0) || (e->gen == __atomic_load_n(&dc->path_gen, __ATOMIC_ACQUIRE)))) {
+		// Avoid dirtying the cache line if the flag is already set
+		if (!__atomic_load_n(&e->referenced, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&e->referenced, true, __ATOMIC_RELAXED);
+		}
+		*ino = e->ino;
+		found = true;
+	}
+
+	if (slot != NULL) {
+		reader_exit(slot);
+	} else {
+		pthread_mutex_unlock(&dc->lock);
+	}
+	return found;
+}
+
+bool dcache_lookup_path(dcache *dc, const char *path, a1fs_ino_t *ino)
+{
+	return dcache_lookup(dc, 0, path, strlen(path), ino);
+}
+
+// Add an entry, replacing any old one. A full path entry is only added if no
+// full path entry was removed or invalidated since the snapshot was taken.
+static void insert(dcache *dc, a1fs_ino_t parent, const char *name, size_t len,
+                   a1fs_ino_t ino, uint64_t snapshot)
+{
+	uint64_t hash = dcache_hash(parent, name, len);
+	dcache_entry *e = malloc(sizeof(dcache_entry) + len + 1);
+	pthread_mutex_lock(&dc->lock);
+	if ((parent == 0) && (dc->path_changes != snapshot)) {
+		free(e);
+		pthread_mutex_unlock(&dc->lock);
+		return;
+	}
+	dcache_entry **link = entry_find(dc, hash, parent, name, len);
+	if (link != NULL) entry_free(dc, link);
+
+	// The cache is only an optimization; just don't cache if out of memory
+	if (e == NULL) {
+		reclaim(dc);
+		pthread_mutex_unlock(&dc->lock);
+		return;
+	}
+	e->hash = hash;
+	e->parent = parent;
+	e->ino = ino;
+	e->gen = dc->path_gen;
+	e->len = len;
+	e->referenced = false;
+	memcpy(e->name, name, len);
+	e->name[len] = '\0';
+
+	// Publish the entry only once it is complete
+	link = &dc->buckets[hash & (dc->nbuckets - 1)];
+	e->hnext = *link;
+	__atomic_store_n(link, e, __ATOMIC_SEQ_CST);
+	lru_push_front(dc, e);
+	dc->mem += entry_size(e);
+	evict(dc);
+	reclaim(dc);
+	pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_insert(dcache *dc, a1fs_ino_t parent, const char *name, size_t len,
+                   a1fs_ino_t ino)
+{
+	insert(dc, parent, name, len, ino, 0);
+}
+
+uint64_t dcache_path_snapshot(dcache *dc)
+{
+	return __atomic_load_n(&dc->path_changes, __ATOMIC_ACQUIRE);
+}
+
+void dcache_insert_path(dcache *dc, const char *path, a1fs_ino_t ino,
+                        uint64_t snapshot)
+{
+	insert(dc, 0, path, strlen(path), ino, snapshot);
+}
+
+void dcache_remove(dcache *dc, a1fs_ino_t parent, const char *name, size_t len)
+{
+	uint64_t hash = dcache_hash(parent, name, len);
+	pthread_mutex_lock(&dc->lock);
+	dcache_entry **link = entry_find(dc, hash, parent, name, len);
+	if (link != NULL) entry_free(dc, link);
+	reclaim(dc);
+	pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_remove_path(dcache *dc, const char *path)
+{
+	uint64_t hash = dcache_hash(0, path, strlen(path));
+	pthread_mutex_lock(&dc->lock);
+	dcache_entry **link = entry_find(dc, hash, 0, path, strlen(path));
+	if (link != NULL) entry_free(dc, link);
+	__atomic_store_n(&dc->path_changes, dc->path_changes + 1, __ATOMIC_RELEASE);
+	reclaim(dc);
+	pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_invalidate_paths(dcache *dc)
+{
+	pthread_mutex_lock(&dc->lock);
+	__atomic_store_n(&dc->path_gen, dc->path_gen + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&dc->path_changes, dc->path_changes + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&dc->lock);
+}
@@ -0,0 +1,186 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory entry (dentry) cache header file.
+ *
+ * The dentry cache maps (parent directory inode, name) pairs and full paths to
+ * inode numbers, so that path resolution does not have to scan directories.
+ * A (parent, name) pair can also be cached as a negative entry with inode
+ * number 0 (which never names a file, see README.txt), recording that the name
+ * does not exist in the directory. Memory use is bounded by a budget; entries
+ * that have not been used recently are evicted (the CLOCK algorithm).
+ *
+ * Lookups do not take the cache lock: they walk the hash chains while entries
+ * are being added and removed, so removed entries are only freed once no
+ * lookup that may still see them is running (epoch-based reclamation, a
+ * simple form of RCU). Updates are serialized by the cache lock.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Default dentry cache memory budget in KiB. */
+#define A1FS_DCACHE_DEFAULT_KB 4096
+
+/**
+ * Maximum number of threads doing lock-free lookups in a cache at the same
+ * time; other threads take the cache lock instead.
+ */
+#define DCACHE_READERS 64
+
+/** A cached name or path. Immutable once added, except as noted. */
+typedef struct dcache_entry {
+	/** Next entry in the hash bucket; updated atomically. */
+	struct dcache_entry *hnext;
+	/**
+	 * Neighbours in the CLOCK list. Once the entry is removed, next links the
+	 * list of removed entries waiting to be freed.
+	 */
+	struct dcache_entry *prev, *next;
+	/** Set by lookups; cleared by eviction, which then spares the entry once. */
+	bool referenced;
+	/** Reclamation epoch the entry was removed in. */
+	uint64_t epoch;
+	/** Hash of (parent, name). */
+	uint64_t hash;
+	/** Parent directory inode number; 0 for a full path entry. */
+	a1fs_ino_t parent;
+	/** Inode number the name resolves to; 0 for a negative entry. */
+	a1fs_ino_t ino;
+	/** Path generation the entry was created in (full path entries only). */
+	uint64_t gen;
+	/** Length of the name, not including the null terminator. */
+	size_t len;
+	/** Name (or full path). A null-terminated string. */
+	char name[];
+} dcache_entry;
+
+/** Reader slot of a thread doing lock-free lookups, on a cache line of its own. */
+typedef struct dcache_reader {
+	/** Epoch the running lookup started in; 0 if not in a lookup. */
+	uint64_t epoch;
+	/** Whether the slot is owned by a thread. */
+	bool used;
+} __attribute__((aligned(64))) dcache_reader;
+
+/** Dentry cache. */
+typedef struct dcache {
+	/** Hash buckets. */
+	dcache_entry **buckets;
+	/** Number of hash buckets, a power of 2. */
+	size_t nbuckets;
+	/** CLOCK list head; newest entries are at head.next. */
+	dcache_entry lru;
+	/** Removed entries that lookups may still be looking at. */
+	dcache_entry *retired;
+	/** Memory used by the entries, in bytes. */
+	size_t mem;
+	/** Memory budget for the entries, in bytes. */
+	size_t budget;
+	/**
+	 * Current path generation. Bumped when an operation (e.g. rename) may
+	 * change what many full paths resolve to; older full path entries are
+	 * then ignored and dropped lazily.
+	 */
+	uint64_t path_gen;
+	/**
+	 * Bumped whenever a full path entry is removed or invalidated, so that a
+	 * path resolved before then is not cached afterwards (see
+	 * dcache_insert_path()).
+	 */
+	uint64_t path_changes;
+	/** Serializes updates; the cache is shared by all FUSE threads. */
+	pthread_mutex_t lock;
+	/** Reader slots of the threads doing lock-free lookups. */
+	dcache_reader readers[DCACHE_READERS];
+	/** Current reclamation epoch; advanced by each removal. */
+	uint64_t epoch;
+	/** Key of the calling thread's reader slot. */
+	pthread_key_t reader_key;
+} dcache;
+
+
+/**
+ * Initialize a dentry cache.
+ *
+ * @param dc      pointer to the cache to initialize.
+ * @param budget  memory budget in bytes.
+ * @return        true on success; false if out of memory.
+ */
+bool dcache_init(dcache *dc, size_t budget);
+
+/** Free all memory owned by the cache. */
+void dcache_destroy(dcache *dc);
+
+/**
+ * Look up a name in a directory. Does not block on concurrent updates.
+ *
+ * @param dc      the cache.
+ * @param parent  parent directory inode number.
+ * @param name    the name; need not be null-terminated.
+ * @param len     length of the name.
+ * @param ino     pointer to the variable that receives the inode number;
+ *                set to 0 if the name is cached as not existing.
+ * @return        true if the name is cached; false otherwise.
+ */
+bool dcache_lookup(dcache *dc, a1fs_ino_t parent, const char *name, size_t len,
+                   a1fs_ino_t *ino);
+
+/**
+ * Look up a full path.
+ *
+ * @param dc    the cache.
+ * @param path  absolute path.
+ * @param ino   pointer to the variable that receives the inode number.
+ * @return      true if the path is cached; false otherwise.
+ */
+bool dcache_lookup_path(dcache *dc, const char *path, a1fs_ino_t *ino);
+
+/**
+ * Cache the inode number of a name in a directory, replacing any old entry.
+ * Passing ino 0 records that the name does not exist in the directory.
+ */
+void dcache_insert(dcache *dc, a1fs_ino_t parent, const char *name, size_t len,
+                   a1fs_ino_t ino);
+
+/**
+ * Get the token to pass to dcache_insert_path(). Taken before a path is
+ * resolved.
+ */
+uint64_t dcache_path_snapshot(dcache *dc);
+
+/**
+ * Cache the inode number of a full path, replacing any old entry. Nothing is
+ * cached if a full path entry was removed or invalidated since the snapshot
+ * was taken, since the path may have been resolved before the change.
+ */
+void dcache_insert_path(dcache *dc, const char *path, a1fs_ino_t ino,
+                        uint64_t snapshot);
+
+/** Drop the cached entry for a name in a directory, if any. */
+void dcache_remove(dcache *dc, a1fs_ino_t parent, const char *name, size_t len);
+
+/** Drop the cached entry for a full path, if any. */
+void dcache_remove_path(dcache *dc, const char *path);
+
+/** Invalidate all cached full paths (e.g. after a directory is renamed). */
+void dcache_invalidate_paths(dcache *dc);
@@ -0,0 +1,125 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Delayed allocation buffers implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "delalloc.h"
+#include "util.h"
+
+
+static delalloc_buf **bucket(delalloc_table *dt, a1fs_ino_t ino)
+{
+	return &dt->buckets[ino & (dt->nbuckets - 1)];
+}
+
+bool delalloc_init(delalloc_table *dt, size_t nbuckets)
+{
+	assert(is_powerof2(nbuckets));
+	dt->buckets = calloc(nbuckets, sizeof(delalloc_buf *));
+	dt->nbuckets = nbuckets;
+	dt->count = 0;
+	dt->flushes = dt->blocks = 0;
+	pthread_mutex_init(&dt->lock, NULL);
+	return dt->buckets != NULL;
+}
+
+void delalloc_destroy(delalloc_table *dt)
+{
+	if (dt->buckets == NULL) return;
+	for (size_t i = 0; i < dt->nbuckets; i++) {
+		while (dt->buckets[i] != NULL) {
+			delalloc_buf *buf = dt->buckets[i];
+			dt->buckets[i] = buf->next;
+			free(buf->data);
+			free(buf);
+		}
+	}
+	free(dt->buckets);
+	dt->buckets = NULL;
+	pthread_mutex_destroy(&dt->lock);
+}
+
+delalloc_buf *delalloc_get(delalloc_table *dt, a1fs_ino_t ino)
+{
+	pthread_mutex_lock(&dt->lock);
+	delalloc_buf *buf = *bucket(dt, ino);
+	while ((buf != NULL) && (buf->ino != ino)) buf = buf->next;
+	pthread_mutex_unlock(&dt->lock);
+	return buf;
+}
+
+delalloc_buf *delalloc_any(delalloc_table *dt)
+{
+	delalloc_buf *buf = NULL;
+	pthread_mutex_lock(&dt->lock);
+	for (size_t i = 0; (dt->count > 0) && (buf == NULL); i++) {
+		buf = dt->buckets[i];
+	}
+	pthread_mutex_unlock(&dt->lock);
+	return buf;
+}
+
+delalloc_buf *delalloc_create(delalloc_table *dt, a1fs_ino_t ino, uint64_t first)
+{
+	delalloc_buf *buf = calloc(1, sizeof(delalloc_buf));
+	if (buf == NULL) return NULL;
+	buf->ino = ino;
+	buf->first = first;
+
+	pthread_mutex_lock(&dt->lock);
+	delalloc_buf **head = bucket(dt, ino);
+	buf->next = *head;
+	*head = buf;
+	dt->count++;
+	pthread_mutex_unlock(&dt->lock);
+	return buf;
+}
+
+bool delalloc_grow(delalloc_buf *buf, uint32_t nblocks)
+{
+	if (nblocks <= buf->nblocks) return true;
+	if (nblocks > buf->capacity) {
+		uint32_t capacity = buf->capacity ? buf->capacity : 8;
+		while (capacity < nblocks) capacity *= 2;
+		char *data = realloc(buf->data, (size_t)capacity * A1FS_BLOCK_SIZE);
+		if (data == NULL) return false;
+		buf->data = data;
+		buf->capacity = capacity;
+	}
+	memset(buf->data + (size_t)buf->nblocks * A1FS_BLOCK_SIZE, 0,
+	       (size_t)(nblocks - buf->nblocks) * A1FS_BLOCK_SIZE);
+	buf->nblocks = nblocks;
+	return true;
+}
+
+void delalloc_drop(delalloc_table *dt, a1fs_ino_t ino)
+{
+	pthread_mutex_lock(&dt->lock);
+	for (delalloc_buf **link = bucket(dt, ino); *link != NULL; link = &(*link)->next) {
+		delalloc_buf *buf = *link;
+		if (buf->ino == ino) {
+			*link = buf->next;
+			dt->count--;
+			free(buf->data);
+			free(buf);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dt->lock);
+}
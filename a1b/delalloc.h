@@ -0,0 +1,112 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Delayed allocation buffers header file.
+ *
+ * Data written past the blocks a file has on disk is kept in a per-inode
+ * buffer instead of being written into newly allocated blocks right away.
+ * Only the free block count is reserved for it; the blocks are allocated, as
+ * one run if possible, when the file is flushed (on close or fsync), when the
+ * buffer grows too large, or before the file is truncated. Streams of small
+ * appends then end up in a few large extents instead of many small ones.
+ *
+ * A buffer holds the file's logical blocks [first, first + nblocks), where
+ * first is the number of blocks the file has on disk. Its contents are
+ * protected by the inode's lock; the table lock only protects the lookup
+ * structure.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Maximum number of blocks buffered for an inode before it is flushed. */
+#define A1FS_DELALLOC_MAX_BLOCKS 1024
+
+/** Buffered blocks of an inode. */
+typedef struct delalloc_buf {
+	/** Next buffer in the hash bucket. */
+	struct delalloc_buf *next;
+	/** Inode number the buffer belongs to. */
+	a1fs_ino_t ino;
+	/** First logical block of the file held in the buffer. */
+	uint64_t first;
+	/** Number of blocks held in the buffer (and reserved). */
+	uint32_t nblocks;
+	/** Number of blocks the data array has room for. */
+	uint32_t capacity;
+	/** Contents of the blocks; unwritten parts are zero. */
+	char *data;
+} delalloc_buf;
+
+/** Delayed allocation buffers of all inodes, indexed by inode number. */
+typedef struct delalloc_table {
+	/** Hash buckets. */
+	delalloc_buf **buckets;
+	/** Number of hash buckets, a power of 2. */
+	size_t nbuckets;
+	/** Number of buffers. */
+	size_t count;
+	/** Protects the buckets and the count. */
+	pthread_mutex_t lock;
+
+	/** Number of buffers written out, and blocks allocated for them. */
+	uint64_t flushes, blocks;
+} delalloc_table;
+
+
+/**
+ * Initialize a delayed allocation table.
+ *
+ * @param dt        pointer to the table to initialize.
+ * @param nbuckets  number of hash buckets, a power of 2.
+ * @return          true on success; false if out of memory.
+ */
+bool delalloc_init(delalloc_table *dt, size_t nbuckets);
+
+/** Free all memory owned by the table, including buffers never flushed. */
+void delalloc_destroy(delalloc_table *dt);
+
+/** Get the buffer of an inode; NULL if it has none. */
+delalloc_buf *delalloc_get(delalloc_table *dt, a1fs_ino_t ino);
+
+/** Get any buffer in the table; NULL if the table is empty. */
+delalloc_buf *delalloc_any(delalloc_table *dt);
+
+/**
+ * Create an empty buffer for an inode that has none.
+ *
+ * @param dt     the table.
+ * @param ino    inode number.
+ * @param first  number of blocks the inode has on disk.
+ * @return       the new buffer; NULL if out of memory.
+ */
+delalloc_buf *delalloc_create(delalloc_table *dt, a1fs_ino_t ino, uint64_t first);
+
+/**
+ * Extend a buffer to hold nblocks blocks; the new blocks are zero.
+ *
+ * @return  true on success; false if out of memory.
+ */
+bool delalloc_grow(delalloc_buf *buf, uint32_t nblocks);
+
+/** Remove the buffer of an inode from the table and free it. */
+void delalloc_drop(delalloc_table *dt, a1fs_ino_t ino);
@@ -0,0 +1,168 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - In-memory extent map cache implementation.
+ */
+
+#include <stdlib.h>
+
+#include "extent_map.h"
+
+
+bool emap_cache_init(extent_map_cache *cache, size_t size)
+{
+	cache->maps = calloc(size, sizeof(extent_map));
+	cache->size = size;
+	if (cache->maps == NULL) return false;
+	for (size_t i = 0; i < size; i++) {
+		pthread_mutex_init(&cache->maps[i].lock, NULL);
+	}
+	return true;
+}
+
+void emap_cache_destroy(extent_map_cache *cache)
+{
+	if (cache->maps == NULL) return;
+	for (size_t i = 0; i < cache->size; i++) {
+		free(cache->maps[i].lblk);
+		free(cache->maps[i].slot);
+		pthread_mutex_destroy(&cache->maps[i].lock);
+	}
+	free(cache->maps);
+	cache->maps = NULL;
+}
+
+// Make sure the map can hold at least n extents
+static bool emap_reserve(extent_map *map, uint32_t n)
+{
+	if (n <= map->capacity) return true;
+	uint32_t capacity = map->capacity ? map->capacity : 8;
+	while (capacity < n) capacity *= 2;
+
+	uint64_t *lblk = realloc(map->lblk, (capacity + 1) * sizeof(uint64_t));
+	if (lblk == NULL) return false;
+	map->lblk = lblk;
+	uint32_t *slot = realloc(map->slot, capacity * sizeof(uint32_t));
+	if (slot == NULL) return false;
+	map->slot = slot;
+	map->capacity = capacity;
+	return true;
+}
+
+// Get the map of an inode from its (locked) cache entry, (re)building it if
+// needed; NULL if out of memory
+static const extent_map *emap_get(extent_map *map, a1fs_ino_t ino,
+                                  a1fs_blk_t extentblock,
+                                  const a1fs_extent *extents, uint32_t nslots)
+{
+	if ((map->ino == ino) && (map->extentblock == extentblock) &&
+	    (map->nslots == nslots))
+	{
+		return map;
+	}
+
+	map->ino = 0;
+	if (!emap_reserve(map, nslots)) return NULL;
+	uint64_t lblk = 0;
+	map->count = 0;
+	for (uint32_t i = 0; i < nslots; i++) {
+		if (a1fs_extent_len(&extents[i]) == 0) continue;
+		map->lblk[map->count] = lblk;
+		map->slot[map->count] = i;
+		map->count++;
+		lblk += a1fs_extent_len(&extents[i]);
+	}
+	map->lblk[map->count] = lblk;
+	map->ino = ino;
+	map->extentblock = extentblock;
+	map->nslots = nslots;
+	return map;
+}
+
+// Find the mapped extent that contains lblk; -1 if lblk is not mapped
+static long emap_find(const extent_map *map, uint64_t lblk)
+{
+	if (lblk >= map->lblk[map->count]) return -1;
+
+	// Find the last extent that starts at or before lblk
+	uint32_t lo = 0, hi = map->count;
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (map->lblk[mid] <= lblk) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+int emap_lookup(extent_map_cache *cache, a1fs_ino_t ino, a1fs_blk_t extentblock,
+                const a1fs_extent *extents, uint32_t nslots, uint64_t lblk,
+                uint32_t *slot, uint64_t *first)
+{
+	extent_map *entry = &cache->maps[ino % cache->size];
+	int ret = -1;
+	pthread_mutex_lock(&entry->lock);
+	const extent_map *map = emap_get(entry, ino, extentblock, extents, nslots);
+	if (map != NULL) {
+		long i = emap_find(map, lblk);
+		ret = (i >= 0);
+		if (i >= 0) {
+			*slot = map->slot[i];
+			*first = map->lblk[i];
+		}
+	}
+	pthread_mutex_unlock(&entry->lock);
+	return ret;
+}
+
+bool emap_nblocks(extent_map_cache *cache, a1fs_ino_t ino, a1fs_blk_t extentblock,
+                  const a1fs_extent *extents, uint32_t nslots, uint64_t *nblocks)
+{
+	extent_map *entry = &cache->maps[ino % cache->size];
+	pthread_mutex_lock(&entry->lock);
+	const extent_map *map = emap_get(entry, ino, extentblock, extents, nslots);
+	if (map != NULL) *nblocks = map->lblk[map->count];
+	pthread_mutex_unlock(&entry->lock);
+	return map != NULL;
+}
+
+void emap_append(extent_map_cache *cache, a1fs_ino_t ino, a1fs_blk_t extentblock,
+                 uint32_t slot, uint32_t blocks)
+{
+	extent_map *map = &cache->maps[ino % cache->size];
+	pthread_mutex_lock(&map->lock);
+	if ((map->ino == ino) && (map->extentblock == extentblock)) {
+		if ((slot != map->nslots) || !emap_reserve(map, map->count + 1)) {
+			map->ino = 0;
+		} else {
+			map->slot[map->count] = slot;
+			map->count++;
+			map->lblk[map->count] = map->lblk[map->count - 1] + blocks;
+			map->nslots = slot + 1;
+		}
+	}
+	pthread_mutex_unlock(&map->lock);
+}
+
+void emap_invalidate(extent_map_cache *cache, a1fs_ino_t ino)
+{
+	extent_map *map = &cache->maps[ino % cache->size];
+	pthread_mutex_lock(&map->lock);
+	if (map->ino == ino) map->ino = 0;
+	pthread_mutex_unlock(&map->lock);
+}
+
@@ -0,0 +1,131 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - In-memory extent map cache header file.
+ *
+ * An extent map records, for each non-empty extent of an inode, the logical
+ * block at which it starts. Locating the extent that holds a given file offset
+ * is then a binary search instead of a walk over the extent table.
+ *
+ * For a file with an extent tree the map covers a single leaf (the one last
+ * looked up), and its logical blocks are relative to the start of the leaf.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Default number of inodes whose extent maps are cached. */
+#define A1FS_EMAP_CACHE_SIZE 1024
+
+/** Logical-to-physical extent map of a single inode. */
+typedef struct extent_map {
+	/** Inode number the map belongs to; 0 if the entry is unused. */
+	a1fs_ino_t ino;
+	/** Extent block (or extent tree leaf) the map was built from. */
+	a1fs_blk_t extentblock;
+	/** Number of extent slots in use when the map was built. */
+	uint32_t nslots;
+	/** Number of mapped (non-empty) extents. */
+	uint32_t count;
+	/** Allocated length of the lblk and slot arrays. */
+	uint32_t capacity;
+	/**
+	 * Logical block at which each mapped extent starts. Holds count + 1
+	 * entries; the last one is the total number of mapped blocks.
+	 */
+	uint64_t *lblk;
+	/** Extent table slot of each mapped extent. */
+	uint32_t *slot;
+	/** Protects the entry; it is shared by all inodes that hash to it. */
+	pthread_mutex_t lock;
+} extent_map;
+
+/** Direct-mapped cache of extent maps, indexed by inode number. */
+typedef struct extent_map_cache {
+	/** Cache entries. */
+	extent_map *maps;
+	/** Number of cache entries. */
+	size_t size;
+} extent_map_cache;
+
+
+/**
+ * Initialize an extent map cache.
+ *
+ * @param cache  pointer to the cache to initialize.
+ * @param size   number of cache entries.
+ * @return       true on success; false if out of memory.
+ */
+bool emap_cache_init(extent_map_cache *cache, size_t size);
+
+/** Free all memory owned by the cache. */
+void emap_cache_destroy(extent_map_cache *cache);
+
+/**
+ * Find the mapped extent that contains a logical block of an inode, building
+ * the inode's map if it is not cached.
+ *
+ * A cached map is rebuilt if the inode's extent block (or leaf) or slot count
+ * no longer matches the one it was built from.
+ *
+ * @param cache        the cache.
+ * @param ino          inode number.
+ * @param extentblock  the inode's extent block (or leaf) number.
+ * @param extents      the inode's extent table (or leaf).
+ * @param nslots       number of extent slots in use.
+ * @param lblk         logical block number within the file.
+ * @param slot         pointer to the variable that receives the extent slot.
+ * @param first        pointer to the variable that receives the logical block
+ *                     at which the extent starts.
+ * @return             1 if lblk is mapped; 0 if it is not; -1 if out of memory.
+ */
+int emap_lookup(extent_map_cache *cache, a1fs_ino_t ino, a1fs_blk_t extentblock,
+                const a1fs_extent *extents, uint32_t nslots, uint64_t lblk,
+                uint32_t *slot, uint64_t *first);
+
+/**
+ * Get the number of blocks mapped by an inode's extents, building the inode's
+ * map if it is not cached.
+ *
+ * @param nblocks  pointer to the variable that receives the result.
+ * @return         true on success; false if out of memory.
+ */
+bool emap_nblocks(extent_map_cache *cache, a1fs_ino_t ino, a1fs_blk_t extentblock,
+                  const a1fs_extent *extents, uint32_t nslots, uint64_t *nblocks);
+
+/**
+ * Record an extent appended at the end of an inode's extent table (or leaf).
+ *
+ * Keeps a cached map up to date without rebuilding it. Does nothing if the
+ * inode's map is not cached or was built from another leaf.
+ *
+ * @param cache        the cache.
+ * @param ino          inode number.
+ * @param extentblock  the extent block (or leaf) the extent was added to.
+ * @param slot         extent table slot of the new extent.
+ * @param blocks       number of blocks in the new extent.
+ */
+void emap_append(extent_map_cache *cache, a1fs_ino_t ino, a1fs_blk_t extentblock,
+                 uint32_t slot, uint32_t blocks);
+
+/** Drop the cached extent map of an inode, if any. */
+void emap_invalidate(extent_map_cache *cache, a1fs_ino_t ino);
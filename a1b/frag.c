@@ -0,0 +1,205 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Fragment allocator implementation.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+#include "frag.h"
+
+
+// Get the header of a fragment block
+static a1fs_frag_header *frag_header(frag_table *ft, a1fs_blk_t block)
+{
+	return (a1fs_frag_header *)((char *)ft->image + (uint64_t)block * A1FS_BLOCK_SIZE);
+}
+
+// Get the occupancy map bits of units [unit, unit + units)
+static uint64_t unit_mask(uint32_t unit, uint32_t units)
+{
+	if (units == 0) return 0;
+	return ((units < 64) ? ((UINT64_C(1) << units) - 1) : ~UINT64_C(0)) << unit;
+}
+
+// Find a run of free units in an occupancy map; -1 if there is none
+static long find_free_units(uint64_t map, uint32_t units)
+{
+	for (uint32_t unit = 1; unit + units <= A1FS_FRAG_UNITS; unit++) {
+		if ((map & unit_mask(unit, units)) == 0) return unit;
+	}
+	return -1;
+}
+
+// Find the index of the first listed block that is not below block
+static uint32_t frag_find(const frag_table *ft, a1fs_blk_t block)
+{
+	uint32_t lo = 0, hi = ft->count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (ft->blocks[mid] < block) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// Make sure the list can hold at least n blocks
+static bool frag_reserve(frag_table *ft, uint32_t n)
+{
+	if (n <= ft->capacity) return true;
+	uint32_t capacity = ft->capacity ? ft->capacity : 64;
+	while (capacity < n) capacity *= 2;
+	a1fs_blk_t *blocks = realloc(ft->blocks, capacity * sizeof(a1fs_blk_t));
+	if (blocks == NULL) return false;
+	ft->blocks = blocks;
+	ft->capacity = capacity;
+	return true;
+}
+
+static int blk_cmp(const void *a, const void *b)
+{
+	a1fs_blk_t x = *(const a1fs_blk_t *)a, y = *(const a1fs_blk_t *)b;
+	return (x > y) - (x < y);
+}
+
+bool frag_init(frag_table *ft, void *image, group_table *groups, uint32_t inode_size)
+{
+	ft->image = image;
+	ft->groups = groups;
+	ft->blocks = NULL;
+	ft->count = 0;
+	ft->capacity = 0;
+	ft->cursor = 0;
+	pthread_mutex_init(&ft->lock, NULL);
+
+	a1fs_superblock *sb = (a1fs_superblock *)image;
+	if (!(sb->s_features & A1FS_FEATURE_TAIL_PACKING)) return true;
+
+	const uint32_t *inode_bitmap = (const uint32_t *)((char *)image + (uint64_t)sb->bg_inode_bitmap * A1FS_BLOCK_SIZE);
+	const char *table = (const char *)image + (uint64_t)sb->bg_inode_table * A1FS_BLOCK_SIZE;
+	for (uint32_t i = 0; i < sb->s_inodes_count; i++) {
+		if (!bitmap_test(inode_bitmap, i)) continue;
+		const a1fs_inode *inode = (const a1fs_inode *)(table + (uint64_t)i * inode_size);
+		if (!(inode->flags & A1FS_INODE_FRAGMENT)) continue;
+		if (!frag_reserve(ft, ft->count + 1)) return false;
+		ft->blocks[ft->count++] = inode->extentblock;
+	}
+
+	if (ft->count == 0) return true;
+	// Blocks shared by several files were listed once per file
+	qsort(ft->blocks, ft->count, sizeof(a1fs_blk_t), blk_cmp);
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < ft->count; i++) {
+		if ((n == 0) || (ft->blocks[n - 1] != ft->blocks[i])) ft->blocks[n++] = ft->blocks[i];
+	}
+	ft->count = n;
+	return true;
+}
+
+void frag_destroy(frag_table *ft)
+{
+	free(ft->blocks);
+	ft->blocks = NULL;
+	pthread_mutex_destroy(&ft->lock);
+}
+
+long frag_alloc(frag_table *ft, uint32_t goal, uint32_t units, uint16_t *offset)
+{
+	pthread_mutex_lock(&ft->lock);
+	uint32_t scan = (ft->count < A1FS_FRAG_SCAN) ? ft->count : A1FS_FRAG_SCAN;
+	for (uint32_t k = 0; k < scan; k++) {
+		uint32_t i = (ft->cursor + k) % ft->count;
+		a1fs_frag_header *hdr = frag_header(ft, ft->blocks[i]);
+		long unit = find_free_units(hdr->map, units);
+		if (unit < 0) continue;
+
+		hdr->map |= unit_mask(unit, units);
+		ft->cursor = i;
+		// The list may move once unlocked
+		a1fs_blk_t block = ft->blocks[i];
+		pthread_mutex_unlock(&ft->lock);
+		*offset = unit * A1FS_FRAG_UNIT;
+		return block;
+	}
+
+	// Start a new block, listed before it is taken from the groups
+	if (!frag_reserve(ft, ft->count + 1)) {
+		pthread_mutex_unlock(&ft->lock);
+		return -ENOSPC;
+	}
+	uint32_t len = 1;
+	long bit = group_alloc_blocks(ft->groups, goal, &len, false);
+	if (bit < 0) {
+		pthread_mutex_unlock(&ft->lock);
+		return -ENOSPC;
+	}
+	a1fs_blk_t block = ft->groups->sb->bg_data_block + bit;
+	a1fs_frag_header *hdr = frag_header(ft, block);
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->map = unit_mask(0, 1) | unit_mask(1, units);
+
+	uint32_t i = frag_find(ft, block);
+	memmove(&ft->blocks[i + 1], &ft->blocks[i], (ft->count - i) * sizeof(a1fs_blk_t));
+	ft->blocks[i] = block;
+	ft->count++;
+	ft->cursor = i;
+	pthread_mutex_unlock(&ft->lock);
+	*offset = A1FS_FRAG_UNIT;
+	return block;
+}
+
+bool frag_resize(frag_table *ft, a1fs_blk_t block, uint16_t offset,
+                 uint32_t old_units, uint32_t new_units)
+{
+	uint32_t unit = offset / A1FS_FRAG_UNIT;
+	bool ret = true;
+	pthread_mutex_lock(&ft->lock);
+	a1fs_frag_header *hdr = frag_header(ft, block);
+	if (new_units <= old_units) {
+		hdr->map &= ~unit_mask(unit + new_units, old_units - new_units);
+	} else if ((unit + new_units <= A1FS_FRAG_UNITS) &&
+	           ((hdr->map & unit_mask(unit + old_units, new_units - old_units)) == 0))
+	{
+		hdr->map |= unit_mask(unit + old_units, new_units - old_units);
+	} else {
+		ret = false;
+	}
+	pthread_mutex_unlock(&ft->lock);
+	return ret;
+}
+
+void frag_free(frag_table *ft, a1fs_blk_t block, uint16_t offset, uint32_t units)
+{
+	pthread_mutex_lock(&ft->lock);
+	a1fs_frag_header *hdr = frag_header(ft, block);
+	hdr->map &= ~unit_mask(offset / A1FS_FRAG_UNIT, units);
+	if (hdr->map == unit_mask(0, 1)) {
+		uint32_t i = frag_find(ft, block);
+		if ((i < ft->count) && (ft->blocks[i] == block)) {
+			memmove(&ft->blocks[i], &ft->blocks[i + 1], (ft->count - i - 1) * sizeof(a1fs_blk_t));
+			ft->count--;
+			if (ft->cursor > i) ft->cursor--;
+			if (ft->cursor >= ft->count) ft->cursor = 0;
+		}
+		group_free_blocks(ft->groups, block - ft->groups->sb->bg_data_block, 1);
+	}
+	pthread_mutex_unlock(&ft->lock);
+}
@@ -0,0 +1,100 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Fragment allocator header file.
+ *
+ * Small files are packed into shared fragment blocks (see a1fs_frag_header),
+ * each file taking a run of A1FS_FRAG_UNIT byte units. The occupancy map of a
+ * block is kept in its header on disk; the table only lists the fragment
+ * blocks, sorted, so that a block can be found again when a fragment in it is
+ * freed. The list is rebuilt at mount time from the inodes that have
+ * fragments.
+ *
+ * New fragments are taken from the block the previous one came from, or from
+ * one of the few blocks after it in the list, before a new block is
+ * allocated, so that allocation cost does not grow with the number of blocks.
+ *
+ * The table lock is taken after inode locks and before allocation group locks.
+ * The contents of a fragment are protected by the lock of its inode.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+#include "groups.h"
+
+
+/** Number of fragment blocks looked at for free units before allocating one. */
+#define A1FS_FRAG_SCAN 16
+
+/** Fragment blocks of a file system. */
+typedef struct frag_table {
+	/** Pointer to the start of the image. */
+	void *image;
+	/** Allocation groups the blocks come from. */
+	group_table *groups;
+	/** Fragment blocks, sorted by block number. */
+	a1fs_blk_t *blocks;
+	/** Number of fragment blocks, and the number the array has room for. */
+	uint32_t count, capacity;
+	/** Index of the block the last fragment was allocated from. */
+	uint32_t cursor;
+	/** Protects the list, the cursor and the headers of the blocks. */
+	pthread_mutex_t lock;
+} frag_table;
+
+
+/**
+ * Set up the fragment table of an image, collecting the fragment blocks of
+ * the inodes in use if the file system has A1FS_FEATURE_TAIL_PACKING.
+ *
+ * @param ft          pointer to the table to initialize.
+ * @param image       pointer to the start of the image.
+ * @param groups      allocation groups of the image.
+ * @param inode_size  size of an inode in the inode table.
+ * @return            true on success; false if out of memory.
+ */
+bool frag_init(frag_table *ft, void *image, group_table *groups, uint32_t inode_size);
+
+/** Free all memory owned by the fragment table. */
+void frag_destroy(frag_table *ft);
+
+/**
+ * Allocate a fragment of consecutive units.
+ *
+ * @param ft      the table.
+ * @param goal    preferred allocation group for a new fragment block.
+ * @param units   number of units, at most A1FS_FRAG_UNITS / 2.
+ * @param offset  pointer to the byte offset of the fragment in the block.
+ * @return        the fragment block on success; -ENOSPC if a new block was
+ *                needed and there are no free blocks.
+ */
+long frag_alloc(frag_table *ft, uint32_t goal, uint32_t units, uint16_t *offset);
+
+/**
+ * Change the number of units of a fragment in place. Shrinking always
+ * succeeds; growing needs the units after the fragment to be free.
+ *
+ * @return  true on success; false if the fragment cannot grow in place.
+ */
+bool frag_resize(frag_table *ft, a1fs_blk_t block, uint16_t offset,
+                 uint32_t old_units, uint32_t new_units);
+
+/** Free a fragment, and its block if no other fragments are left in it. */
+void frag_free(frag_table *ft, a1fs_blk_t block, uint16_t offset, uint32_t units);
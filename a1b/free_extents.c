@@ -0,0 +1,387 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - In-memory free extent index implementation.
+ */
+
+#include <stdlib.h>
+
+#include "bitmap.h"
+#include "free_extents.h"
+
+
+// Treaps a free extent is linked into
+enum { BY_START = 0, BY_LEN = 1 };
+
+// Ordering of nodes within each treap
+static bool less(int t, const free_extent *a, const free_extent *b)
+{
+	if (t == BY_LEN && a->len != b->len) return a->len < b->len;
+	return a->start < b->start;
+}
+
+// Recompute the subtree augmentation of a node in the by-start treap
+static void fix(int t, free_extent *n)
+{
+	if (t != BY_START) return;
+	n->max_len = n->len;
+	for (int i = 0; i < 2; i++) {
+		free_extent *c = n->child[BY_START][i];
+		if (c && c->max_len > n->max_len) n->max_len = c->max_len;
+	}
+}
+
+// Split treap root into nodes ordered before key (*l) and the rest (*r)
+static void split(int t, free_extent *root, const free_extent *key,
+                  free_extent **l, free_extent **r)
+{
+	if (root == NULL) {
+		*l = *r = NULL;
+	} else if (less(t, root, key)) {
+		split(t, root->child[t][1], key, &root->child[t][1], r);
+		fix(t, root);
+		*l = root;
+	} else {
+		split(t, root->child[t][0], key, l, &root->child[t][0]);
+		fix(t, root);
+		*r = root;
+	}
+}
+
+// Join two treaps where every node of a is ordered before every node of b
+static free_extent *merge(int t, free_extent *a, free_extent *b)
+{
+	if (a == NULL) return b;
+	if (b == NULL) return a;
+	if (a->prio > b->prio) {
+		a->child[t][1] = merge(t, a->child[t][1], b);
+		fix(t, a);
+		return a;
+	}
+	b->child[t][0] = merge(t, a, b->child[t][0]);
+	fix(t, b);
+	return b;
+}
+
+static void insert(free_extent_index *fe, int t, free_extent *n)
+{
+	free_extent *l, *r;
+	n->child[t][0] = n->child[t][1] = NULL;
+	fix(t, n);
+	split(t, fe->root[t], n, &l, &r);
+	fe->root[t] = merge(t, merge(t, l, n), r);
+}
+
+static void erase(int t, free_extent **root, free_extent *n)
+{
+	if (*root == n) {
+		*root = merge(t, n->child[t][0], n->child[t][1]);
+		return;
+	}
+	erase(t, &(*root)->child[t][less(t, n, *root) ? 0 : 1], n);
+	fix(t, *root);
+}
+
+// Link a run into both treaps
+static void link_run(free_extent_index *fe, free_extent *n)
+{
+	// xorshift32
+	fe->seed ^= fe->seed << 13;
+	fe->seed ^= fe->seed >> 17;
+	fe->seed ^= fe->seed << 5;
+	n->prio = fe->seed;
+	insert(fe, BY_START, n);
+	insert(fe, BY_LEN, n);
+	fe->count++;
+}
+
+// Unlink a run from both treaps
+static void unlink_run(free_extent_index *fe, free_extent *n)
+{
+	erase(BY_START, &fe->root[BY_START], n);
+	erase(BY_LEN, &fe->root[BY_LEN], n);
+	fe->count--;
+}
+
+static bool add_run(free_extent_index *fe, uint32_t start, uint32_t len)
+{
+	free_extent *n = malloc(sizeof(free_extent));
+	if (n == NULL) return false;
+	n->start = start;
+	n->len = len;
+	link_run(fe, n);
+	return true;
+}
+
+static void free_tree(free_extent *n)
+{
+	if (n == NULL) return;
+	free_tree(n->child[BY_START][0]);
+	free_tree(n->child[BY_START][1]);
+	free(n);
+}
+
+// Drop all runs; used when the index can no longer be kept in sync
+static void invalidate(free_extent_index *fe)
+{
+	free_tree(fe->root[BY_START]);
+	fe->root[BY_START] = fe->root[BY_LEN] = NULL;
+	fe->count = 0;
+	fe->valid = false;
+}
+
+bool fext_init(free_extent_index *fe, const uint32_t *bitmap, uint32_t nbits)
+{
+	fe->root[BY_START] = fe->root[BY_LEN] = NULL;
+	fe->count = 0;
+	fe->seed = 2463534242u;
+	fe->valid = true;
+
+	uint32_t from = 0;
+	while (from < nbits) {
+		long start = bitmap_next_clear(bitmap, from, nbits);
+		if (start < 0) break;
+		uint32_t end = bitmap_next_set(bitmap, start, nbits);
+		if (!add_run(fe, start, end - start)) {
+			invalidate(fe);
+			return false;
+		}
+		from = end;
+	}
+	return true;
+}
+
+void fext_destroy(free_extent_index *fe)
+{
+	invalidate(fe);
+}
+
+// Find the run with the greatest start <= pos; NULL if none
+static free_extent *find_at_or_before(const free_extent_index *fe, uint32_t pos)
+{
+	free_extent *n = fe->root[BY_START], *found = NULL;
+	while (n != NULL) {
+		if (n->start <= pos) {
+			found = n;
+			n = n->child[BY_START][1];
+		} else {
+			n = n->child[BY_START][0];
+		}
+	}
+	return found;
+}
+
+// Find the run with the smallest start > pos; NULL if none
+static free_extent *find_after(const free_extent_index *fe, uint32_t pos)
+{
+	free_extent *n = fe->root[BY_START], *found = NULL;
+	while (n != NULL) {
+		if (n->start > pos) {
+			found = n;
+			n = n->child[BY_START][0];
+		} else {
+			n = n->child[BY_START][1];
+		}
+	}
+	return found;
+}
+
+// Find the lowest run starting at or after goal with at least len blocks
+static free_extent *first_fit(free_extent *n, uint32_t goal, uint32_t len)
+{
+	if ((n == NULL) || (n->max_len < len)) return NULL;
+	if (n->start >= goal) {
+		free_extent *found = first_fit(n->child[BY_START][0], goal, len);
+		if (found != NULL) return found;
+		if (n->len >= len) return n;
+	}
+	return first_fit(n->child[BY_START][1], goal, len);
+}
+
+// Carve [start, start + len) out of run n
+static bool take(free_extent_index *fe, free_extent *n, uint32_t start, uint32_t len)
+{
+	uint32_t end = n->start + n->len;
+	unlink_run(fe, n);
+	if (n->start == start) {
+		// Reuse the node for what is left after the range
+		n->start = start + len;
+		n->len = end - n->start;
+	} else {
+		// Reuse the node for what is left before the range
+		n->len = start - n->start;
+		if ((start + len < end) && !add_run(fe, start + len, end - start - len)) {
+			free(n);
+			invalidate(fe);
+			return false;
+		}
+	}
+	if (n->len > 0) {
+		link_run(fe, n);
+	} else {
+		free(n);
+	}
+	return true;
+}
+
+bool fext_alloc_best_fit(free_extent_index *fe, uint32_t len, uint32_t *start)
+{
+	free_extent *n = fe->root[BY_LEN], *best = NULL;
+	while (n != NULL) {
+		if (n->len >= len) {
+			best = n;
+			n = n->child[BY_LEN][0];
+		} else {
+			n = n->child[BY_LEN][1];
+		}
+	}
+	if (best == NULL) return false;
+	*start = best->start;
+	return take(fe, best, best->start, len);
+}
+
+bool fext_alloc_first_fit(free_extent_index *fe, uint32_t goal, uint32_t len,
+                          uint32_t *start)
+{
+	// Prefer starting right at the goal if it falls inside a long enough run
+	free_extent *n = find_at_or_before(fe, goal);
+	if ((n != NULL) && ((uint64_t)goal + len <= (uint64_t)n->start + n->len)) {
+		*start = goal;
+		return take(fe, n, goal, len);
+	}
+	n = first_fit(fe->root[BY_START], goal, len);
+	if (n == NULL) n = first_fit(fe->root[BY_START], 0, len);
+	if (n == NULL) return false;
+	*start = n->start;
+	return take(fe, n, n->start, len);
+}
+
+// Get the first position at or after pos that is aligned once offset is added
+static uint32_t align_pos(uint32_t pos, uint32_t align, uint32_t offset)
+{
+	return pos + ((align - (pos + offset) % align) % align);
+}
+
+// Allocate len aligned blocks from the lowest run at or after goal with room
+// for them; see fext_alloc_aligned()
+static bool alloc_aligned_from(free_extent_index *fe, uint32_t goal, uint32_t len,
+                               uint32_t align, uint32_t offset, uint32_t *start)
+{
+	// Runs long enough but misaligned are skipped a few at a time; past that,
+	// only runs with room to spare for any alignment are looked at
+	uint32_t pos = goal;
+	for (int i = 0; i < A1FS_FEXT_ALIGN_TRIES; i++) {
+		free_extent *n = first_fit(fe->root[BY_START], pos, len);
+		if (n == NULL) return false;
+		uint32_t a = align_pos(n->start, align, offset);
+		if ((uint64_t)a + len <= (uint64_t)n->start + n->len) {
+			*start = a;
+			return take(fe, n, a, len);
+		}
+		pos = n->start + 1;
+	}
+	free_extent *n = first_fit(fe->root[BY_START], pos, len + align - 1);
+	if (n == NULL) return false;
+	*start = align_pos(n->start, align, offset);
+	return take(fe, n, *start, len);
+}
+
+bool fext_alloc_aligned(free_extent_index *fe, uint32_t goal, uint32_t len,
+                        uint32_t align, uint32_t offset, uint32_t *start)
+{
+	if (align <= 1) return fext_alloc_first_fit(fe, goal, len, start);
+	// The run the goal falls in, from the first aligned block after the goal
+	free_extent *n = find_at_or_before(fe, goal);
+	uint32_t a = align_pos(goal, align, offset);
+	if ((n != NULL) && ((uint64_t)a + len <= (uint64_t)n->start + n->len)) {
+		*start = a;
+		return take(fe, n, a, len);
+	}
+	return alloc_aligned_from(fe, goal, len, align, offset, start) ||
+	       alloc_aligned_from(fe, 0, len, align, offset, start);
+}
+
+bool fext_reserve(free_extent_index *fe, uint32_t start, uint32_t len)
+{
+	if (!fe->valid) return false;
+	while (len > 0) {
+		free_extent *n = find_at_or_before(fe, start);
+		if ((n == NULL) || (n->start + n->len <= start)) {
+			// Not free; the caller's view of the bitmap disagrees with ours
+			invalidate(fe);
+			return false;
+		}
+		uint32_t end = n->start + n->len;
+		uint32_t chunk = (end - start < len) ? end - start : len;
+		if (!take(fe, n, start, chunk)) return false;
+		start += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+uint32_t fext_free_run(const free_extent_index *fe, uint32_t start, uint32_t len)
+{
+	if (!fe->valid) return 0;
+	free_extent *n = find_at_or_before(fe, start);
+	if ((n == NULL) || (n->start + n->len <= start)) return 0;
+	uint32_t end = n->start + n->len;
+	return (end - start < len) ? end - start : len;
+}
+
+bool fext_free(free_extent_index *fe, uint32_t start, uint32_t len)
+{
+	if (!fe->valid) return false;
+	if (len == 0) return true;
+	free_extent *prev = find_at_or_before(fe, start);
+	free_extent *next = find_after(fe, start);
+	if ((prev && prev->start + prev->len > start) ||
+	    (next && next->start < start + len)) {
+		invalidate(fe);
+		return false;
+	}
+	bool merge_prev = prev && (prev->start + prev->len == start);
+	bool merge_next = next && (next->start == start + len);
+
+	if (merge_prev && merge_next) {
+		unlink_run(fe, prev);
+		unlink_run(fe, next);
+		prev->len += len + next->len;
+		free(next);
+		link_run(fe, prev);
+	} else if (merge_prev) {
+		unlink_run(fe, prev);
+		prev->len += len;
+		link_run(fe, prev);
+	} else if (merge_next) {
+		unlink_run(fe, next);
+		next->start = start;
+		next->len += len;
+		link_run(fe, next);
+	} else if (!add_run(fe, start, len)) {
+		invalidate(fe);
+		return false;
+	}
+	return true;
+}
+
+uint32_t fext_largest(const free_extent_index *fe, uint32_t *start)
+{
+	const free_extent *n = fe->root[BY_LEN];
+	if (n == NULL) return 0;
+	while (n->child[BY_LEN][1] != NULL) n = n->child[BY_LEN][1];
+	if (start != NULL) *start = n->start;
+	return n->len;
+}
@@ -0,0 +1,148 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - In-memory free extent index header file.
+ *
+ * The index mirrors the free runs of the data bitmap so that the block
+ * allocator does not have to rediscover free space by scanning the bitmap.
+ * Every free run is kept in two treaps: one ordered by start (augmented with
+ * the longest run in each subtree, for first-fit and coalescing) and one
+ * ordered by length (for best-fit). Both give O(log n) expected time.
+ *
+ * Positions are bit indices in the data bitmap, i.e. block numbers relative to
+ * the start of the data region. The caller updates the bitmap and the index
+ * together; the index never touches the bitmap itself.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Number of long enough but misaligned runs fext_alloc_aligned() looks past
+ * before it only considers runs with room for any alignment.
+ */
+#define A1FS_FEXT_ALIGN_TRIES 8
+
+
+/** A run of free blocks, linked into both treaps. */
+typedef struct free_extent {
+	/** First block of the run. */
+	uint32_t start;
+	/** Number of blocks in the run. */
+	uint32_t len;
+	/** Treap priority. */
+	uint32_t prio;
+	/** Longest run in the by-start subtree rooted at this node. */
+	uint32_t max_len;
+	/** Children in the by-start ([0]) and by-length ([1]) treaps. */
+	struct free_extent *child[2][2];
+} free_extent;
+
+/** Free extent index of the data region. */
+typedef struct free_extent_index {
+	/** Roots of the by-start ([0]) and by-length ([1]) treaps. */
+	free_extent *root[2];
+	/** Number of free runs in the index. */
+	size_t count;
+	/** State of the priority generator. */
+	uint32_t seed;
+	/**
+	 * False if the index could not be kept in sync (out of memory); the
+	 * caller then falls back to scanning the bitmap until it is rebuilt.
+	 */
+	bool valid;
+} free_extent_index;
+
+
+/**
+ * Build the index from a data bitmap.
+ *
+ * @param fe      pointer to the index to initialize.
+ * @param bitmap  the data bitmap.
+ * @param nbits   number of blocks in the data region.
+ * @return        true on success; false if out of memory.
+ */
+bool fext_init(free_extent_index *fe, const uint32_t *bitmap, uint32_t nbits);
+
+/** Free all memory owned by the index. */
+void fext_destroy(free_extent_index *fe);
+
+/**
+ * Allocate len blocks from the smallest free run that can hold them.
+ *
+ * @param start  pointer to the variable that receives the first block.
+ * @return       true on success; false if no run is long enough.
+ */
+bool fext_alloc_best_fit(free_extent_index *fe, uint32_t len, uint32_t *start);
+
+/**
+ * Allocate len blocks from the lowest free run at or after goal that can hold
+ * them, wrapping around to the start of the region if there is none.
+ *
+ * @param start  pointer to the variable that receives the first block.
+ * @return       true on success; false if no run is long enough.
+ */
+bool fext_alloc_first_fit(free_extent_index *fe, uint32_t goal, uint32_t len,
+                          uint32_t *start);
+
+/**
+ * Allocate len blocks starting at an aligned position, i.e. one where
+ * position + offset is a multiple of align, from the lowest free run at or
+ * after goal that has room for them, wrapping around to the start of the
+ * region if there is none. Same as fext_alloc_first_fit() if align is 1.
+ *
+ * @param align   alignment in blocks, a power of 2.
+ * @param offset  value added to positions before checking their alignment.
+ * @param start   pointer to the variable that receives the first block.
+ * @return        true on success; false if no run has room.
+ */
+bool fext_alloc_aligned(free_extent_index *fe, uint32_t goal, uint32_t len,
+                        uint32_t align, uint32_t offset, uint32_t *start);
+
+/**
+ * Mark blocks [start, start + len) as allocated. The range must be free.
+ *
+ * @return  true on success; false if out of memory (the index is invalidated).
+ */
+bool fext_reserve(free_extent_index *fe, uint32_t start, uint32_t len);
+
+/**
+ * Get the number of blocks from start on, up to len, that are free in the
+ * index. Unlike fext_reserve(), a range that is not free is not an error.
+ *
+ * @return  number of free blocks at start; 0 if start is not free.
+ */
+uint32_t fext_free_run(const free_extent_index *fe, uint32_t start, uint32_t len);
+
+/**
+ * Mark blocks [start, start + len) as free, merging with adjacent free runs.
+ * The range must not overlap any free run.
+ *
+ * @return  true on success; false if out of memory (the index is invalidated).
+ */
+bool fext_free(free_extent_index *fe, uint32_t start, uint32_t len);
+
+/**
+ * Get the longest free run.
+ *
+ * @param start  pointer to the variable that receives its first block; may be
+ *               NULL.
+ * @return       length of the run; 0 if there are no free blocks.
+ */
+uint32_t fext_largest(const free_extent_index *fe, uint32_t *start);
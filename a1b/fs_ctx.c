@@ -16,21 +16,171 @@
  * CSC369 Assignment 1 - File system runtime context implementation.
  */
 
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a1fs.h"
+#include "bitmap.h"
 #include "fs_ctx.h"
 
 
+// Convert the directories of an image without A1FS_FEATURE_DIR_SIZE: their
+// size counted 256 bytes per entry, and entry_count 16 slots per block
+static void convert_dir_sizes(void *image)
+{
+	a1fs_superblock *sb = (a1fs_superblock *)image;
+	const uint32_t *inode_bitmap = (const uint32_t *)((char *)image + (uint64_t)sb->bg_inode_bitmap * A1FS_BLOCK_SIZE);
+	a1fs_inode *table = (a1fs_inode *)((char *)image + (uint64_t)sb->bg_inode_table * A1FS_BLOCK_SIZE);
+	for (uint32_t i = 0; i < sb->s_inodes_count; i++) {
+		if (!(inode_bitmap[i / 32] & (1u << (i % 32)))) continue;
+		a1fs_inode *inode = &table[i];
+		if (!S_ISDIR(inode->mode)) continue;
+		uint64_t nblocks = inode->entry_count / (A1FS_BLOCK_SIZE / sizeof(a1fs_dentry));
+		inode->entry_count = inode->size / sizeof(a1fs_dentry);
+		inode->size = nblocks * A1FS_BLOCK_SIZE;
+	}
+	sb->s_features |= A1FS_FEATURE_DIR_SIZE;
+}
+
+// Queue the inodes that were removed, but whose numbers were not freed before
+// the image was last unmounted: the ones in use that have no links
+static void queue_dead_inodes(fs_ctx *fs)
+{
+	a1fs_superblock *sb = (a1fs_superblock *)fs->image;
+	const uint32_t *inode_bitmap = (const uint32_t *)((char *)fs->image + (uint64_t)sb->bg_inode_bitmap * A1FS_BLOCK_SIZE);
+	char *table = (char *)fs->image + (uint64_t)sb->bg_inode_table * A1FS_BLOCK_SIZE;
+	for (uint32_t i = 0; i < sb->s_inodes_count; i++) {
+		if (!bitmap_test(inode_bitmap, i)) continue;
+		a1fs_inode *inode = (a1fs_inode *)(table + (uint64_t)i * fs->inode_size);
+		if (inode->links == 0) fs_queue_dead(fs, i + 1);
+	}
+}
+
 bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, a1fs_opts *opts)
 {
 	fs->image = image;
 	fs->size = size;
 	fs->opts = opts;
 
-	//TODO
+	a1fs_superblock *sb = (a1fs_superblock *)image;
+	if (sb->s_features & ~A1FS_FEATURE_ALL) return false;
+	// Older mkfs left the superblock after data_block_count unwritten; the
+	// hash seed only means something once it has been used for directories
+	if (!(sb->s_features & (A1FS_FEATURE_DIR_INDEX | A1FS_FEATURE_COMPACT_DIRENT))) sb->s_hash_seed = 0;
+	if (!(sb->s_features & A1FS_FEATURE_DIR_SIZE)) {
+		// Nor did it know about allocation groups or any later feature
+		if (sb->s_features & ~(A1FS_FEATURE_DIR_INDEX | A1FS_FEATURE_COMPACT_DIRENT)) return false;
+		memset(&sb->bg_group_desc, 0, sizeof(*sb) - offsetof(a1fs_superblock, bg_group_desc));
+		convert_dir_sizes(image);
+	}
+	fs->inode_size = a1fs_inode_size(sb);
+	if ((fs->inode_size < sizeof(a1fs_inode)) || (A1FS_BLOCK_SIZE % fs->inode_size != 0)) return false;
+	fs->inline_extents = 0;
+	if (sb->s_features & A1FS_FEATURE_INLINE_EXTENTS) {
+		fs->inline_extents = (fs->inode_size - sizeof(a1fs_inode)) / sizeof(a1fs_extent);
+	}
+	fs->inline_data = 0;
+	if (sb->s_features & A1FS_FEATURE_INLINE_DATA) {
+		fs->inline_data = fs->inode_size - sizeof(a1fs_inode);
+	}
+	fs->frag_max = (sb->s_features & A1FS_FEATURE_TAIL_PACKING) ? A1FS_FRAG_MAX : 0;
+	fs->huge_align = opts->hugepages ? A1FS_HUGE_PAGE_SIZE / A1FS_BLOCK_SIZE : 1;
+
+	pthread_rwlock_init(&fs->ns_lock, NULL);
+	fs->ns_seq = 0;
+	for (size_t i = 0; i < A1FS_INODE_LOCKS; i++) {
+		pthread_rwlock_init(&fs->inode_locks[i].lock, NULL);
+		fs->inode_locks[i].seq = 0;
+	}
+	fs->dead = malloc(A1FS_DEAD_BATCH * sizeof(a1fs_ino_t));
+	if (fs->dead == NULL) return false;
+	fs->dead_count = 0;
+	fs->dead_max = A1FS_DEAD_BATCH;
+	pthread_mutex_init(&fs->dead_lock, NULL);
+
+	if (!emap_cache_init(&fs->emaps, A1FS_EMAP_CACHE_SIZE)) return false;
+	size_t dcache_kb = opts->dcache_size ? opts->dcache_size : A1FS_DCACHE_DEFAULT_KB;
+	if (!dcache_init(&fs->dcache, dcache_kb * 1024)) return false;
+
+	if (!groups_init(&fs->groups, image)) return false;
+	if (!delalloc_init(&fs->delalloc, A1FS_INODE_LOCKS)) return false;
+	if (!frag_init(&fs->frags, image, &fs->groups, fs->inode_size)) return false;
+	if (!rsv_init(&fs->rsv, &fs->groups, A1FS_INODE_LOCKS)) return false;
+	queue_dead_inodes(fs);
 	return true;
 }
 
 void fs_ctx_destroy(fs_ctx *fs)
 {
-	//TODO
-	(void)fs;
+	rsv_destroy(&fs->rsv);
+	frag_destroy(&fs->frags);
+	delalloc_destroy(&fs->delalloc);
+	groups_destroy(&fs->groups);
+	dcache_destroy(&fs->dcache);
+	emap_cache_destroy(&fs->emaps);
+
+	pthread_mutex_destroy(&fs->dead_lock);
+	free(fs->dead);
+	for (size_t i = 0; i < A1FS_INODE_LOCKS; i++) {
+		pthread_rwlock_destroy(&fs->inode_locks[i].lock);
+	}
+	pthread_rwlock_destroy(&fs->ns_lock);
+}
+
+// Get the distinct lock indices of a set of inodes in increasing order,
+// return their number
+static int lock_indices(const a1fs_ino_t *inos, int n, uint32_t *idx)
+{
+	int count = 0;
+	for (int i = 0; i < n; i++) {
+		if (inos[i] == 0) continue;
+		uint32_t l = inos[i] % A1FS_INODE_LOCKS;
+		int j = 0;
+		while ((j < count) && (idx[j] < l)) j++;
+		if ((j < count) && (idx[j] == l)) continue;
+		memmove(&idx[j + 1], &idx[j], (count - j) * sizeof(*idx));
+		idx[j] = l;
+		count++;
+	}
+	return count;
+}
+
+void fs_lock_inodes(fs_ctx *fs, const a1fs_ino_t *inos, int n)
+{
+	uint32_t idx[A1FS_MAX_LOCKED];
+	int count = lock_indices(inos, n, idx);
+	for (int i = 0; i < count; i++) {
+		pthread_rwlock_wrlock(&fs->inode_locks[idx[i]].lock);
+		seqcount_write_begin(&fs->inode_locks[idx[i]].seq);
+	}
+}
+
+void fs_unlock_inodes(fs_ctx *fs, const a1fs_ino_t *inos, int n)
+{
+	uint32_t idx[A1FS_MAX_LOCKED];
+	int count = lock_indices(inos, n, idx);
+	for (int i = count - 1; i >= 0; i--) {
+		seqcount_write_end(&fs->inode_locks[idx[i]].seq);
+		pthread_rwlock_unlock(&fs->inode_locks[idx[i]].lock);
+	}
+}
+
+bool fs_queue_dead(fs_ctx *fs, a1fs_ino_t ino)
+{
+	pthread_mutex_lock(&fs->dead_lock);
+	if (fs->dead_count == fs->dead_max) {
+		// If out of memory, the inode is found again at the next mount
+		a1fs_ino_t *dead = realloc(fs->dead, 2 * fs->dead_max * sizeof(a1fs_ino_t));
+		if (dead == NULL) {
+			pthread_mutex_unlock(&fs->dead_lock);
+			return true;
+		}
+		fs->dead = dead;
+		fs->dead_max *= 2;
+	}
+	fs->dead[fs->dead_count++] = ino;
+	bool full = fs->dead_count >= A1FS_DEAD_BATCH;
+	pthread_mutex_unlock(&fs->dead_lock);
+	return full;
 }
@@ -14,14 +14,80 @@
 
 /**
  * CSC369 Assignment 1 - File system runtime context header file.
+ *
+ * Locking (relevant with the --mt mount option). Locks are always taken in
+ * this order:
+ *
+ *   1. ns_lock: held for reading by every operation except a rename that moves
+ *      a directory to another parent, which holds it for writing and runs
+ *      alone, so that two such renames cannot make a loop. It is also held for
+ *      writing briefly to free the numbers of removed inodes (see below).
+ *   2. Inode locks: held for reading while a directory is searched or a file
+ *      is read, and for writing while an inode or its blocks are modified
+ *      (a parent directory in create and mkdir, a file in write/truncate).
+ *      A thread holds at most one inode lock at a time, except for unlink,
+ *      rmdir and rename, which lock the parent directories and the inode
+ *      being removed with fs_lock_inodes(), in the order of the locks.
+ *   3. The fragment table lock (see frag.h) or the reservation window table
+ *      lock (see rsv.h), then allocation group locks (see groups.h), at most
+ *      one at a time. The superblock free counters are updated atomically
+ *      instead.
+ *   4. Cache locks: the dentry cache lock, the extent map entry locks, the
+ *      delayed allocation table lock and the dead inode list lock.
+ *
+ * Since unlink, rmdir and rename do not run alone, other operations may hold
+ * the number of an inode they remove, having resolved its path just before.
+ * The inode's data is freed right away and the inode is left with no links;
+ * operations that find no links once they lock an inode resolve the path
+ * again. The number is only freed later, with ns_lock held for writing (see
+ * fs_queue_dead()).
+ *
+ * Each of ns_lock and the inode locks has a sequence counter (see seqcount.h)
+ * that is odd while the lock is held for writing, so that getattr can look at
+ * the directory tree and inode attributes without taking any locks: it only
+ * uses the dentry cache and retries (or falls back to locking) if a writer
+ * was active in between.
  */
 
 #pragma once
 
+#include <pthread.h>
 #include <stddef.h>
 
+#include "dcache.h"
+#include "delalloc.h"
+#include "extent_map.h"
+#include "frag.h"
+#include "groups.h"
+#include "map.h"
 #include "options.h"
+#include "rsv.h"
+#include "seqcount.h"
+
+
+/** Number of inode locks; inodes are hashed onto them. */
+#define A1FS_INODE_LOCKS 256
+
+/**
+ * Size from which a file's new extents start at huge page boundaries in the
+ * image when mounted with --hugepages.
+ */
+#define A1FS_HUGE_FILE_SIZE A1FS_HUGE_PAGE_SIZE
+
+/** Number of lock-free read attempts before falling back to locking. */
+#define A1FS_SEQ_RETRIES 4
+
+/** Maximum number of inodes fs_lock_inodes() can lock. */
+#define A1FS_MAX_LOCKED 3
 
+/** Number of removed inodes whose numbers are freed together. */
+#define A1FS_DEAD_BATCH 64
+
+/** An inode lock and the sequence counter of its writers. */
+typedef struct fs_inode_lock {
+	pthread_rwlock_t lock;
+	seqcount seq;
+} fs_inode_lock;
 
 /**
  * Mounted file system runtime state - "fs context".
@@ -33,8 +99,48 @@ typedef struct fs_ctx {
 	size_t size;
 	/** Command line options. */
 	a1fs_opts *opts;
+	/** Size of an inode in the inode table. */
+	uint32_t inode_size;
+	/** Extent slots stored in an inode; 0 without inline extents. */
+	uint32_t inline_extents;
+	/** Bytes of file data stored in an inode; 0 without inline data. */
+	uint32_t inline_data;
+	/** Largest file stored in a fragment; 0 without tail packing. */
+	uint32_t frag_max;
+	/** Alignment of large files' extents in blocks; 1 without --hugepages. */
+	uint32_t huge_align;
+
+	/** Cached logical-to-physical extent maps of recently used inodes. */
+	extent_map_cache emaps;
+	/** Cached path and (directory, name) to inode number mappings. */
+	dcache dcache;
+	/** Allocation groups: block and inode allocators. */
+	group_table groups;
+	/** Buffered file data waiting for blocks to be allocated. */
+	delalloc_table delalloc;
+	/** Fragment blocks shared by small files. */
+	frag_table frags;
+	/** Blocks set aside for files being appended to. */
+	rsv_table rsv;
+
+	/** Directory tree lock. */
+	pthread_rwlock_t ns_lock;
+	/**
+	 * Sequence counter of ns_lock writers. Kept on its own cache line, away
+	 * from ns_lock, which every locking reader writes to.
+	 */
+	seqcount ns_seq __attribute__((aligned(64)));
+	/** Inode locks; inode ino uses inode_locks[ino % A1FS_INODE_LOCKS]. */
+	fs_inode_lock inode_locks[A1FS_INODE_LOCKS] __attribute__((aligned(64)));
 
-	//TODO
+	/** Removed inodes whose numbers are not freed yet. */
+	a1fs_ino_t *dead;
+	/** Number of inodes in dead. */
+	uint32_t dead_count;
+	/** Capacity of dead. */
+	uint32_t dead_max;
+	/** Protects the dead inode list. */
+	pthread_mutex_t dead_lock;
 
 } fs_ctx;
 
@@ -55,3 +161,75 @@ bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, a1fs_opts *opts);
  * Must cleanup all the resources created in fs_ctx_init().
  */
 void fs_ctx_destroy(fs_ctx *fs);
+
+/** Lock the directory tree for reading (write == false) or writing. */
+static inline void fs_lock_ns(fs_ctx *fs, bool write)
+{
+	if (write) {
+		pthread_rwlock_wrlock(&fs->ns_lock);
+		seqcount_write_begin(&fs->ns_seq);
+	} else {
+		pthread_rwlock_rdlock(&fs->ns_lock);
+	}
+}
+
+/** Unlock the directory tree locked with fs_lock_ns(). */
+static inline void fs_unlock_ns(fs_ctx *fs)
+{
+	// The counter is only odd while the lock is held for writing, i.e. by us
+	if (seqcount_writing(&fs->ns_seq)) seqcount_write_end(&fs->ns_seq);
+	pthread_rwlock_unlock(&fs->ns_lock);
+}
+
+/** Lock an inode for reading (write == false) or writing (write == true). */
+static inline void fs_lock_inode(fs_ctx *fs, a1fs_ino_t ino, bool write)
+{
+	fs_inode_lock *l = &fs->inode_locks[ino % A1FS_INODE_LOCKS];
+	if (write) {
+		pthread_rwlock_wrlock(&l->lock);
+		seqcount_write_begin(&l->seq);
+	} else {
+		pthread_rwlock_rdlock(&l->lock);
+	}
+}
+
+/** Unlock an inode locked with fs_lock_inode(). */
+static inline void fs_unlock_inode(fs_ctx *fs, a1fs_ino_t ino)
+{
+	fs_inode_lock *l = &fs->inode_locks[ino % A1FS_INODE_LOCKS];
+	if (seqcount_writing(&l->seq)) seqcount_write_end(&l->seq);
+	pthread_rwlock_unlock(&l->lock);
+}
+
+/**
+ * Lock inodes for writing, in the order of their locks so that threads locking
+ * overlapping sets cannot deadlock. Inodes that share a lock are locked once;
+ * zeros are skipped.
+ *
+ * @param fs    the context.
+ * @param inos  inode numbers; at most A1FS_MAX_LOCKED.
+ * @param n     number of inode numbers.
+ */
+void fs_lock_inodes(fs_ctx *fs, const a1fs_ino_t *inos, int n);
+
+/** Unlock inodes locked with fs_lock_inodes(). */
+void fs_unlock_inodes(fs_ctx *fs, const a1fs_ino_t *inos, int n);
+
+/**
+ * Add an inode that was removed from the directory tree to the list of inodes
+ * whose numbers are to be freed. The numbers are freed in batches, with
+ * ns_lock held for writing; until then the inode stays allocated with no
+ * links.
+ *
+ * @param fs   the context.
+ * @param ino  the inode number.
+ * @return     true if the list has A1FS_DEAD_BATCH inodes, and the caller
+ *             should free them once it has dropped its locks.
+ */
+bool fs_queue_dead(fs_ctx *fs, a1fs_ino_t ino);
+
+/** Get the sequence counter of an inode's lock. */
+static inline seqcount *fs_inode_seq(fs_ctx *fs, a1fs_ino_t ino)
+{
+	return &fs->inode_locks[ino % A1FS_INODE_LOCKS].seq;
+}
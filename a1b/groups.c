@@ -0,0 +1,497 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Allocation groups implementation.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "bitmap.h"
+#include "groups.h"
+
+
+// Update a superblock free counter; other groups update it concurrently
+static void sb_count_add(unsigned int *count, int delta)
+{
+	__atomic_add_fetch(count, (unsigned int)delta, __ATOMIC_RELAXED);
+}
+
+// Count the directories of each group; only directory placement needs them
+static void count_dirs(group_table *gt, void *image)
+{
+	a1fs_superblock *sb = gt->sb;
+	uint32_t inode_size = a1fs_inode_size(sb);
+	const char *table = (const char *)image + (uint64_t)sb->bg_inode_table * A1FS_BLOCK_SIZE;
+	for (uint32_t i = 0; i < sb->s_inodes_count; i++) {
+		if (!bitmap_test(gt->inode_bitmap, i)) continue;
+		const a1fs_inode *inode = (const a1fs_inode *)(table + (uint64_t)i * inode_size);
+		if (S_ISDIR(inode->mode)) gt->groups[i / gt->inodes_per_group].ndirs++;
+	}
+}
+
+bool groups_init(group_table *gt, void *image)
+{
+	a1fs_superblock *sb = (a1fs_superblock *)image;
+	gt->sb = sb;
+	gt->data_bitmap = (uint32_t *)((char *)image + sb->bg_block_bitmap * A1FS_BLOCK_SIZE);
+	gt->inode_bitmap = (uint32_t *)((char *)image + sb->bg_inode_bitmap * A1FS_BLOCK_SIZE);
+	gt->legacy_desc = NULL;
+	gt->inodes_per_block = A1FS_BLOCK_SIZE / a1fs_inode_size(sb);
+	gt->dir_rotor = 0;
+	gt->reserved = 0;
+
+	a1fs_group_desc *desc;
+	if (sb->s_groups_count > 0) {
+		gt->count = sb->s_groups_count;
+		gt->blocks_per_group = sb->s_blocks_per_group;
+		gt->inodes_per_group = sb->s_inodes_per_group;
+		desc = (a1fs_group_desc *)((char *)image + sb->bg_group_desc * A1FS_BLOCK_SIZE);
+	} else {
+		// Formatted without groups: everything is in one group
+		gt->count = 1;
+		gt->blocks_per_group = sb->data_block_count;
+		gt->inodes_per_group = sb->s_inodes_count;
+		desc = gt->legacy_desc = malloc(sizeof(a1fs_group_desc));
+		if (desc == NULL) return false;
+		desc->free_blocks_count = sb->s_free_blocks_count;
+		desc->free_inodes_count = sb->s_free_inodes_count;
+	}
+
+	gt->groups = calloc(gt->count, sizeof(alloc_group));
+	if (gt->groups == NULL) {
+		free(gt->legacy_desc);
+		return false;
+	}
+	for (uint32_t g = 0; g < gt->count; g++) {
+		alloc_group *grp = &gt->groups[g];
+		pthread_mutex_init(&grp->lock, NULL);
+		grp->desc = &desc[g];
+		grp->first_block = g * gt->blocks_per_group;
+		grp->nblocks = sb->data_block_count - grp->first_block;
+		if (grp->nblocks > gt->blocks_per_group) grp->nblocks = gt->blocks_per_group;
+		grp->first_inode = g * gt->inodes_per_group;
+		grp->ninodes = 0;
+		if (grp->first_inode < sb->s_inodes_count) {
+			grp->ninodes = sb->s_inodes_count - grp->first_inode;
+			if (grp->ninodes > gt->inodes_per_group) grp->ninodes = gt->inodes_per_group;
+		}
+		ialloc_init(&grp->inodes, gt->inode_bitmap + grp->first_inode / 32, grp->ninodes);
+		if (!fext_init(&grp->free_blocks, gt->data_bitmap + grp->first_block / 32, grp->nblocks)) {
+			gt->count = g + 1;
+			groups_destroy(gt);
+			return false;
+		}
+	}
+	if (gt->count > 1) count_dirs(gt, image);
+	return true;
+}
+
+void groups_destroy(group_table *gt)
+{
+	if (gt->groups == NULL) return;
+	for (uint32_t g = 0; g < gt->count; g++) {
+		fext_destroy(&gt->groups[g].free_blocks);
+		pthread_mutex_destroy(&gt->groups[g].lock);
+	}
+	free(gt->groups);
+	gt->groups = NULL;
+	free(gt->legacy_desc);
+	gt->legacy_desc = NULL;
+}
+
+// Get the free extent index of a group (locked), rebuilding it if it ran out
+// of memory before
+static free_extent_index *group_index(group_table *gt, alloc_group *grp)
+{
+	free_extent_index *fe = &grp->free_blocks;
+	if (!fe->valid) {
+		fext_destroy(fe);
+		fext_init(fe, gt->data_bitmap + grp->first_block / 32, grp->nblocks);
+		// Reservation windows are back in the index
+		grp->index_gen++;
+	}
+	return fe;
+}
+
+// Allocate a run from a locked group; see group_alloc_blocks(). Returns the
+// start of the run relative to the group, or -1.
+static long take_run(group_table *gt, alloc_group *grp, uint32_t *len, bool partial)
+{
+	if (grp->desc->free_blocks_count < (partial ? 1 : *len)) return -1;
+	uint32_t *slice = gt->data_bitmap + grp->first_block / 32;
+	free_extent_index *fe = group_index(gt, grp);
+
+	long bit = -1;
+	uint32_t start;
+	if (fext_alloc_best_fit(fe, *len, &start)) {
+		bit = start;
+	} else if (partial && fe->valid) {
+		uint32_t longest = fext_largest(fe, &start);
+		if ((longest > 0) && fext_reserve(fe, start, longest)) {
+			*len = longest;
+			bit = start;
+		}
+	}
+	// Fall back to scanning the bitmap if the index ran out of memory
+	if ((bit < 0) && !fe->valid) {
+		bit = bitmap_find_clear_run(slice, 0, grp->nblocks, *len);
+		if ((bit < 0) && partial) {
+			uint32_t longest = bitmap_longest_clear_run(slice, grp->nblocks, &start);
+			if (longest > 0) {
+				*len = longest;
+				bit = start;
+			}
+		}
+	}
+	if (bit >= 0) {
+		bitmap_set_range(slice, bit, *len);
+		grp->desc->free_blocks_count -= *len;
+	}
+	return bit;
+}
+
+long group_alloc_blocks(group_table *gt, uint32_t goal, uint32_t *len, bool partial)
+{
+	if (*len == 0) return -ENOSPC;
+	// First look for a run that holds everything, then settle for less
+	for (int pass = 0; pass < (partial ? 2 : 1); pass++) {
+		for (uint32_t i = 0; i < gt->count; i++) {
+			alloc_group *grp = &gt->groups[(goal + i) % gt->count];
+			pthread_mutex_lock(&grp->lock);
+			long bit = take_run(gt, grp, len, pass == 1);
+			pthread_mutex_unlock(&grp->lock);
+			if (bit >= 0) {
+				sb_count_add(&gt->sb->s_free_blocks_count, -(int)*len);
+				return grp->first_block + bit;
+			}
+		}
+	}
+	return -ENOSPC;
+}
+
+// Find the first free run of len blocks at or after goal (or, failing that,
+// anywhere) in a locked group, starting at a block aligned to align in the
+// image, and take it out of the index, leaving the bitmap to the caller; -1
+// if there is none. Alignment is only looked at if the index is valid.
+static long first_fit(group_table *gt, alloc_group *grp, uint32_t goal, uint32_t len, uint32_t align)
+{
+	free_extent_index *fe = group_index(gt, grp);
+	uint32_t start;
+	uint32_t offset = gt->sb->bg_data_block + grp->first_block;
+	if (fe->valid) return fext_alloc_aligned(fe, goal, len, align, offset, &start) ? (long)start : -1;
+	uint32_t *slice = gt->data_bitmap + grp->first_block / 32;
+	long bit = bitmap_find_clear_run(slice, goal, grp->nblocks, len);
+	return (bit >= 0) ? bit : bitmap_find_clear_run(slice, 0, grp->nblocks, len);
+}
+
+long group_alloc_near(group_table *gt, uint32_t near, uint32_t *len, bool partial)
+{
+	alloc_group *last = &gt->groups[gt->count - 1];
+	if ((*len == 0) || (near >= last->first_block + last->nblocks)) return -ENOSPC;
+	alloc_group *grp = &gt->groups[group_of_block(gt, near)];
+	uint32_t *slice = gt->data_bitmap + grp->first_block / 32;
+	uint32_t goal = near - grp->first_block;
+
+	pthread_mutex_lock(&grp->lock);
+	free_extent_index *fe = group_index(gt, grp);
+	long bit = -1;
+	// The blocks right at near, then the first run after it that holds them all
+	uint32_t limit = (*len < grp->nblocks - goal) ? goal + *len : grp->nblocks;
+	uint32_t n = bitmap_next_set(slice, goal, limit) - goal;
+	// Blocks in other files' reservation windows are clear in the bitmap, but
+	// not free in the index
+	if (fe->valid) n = fext_free_run(fe, goal, n);
+	if (((n == *len) || (partial && (n > 0))) && (!fe->valid || fext_reserve(fe, goal, n))) {
+		*len = n;
+		bit = goal;
+	} else {
+		bit = first_fit(gt, grp, goal, *len, 1);
+	}
+	if (bit >= 0) {
+		bitmap_set_range(slice, bit, *len);
+		grp->desc->free_blocks_count -= *len;
+	}
+	pthread_mutex_unlock(&grp->lock);
+
+	if (bit < 0) return -ENOSPC;
+	sb_count_add(&gt->sb->s_free_blocks_count, -(int)*len);
+	return grp->first_block + bit;
+}
+
+long group_alloc_from(group_table *gt, uint32_t goal, uint32_t len, uint32_t room, uint32_t align)
+{
+	alloc_group *last = &gt->groups[gt->count - 1];
+	if ((len == 0) || (goal >= last->first_block + last->nblocks)) return -ENOSPC;
+	uint32_t first = group_of_block(gt, goal);
+
+	for (uint32_t i = 0; i < gt->count; i++) {
+		alloc_group *grp = &gt->groups[(first + i) % gt->count];
+		pthread_mutex_lock(&grp->lock);
+		long bit = -1;
+		if (grp->desc->free_blocks_count >= room) {
+			bit = first_fit(gt, grp, (i == 0) ? goal - grp->first_block : 0, room, align);
+		}
+		if (bit >= 0) {
+			// Only the first len blocks are taken; the rest go back to the index
+			if (room > len) fext_free(&grp->free_blocks, bit + len, room - len);
+			bitmap_set_range(gt->data_bitmap + grp->first_block / 32, bit, len);
+			grp->desc->free_blocks_count -= len;
+		}
+		pthread_mutex_unlock(&grp->lock);
+		if (bit >= 0) {
+			sb_count_add(&gt->sb->s_free_blocks_count, -(int)len);
+			return grp->first_block + bit;
+		}
+	}
+	return -ENOSPC;
+}
+
+uint32_t group_data_goal(const group_table *gt, a1fs_ino_t ino)
+{
+	const alloc_group *grp = &gt->groups[group_of_inode(gt, ino)];
+	if (grp->ninodes == 0) return grp->first_block;
+	uint32_t span = A1FS_DIR_INODE_BLOCKS * gt->inodes_per_block;
+	uint32_t index = (ino - 1 - grp->first_inode) / span * span;
+	return grp->first_block + (uint32_t)((uint64_t)index * grp->nblocks / grp->ninodes);
+}
+
+long group_window_open(group_table *gt, uint32_t near, uint32_t *len, uint32_t align, uint32_t *gen)
+{
+	alloc_group *last = &gt->groups[gt->count - 1];
+	if ((*len == 0) || (near >= last->first_block + last->nblocks)) return -ENOSPC;
+	uint32_t first = group_of_block(gt, near);
+
+	// Look for a run that holds the whole window first, then settle for less
+	for (int pass = 0; pass < 2; pass++) {
+		for (uint32_t i = 0; i < gt->count; i++) {
+			alloc_group *grp = &gt->groups[(first + i) % gt->count];
+			uint32_t goal = (i == 0) ? near - grp->first_block : 0;
+			pthread_mutex_lock(&grp->lock);
+			free_extent_index *fe = group_index(gt, grp);
+			long bit = -1;
+			uint32_t start;
+			uint32_t *slice = gt->data_bitmap + grp->first_block / 32;
+			uint32_t limit = (*len < grp->nblocks - goal) ? goal + *len : grp->nblocks;
+			uint32_t n = (i == 0) ? bitmap_next_set(slice, goal, limit) - goal : 0;
+			// Not the blocks of another file's window (see group_alloc_near())
+			if (fe->valid) n = fext_free_run(fe, goal, n);
+			if (!fe->valid) {
+				// Windows need the index; leave the group to the allocator
+			} else if ((n > 0) && fext_reserve(fe, goal, n)) {
+				// Right at near, even if shorter, so that the file stays contiguous
+				*len = n;
+				bit = goal;
+			} else if (pass == 0) {
+				uint32_t offset = gt->sb->bg_data_block + grp->first_block;
+				if (fext_alloc_aligned(fe, goal, *len, align, offset, &start)) bit = start;
+			} else {
+				uint32_t longest = fext_largest(fe, &start);
+				if ((longest > 0) && fext_reserve(fe, start, longest)) {
+					*len = longest;
+					bit = start;
+				}
+			}
+			*gen = grp->index_gen;
+			pthread_mutex_unlock(&grp->lock);
+			if (bit >= 0) return grp->first_block + bit;
+		}
+	}
+	return -ENOSPC;
+}
+
+uint32_t group_window_claim(group_table *gt, uint32_t start, uint32_t len, uint32_t gen)
+{
+	alloc_group *grp = &gt->groups[group_of_block(gt, start)];
+	uint32_t *slice = gt->data_bitmap + grp->first_block / 32;
+	uint32_t bit = start - grp->first_block;
+
+	pthread_mutex_lock(&grp->lock);
+	uint32_t n = bitmap_next_set(slice, bit, bit + len) - bit;
+	// A rebuilt index has the window's blocks as free again
+	if (gen != grp->index_gen) fext_reserve(&grp->free_blocks, bit, n);
+	bitmap_set_range(slice, bit, n);
+	grp->desc->free_blocks_count -= n;
+	pthread_mutex_unlock(&grp->lock);
+	sb_count_add(&gt->sb->s_free_blocks_count, -(int)n);
+	return n;
+}
+
+void group_window_close(group_table *gt, uint32_t start, uint32_t len, uint32_t gen)
+{
+	alloc_group *grp = &gt->groups[group_of_block(gt, start)];
+	pthread_mutex_lock(&grp->lock);
+	if (gen == grp->index_gen) fext_free(&grp->free_blocks, start - grp->first_block, len);
+	pthread_mutex_unlock(&grp->lock);
+}
+
+void group_free_blocks(group_table *gt, uint32_t start, uint32_t count)
+{
+	while (count > 0) {
+		alloc_group *grp = &gt->groups[group_of_block(gt, start)];
+		uint32_t n = grp->first_block + grp->nblocks - start;
+		if (n > count) n = count;
+
+		pthread_mutex_lock(&grp->lock);
+		bitmap_clear_range(gt->data_bitmap, start, n);
+		fext_free(&grp->free_blocks, start - grp->first_block, n);
+		grp->desc->free_blocks_count += n;
+		pthread_mutex_unlock(&grp->lock);
+		sb_count_add(&gt->sb->s_free_blocks_count, n);
+
+		start += n;
+		count -= n;
+	}
+}
+
+bool group_reserve_blocks(group_table *gt, uint32_t count)
+{
+	uint32_t reserved = __atomic_load_n(&gt->reserved, __ATOMIC_RELAXED);
+	do {
+		uint32_t free_blocks = __atomic_load_n(&gt->sb->s_free_blocks_count, __ATOMIC_RELAXED);
+		if ((free_blocks < reserved) || (free_blocks - reserved < count)) return false;
+	} while (!__atomic_compare_exchange_n(&gt->reserved, &reserved, reserved + count, true,
+	                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return true;
+}
+
+void group_unreserve_blocks(group_table *gt, uint32_t count)
+{
+	__atomic_sub_fetch(&gt->reserved, count, __ATOMIC_RELAXED);
+}
+
+uint32_t group_avail_blocks(group_table *gt)
+{
+	uint32_t free_blocks = __atomic_load_n(&gt->sb->s_free_blocks_count, __ATOMIC_RELAXED);
+	uint32_t reserved = __atomic_load_n(&gt->reserved, __ATOMIC_RELAXED);
+	return (free_blocks > reserved) ? free_blocks - reserved : 0;
+}
+
+long group_alloc_inode(group_table *gt, uint32_t goal, a1fs_ino_t near, bool dir)
+{
+	for (uint32_t i = 0; i < gt->count; i++) {
+		uint32_t g = (goal + i) % gt->count;
+		alloc_group *grp = &gt->groups[g];
+		uint32_t from = (group_of_inode(gt, near) == g) ? near - 1 - grp->first_inode : 0;
+		long index = -1;
+		pthread_mutex_lock(&grp->lock);
+		if ((grp->desc->free_inodes_count > 0) && (i == 0)) {
+			if (dir) index = ialloc_alloc_block(&grp->inodes, from, A1FS_DIR_INODE_BLOCKS * gt->inodes_per_block);
+			if (dir && (index < 0)) index = ialloc_alloc_block(&grp->inodes, from, gt->inodes_per_block);
+			if (index < 0) index = ialloc_alloc_near(&grp->inodes, from);
+		} else if (grp->desc->free_inodes_count > 0) {
+			index = ialloc_alloc(&grp->inodes);
+		}
+		if (index >= 0) grp->desc->free_inodes_count--;
+		pthread_mutex_unlock(&grp->lock);
+		if (index >= 0) {
+			sb_count_add(&gt->sb->s_free_inodes_count, -1);
+			return grp->first_inode + index + 1;
+		}
+	}
+	return -ENOSPC;
+}
+
+void group_free_inode(group_table *gt, a1fs_ino_t ino)
+{
+	alloc_group *grp = &gt->groups[group_of_inode(gt, ino)];
+	pthread_mutex_lock(&grp->lock);
+	ialloc_free(&grp->inodes, ino - 1 - grp->first_inode);
+	grp->desc->free_inodes_count++;
+	pthread_mutex_unlock(&grp->lock);
+	sb_count_add(&gt->sb->s_free_inodes_count, 1);
+}
+
+void group_count_dir(group_table *gt, a1fs_ino_t ino, int delta)
+{
+	alloc_group *grp = &gt->groups[group_of_inode(gt, ino)];
+	pthread_mutex_lock(&grp->lock);
+	grp->ndirs += delta;
+	pthread_mutex_unlock(&grp->lock);
+}
+
+/** Snapshot of the counters of a group that directory placement looks at. */
+typedef struct group_stats {
+	uint32_t free_inodes, free_blocks, ndirs;
+} group_stats;
+
+static group_stats get_stats(alloc_group *grp)
+{
+	pthread_mutex_lock(&grp->lock);
+	group_stats st = { grp->desc->free_inodes_count, grp->desc->free_blocks_count, grp->ndirs };
+	pthread_mutex_unlock(&grp->lock);
+	return st;
+}
+
+uint32_t group_for_dir(group_table *gt, a1fs_ino_t parent)
+{
+	if (gt->count == 1) return 0;
+	uint32_t ndirs = 0;
+	for (uint32_t g = 0; g < gt->count; g++) ndirs += get_stats(&gt->groups[g]).ndirs;
+	uint32_t avg_inodes = __atomic_load_n(&gt->sb->s_free_inodes_count, __ATOMIC_RELAXED) / gt->count;
+	uint32_t avg_blocks = __atomic_load_n(&gt->sb->s_free_blocks_count, __ATOMIC_RELAXED) / gt->count;
+	uint32_t avg_dirs = ndirs / gt->count;
+
+	uint32_t start = __atomic_fetch_add(&gt->dir_rotor, 1, __ATOMIC_RELAXED);
+	if (parent == A1FS_ROOT_INO) {
+		// Spread top-level directories: the emptiest group with the most room
+		long best = -1;
+		group_stats best_st = {0};
+		for (uint32_t i = 0; i < gt->count; i++) {
+			uint32_t g = (start + i) % gt->count;
+			group_stats st = get_stats(&gt->groups[g]);
+			if ((st.free_inodes == 0) || (st.free_inodes < avg_inodes) || (st.free_blocks < avg_blocks)) continue;
+			if ((best < 0) || (st.ndirs < best_st.ndirs) ||
+			    ((st.ndirs == best_st.ndirs) && (st.free_blocks > best_st.free_blocks)))
+			{
+				best = g;
+				best_st = st;
+			}
+		}
+		if (best >= 0) return best;
+	} else {
+		// Keep subdirectories with their parent while its group has room
+		uint32_t max_dirs = avg_dirs + gt->inodes_per_group / 16;
+		uint32_t first = group_of_inode(gt, parent);
+		for (uint32_t i = 0; i < gt->count; i++) {
+			uint32_t g = (first + i) % gt->count;
+			group_stats st = get_stats(&gt->groups[g]);
+			if ((st.ndirs < max_dirs) && (st.free_inodes > 0) &&
+			    (st.free_inodes >= avg_inodes / 4) && (st.free_blocks >= avg_blocks / 4))
+			{
+				return g;
+			}
+		}
+	}
+
+	// Everything is crowded; any group with free inodes will do
+	for (uint32_t i = 0; i < gt->count; i++) {
+		uint32_t g = (start + i) % gt->count;
+		if (get_stats(&gt->groups[g]).free_inodes > 0) return g;
+	}
+	return start % gt->count;
+}
+
+void groups_report(group_table *gt, FILE *out)
+{
+	for (uint32_t g = 0; g < gt->count; g++) {
+		alloc_group *grp = &gt->groups[g];
+		if (grp->inodes.allocs == 0) continue;
+		fprintf(out, "group %u: %u free blocks, %u free inodes; ", g,
+		        grp->desc->free_blocks_count, grp->desc->free_inodes_count);
+		ialloc_report(&grp->inodes, out);
+	}
+}
@@ -0,0 +1,268 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Allocation groups header file.
+ *
+ * Runtime state of the allocation groups (see a1fs_group_desc). Each group has
+ * its own lock, free extent index and inode allocator over its slices of the
+ * data and inode bitmaps, so allocations in different groups neither contend
+ * nor scan each other's bitmaps. Allocations start in a goal group chosen by
+ * the caller and move on to the following groups only if it is full.
+ *
+ * Placement follows the Orlov allocator: top-level directories are spread
+ * over the groups with the most room and the fewest directories, other
+ * directories stay in their parent's group while it has room, and files go
+ * to their parent's group. Within a group a directory starts an unused inode
+ * table block that its entries' inodes then fill (see group_alloc_inode()),
+ * and each inode table block has its own stretch of the group's data blocks
+ * that the data of its inodes starts from (see group_data_goal()), so listing
+ * or walking a directory touches few inode table and data blocks.
+ *
+ * Images formatted without allocation groups are handled as a single group
+ * whose descriptor only lives in memory.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "a1fs.h"
+#include "free_extents.h"
+#include "inode_alloc.h"
+
+
+/** Number of unused inode table blocks a new directory's inode starts, if possible. */
+#define A1FS_DIR_INODE_BLOCKS 2
+
+/** Runtime state of an allocation group. */
+typedef struct alloc_group {
+	/** Protects the group's bitmap slices, descriptor, index and allocator. */
+	pthread_mutex_t lock;
+	/** Group descriptor. */
+	a1fs_group_desc *desc;
+	/** First data block of the group, relative to bg_data_block. */
+	uint32_t first_block;
+	/** Number of data blocks in the group. */
+	uint32_t nblocks;
+	/** First inode of the group, as an inode bitmap index. */
+	uint32_t first_inode;
+	/** Number of inodes in the group. */
+	uint32_t ninodes;
+	/** Number of directories in the group; counted at mount time. */
+	uint32_t ndirs;
+	/** Free runs of the group's data blocks, relative to first_block. */
+	free_extent_index free_blocks;
+	/** Number of times free_blocks was rebuilt from the bitmap. */
+	uint32_t index_gen;
+	/** Allocator of the group's inodes, relative to first_inode. */
+	inode_alloc inodes;
+} alloc_group;
+
+/** All allocation groups of a file system. */
+typedef struct group_table {
+	/** The superblock. */
+	a1fs_superblock *sb;
+	/** Data and inode bitmaps. */
+	uint32_t *data_bitmap, *inode_bitmap;
+	/** Groups. */
+	alloc_group *groups;
+	/** Number of groups. */
+	uint32_t count;
+	/** Data blocks and inodes per group (except maybe the last one). */
+	uint32_t blocks_per_group, inodes_per_group;
+	/** Number of inodes in an inode table block. */
+	uint32_t inodes_per_block;
+	/** Descriptor of an image formatted without groups; NULL otherwise. */
+	a1fs_group_desc *legacy_desc;
+	/** Group the search for a top-level directory's group starts at. */
+	uint32_t dir_rotor;
+	/** Free data blocks promised to delayed allocations (see delalloc.h). */
+	uint32_t reserved;
+} group_table;
+
+
+/**
+ * Set up the allocation groups of an image.
+ *
+ * @param gt     pointer to the group table to initialize.
+ * @param image  pointer to the start of the image.
+ * @return       true on success; false if out of memory.
+ */
+bool groups_init(group_table *gt, void *image);
+
+/** Free all memory owned by the group table. */
+void groups_destroy(group_table *gt);
+
+/** Get the group that owns a data block (relative to bg_data_block). */
+static inline uint32_t group_of_block(const group_table *gt, uint32_t block)
+{
+	return block / gt->blocks_per_group;
+}
+
+/** Get the group that owns an inode. */
+static inline uint32_t group_of_inode(const group_table *gt, a1fs_ino_t ino)
+{
+	return (ino - 1) / gt->inodes_per_group;
+}
+
+/**
+ * Allocate a run of free data blocks and mark it in the data bitmap.
+ *
+ * Takes the smallest free run that holds all *len blocks (best fit), looking
+ * at the goal group first. If no group has such a run and partial is true,
+ * takes the longest free run of the first group (from the goal on) that has
+ * any free blocks, and stores its length in *len.
+ *
+ * @param goal     preferred group.
+ * @param len      pointer to the number of blocks wanted/allocated.
+ * @param partial  whether a shorter run may be returned.
+ * @return         first block of the run, relative to bg_data_block;
+ *                 -ENOSPC if there is no suitable free run.
+ */
+long group_alloc_blocks(group_table *gt, uint32_t goal, uint32_t *len, bool partial);
+
+/**
+ * Allocate a run of free data blocks close to a given block, so that a file
+ * can grow in place: the blocks starting right at near if they are free (and
+ * not in a reservation window), or else the first free run that holds all
+ * *len blocks at or after near (or, failing that, anywhere) in near's group.
+ *
+ * @param near     preferred first block, relative to bg_data_block.
+ * @param len      pointer to the number of blocks wanted/allocated.
+ * @param partial  whether fewer blocks may be taken at near; the number
+ *                 taken is then stored in *len.
+ * @return         first block of the run, relative to bg_data_block;
+ *                 -ENOSPC if near's group has no suitable free run.
+ */
+long group_alloc_near(group_table *gt, uint32_t near, uint32_t *len, bool partial);
+
+/**
+ * Allocate a run of free data blocks starting the search at a goal block: the
+ * first len blocks of the first free run that holds room blocks at or after
+ * goal (or, failing that, anywhere) in goal's group, or else of the first such
+ * run in the following groups.
+ *
+ * @param goal   block to start from, relative to bg_data_block.
+ * @param len    number of blocks wanted.
+ * @param room   number of free blocks the run must have, at least len; the
+ *               ones past len are left free for the allocation to grow into.
+ * @param align  alignment of the first block in the image (e.g. to a huge
+ *               page), in blocks; 1 for none.
+ * @return       first block of the run, relative to bg_data_block; -ENOSPC if
+ *               there is no such run.
+ */
+long group_alloc_from(group_table *gt, uint32_t goal, uint32_t len, uint32_t room, uint32_t align);
+
+/**
+ * Get the block the data of an inode is placed from: the start of the stretch
+ * of its group's data blocks that belongs to the inode's inode table block.
+ *
+ * @return  block number relative to bg_data_block.
+ */
+uint32_t group_data_goal(const group_table *gt, a1fs_ino_t ino);
+
+/**
+ * Open a reservation window (see rsv.h): take a run of free data blocks out of
+ * a group's free extent index only, so that other allocations do not use it.
+ * The blocks stay free in the bitmap and the free counts until claimed with
+ * group_window_claim(). The run starts right at near if that block is free
+ * (and is then cut short by the first used block); otherwise it is the first
+ * run at or after near in near's group that holds all *len blocks (from a block
+ * aligned to align in the image), or else the first such run in the following
+ * groups, or else the longest run of the first group (from near's on) that has
+ * any free blocks.
+ *
+ * @param near   preferred first block, relative to bg_data_block.
+ * @param len    pointer to the number of blocks wanted/taken.
+ * @param align  alignment of a window that does not start at near, in blocks;
+ *               1 for none.
+ * @param gen    pointer to the variable that receives the index generation of
+ *               the window's group.
+ * @return       first block of the window, relative to bg_data_block; -ENOSPC
+ *               if there are no free blocks.
+ */
+long group_window_open(group_table *gt, uint32_t near, uint32_t *len, uint32_t align, uint32_t *gen);
+
+/**
+ * Allocate the first blocks of a reservation window. Blocks allocated by
+ * others in the meantime (if the index was rebuilt) end the claim early.
+ *
+ * @param start  first block of the window, relative to bg_data_block.
+ * @param len    number of blocks wanted.
+ * @param gen    index generation returned by group_window_open().
+ * @return       number of blocks allocated from start on.
+ */
+uint32_t group_window_claim(group_table *gt, uint32_t start, uint32_t len, uint32_t gen);
+
+/** Give the unclaimed blocks of a reservation window back to the index. */
+void group_window_close(group_table *gt, uint32_t start, uint32_t len, uint32_t gen);
+
+/**
+ * Release data blocks [start, start + count), relative to bg_data_block.
+ * The range may span groups.
+ */
+void group_free_blocks(group_table *gt, uint32_t start, uint32_t count);
+
+/**
+ * Reserve free data blocks for a later allocation. Reserved blocks stay free,
+ * but do not count as available for other allocations.
+ *
+ * @return  true on success; false if there are not enough available blocks.
+ */
+bool group_reserve_blocks(group_table *gt, uint32_t count);
+
+/** Give back blocks reserved with group_reserve_blocks(). */
+void group_unreserve_blocks(group_table *gt, uint32_t count);
+
+/** Get the number of free data blocks that are not reserved. */
+uint32_t group_avail_blocks(group_table *gt);
+
+/**
+ * Allocate a free inode, looking at the goal group first. In the goal group a
+ * directory gets the first inode of a wholly unused inode table block (at or
+ * after near if near is in the group) if there is one, and anything else the
+ * first free inode after near, so that a directory's entries share inode table
+ * blocks with it; other groups hand out any free inode.
+ *
+ * @param goal  preferred group.
+ * @param near  inode to allocate near, e.g. the parent directory.
+ * @param dir   whether the inode is for a directory.
+ * @return      the inode number; -ENOSPC if there are no free inodes.
+ */
+long group_alloc_inode(group_table *gt, uint32_t goal, a1fs_ino_t near, bool dir);
+
+/** Release an inode. */
+void group_free_inode(group_table *gt, a1fs_ino_t ino);
+
+/** Account for a directory created (delta 1) or deleted (delta -1). */
+void group_count_dir(group_table *gt, a1fs_ino_t ino, int delta);
+
+/**
+ * Pick the group for a new directory. A top-level directory goes to the group
+ * with the fewest directories among those with at least the average number
+ * of free inodes and blocks; any other directory goes to the first group,
+ * from its parent's on, that neither holds many more directories than the
+ * average nor is short of free inodes or blocks.
+ *
+ * @param parent  inode number of the parent directory.
+ * @return        the group.
+ */
+uint32_t group_for_dir(group_table *gt, a1fs_ino_t parent);
+
+/** Print per-group allocation statistics. */
+void groups_report(group_table *gt, FILE *out);
@@ -0,0 +1,127 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Inode allocator implementation.
+ */
+
+#include <time.h>
+
+#include "bitmap.h"
+#include "inode_alloc.h"
+
+
+void ialloc_init(inode_alloc *ia, uint32_t *bitmap, uint32_t ninodes)
+{
+	*ia = (inode_alloc){ .bitmap = bitmap, .ninodes = ninodes };
+}
+
+// Refill the cache with free indices found from the cursor onwards, wrapping
+// around to the start of the bitmap once
+static void refill(inode_alloc *ia)
+{
+	ia->head = ia->count = 0;
+	ia->refills++;
+
+	uint32_t pos = ia->cursor;
+	bool wrapped = false;
+	while (ia->count < A1FS_IALLOC_CACHE_SIZE) {
+		uint32_t limit = wrapped ? ia->cursor : ia->ninodes;
+		long bit = bitmap_next_clear(ia->bitmap, pos, limit);
+		if (bit < 0) {
+			if (wrapped || ia->cursor == 0) break;
+			wrapped = true;
+			pos = 0;
+			continue;
+		}
+		ia->cache[ia->count++] = bit;
+		pos = bit + 1;
+	}
+	ia->cursor = (pos < ia->ninodes) ? pos : 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Mark an inode as allocated and account for the time it took to find it
+static long take(inode_alloc *ia, uint32_t index, uint64_t start)
+{
+	bitmap_set(ia->bitmap, index);
+
+	uint64_t ns = now_ns() - start;
+	ia->allocs++;
+	ia->total_ns += ns;
+	if (ns > ia->max_ns) ia->max_ns = ns;
+	int bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+	ia->hist[(bucket < A1FS_IALLOC_HIST_SIZE) ? bucket : A1FS_IALLOC_HIST_SIZE - 1]++;
+	return index;
+}
+
+long ialloc_alloc(inode_alloc *ia)
+{
+	uint64_t start = now_ns();
+	for (;;) {
+		if (ia->head == ia->count) refill(ia);
+		if (ia->head == ia->count) return -1;
+
+		uint32_t index = ia->cache[ia->head++];
+		// Taken by ialloc_alloc_near() or ialloc_alloc_block() since the refill
+		if (!bitmap_test(ia->bitmap, index)) return take(ia, index, start);
+	}
+}
+
+long ialloc_alloc_near(inode_alloc *ia, uint32_t near)
+{
+	uint64_t start = now_ns();
+	if (near >= ia->ninodes) near = 0;
+	long index = bitmap_next_clear(ia->bitmap, near, ia->ninodes);
+	if ((index < 0) && (near > 0)) index = bitmap_next_clear(ia->bitmap, 0, near);
+	return (index < 0) ? -1 : take(ia, index, start);
+}
+
+long ialloc_alloc_block(inode_alloc *ia, uint32_t near, uint32_t count)
+{
+	uint64_t start = now_ns();
+	uint32_t nruns = ia->ninodes / count;
+	uint32_t first = (near / count < nruns) ? near / count : 0;
+	for (uint32_t i = 0; i < nruns; i++) {
+		uint32_t index = ((first + i) % nruns) * count;
+		if (bitmap_next_set(ia->bitmap, index, index + count) == index + count) {
+			return take(ia, index, start);
+		}
+	}
+	return -1;
+}
+
+void ialloc_free(inode_alloc *ia, uint32_t index)
+{
+	bitmap_clear(ia->bitmap, index);
+}
+
+void ialloc_report(const inode_alloc *ia, FILE *out)
+{
+	fprintf(out, "inode allocator: %lu allocations, %lu refills, "
+	        "avg %lu ns, max %lu ns\n", (unsigned long)ia->allocs,
+	        (unsigned long)ia->refills,
+	        (unsigned long)(ia->allocs ? ia->total_ns / ia->allocs : 0),
+	        (unsigned long)ia->max_ns);
+	for (int i = 0; i < A1FS_IALLOC_HIST_SIZE; i++) {
+		if (ia->hist[i] == 0) continue;
+		fprintf(out, "  < %10lu ns: %lu\n", 1ul << i, (unsigned long)ia->hist[i]);
+	}
+}
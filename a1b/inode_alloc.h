@@ -0,0 +1,111 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Inode allocator header file.
+ *
+ * Free inodes are handed out from a small cache of free inode bitmap indices
+ * that is refilled by word-at-a-time scans starting at a rotating cursor, so
+ * allocation does not rescan the inode bitmap from bit 0 every time and its
+ * cost stays flat as the inode table fills up.
+ *
+ * Inodes can also be asked for near a given index (see ialloc_alloc_near()
+ * and ialloc_alloc_block()), so that related inodes share inode table blocks;
+ * such allocations scan the bitmap directly, and cached indices taken by them
+ * are skipped when the cache hands them out.
+ *
+ * The allocator also keeps latency counters for allocations; they are printed
+ * on unmount in verbose mode.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/** Number of free inode indices kept in the allocator cache. */
+#define A1FS_IALLOC_CACHE_SIZE 64
+
+/** Number of buckets in the allocation latency histogram (powers of 2 ns). */
+#define A1FS_IALLOC_HIST_SIZE 32
+
+/** Inode allocator state. */
+typedef struct inode_alloc {
+	/** Inode bitmap. */
+	uint32_t *bitmap;
+	/** Number of inodes (bits in the bitmap). */
+	uint32_t ninodes;
+	/** Bitmap index at which the next refill scan starts. */
+	uint32_t cursor;
+	/** Cached free inode indices; entries [head, count) are valid. */
+	uint32_t cache[A1FS_IALLOC_CACHE_SIZE];
+	/** Index of the next cache entry to hand out. */
+	uint32_t head;
+	/** Number of filled cache entries. */
+	uint32_t count;
+
+	/** Number of successful allocations. */
+	uint64_t allocs;
+	/** Number of cache refills. */
+	uint64_t refills;
+	/** Total and maximum allocation latency in nanoseconds. */
+	uint64_t total_ns, max_ns;
+	/** Allocation latency histogram; bucket i counts latencies < 2^i ns. */
+	uint64_t hist[A1FS_IALLOC_HIST_SIZE];
+} inode_alloc;
+
+
+/**
+ * Initialize the inode allocator.
+ *
+ * @param ia       pointer to the allocator to initialize.
+ * @param bitmap   the inode bitmap.
+ * @param ninodes  number of inodes.
+ */
+void ialloc_init(inode_alloc *ia, uint32_t *bitmap, uint32_t ninodes);
+
+/**
+ * Allocate a free inode and mark it in the inode bitmap.
+ *
+ * @return  index of the inode in the inode bitmap (inode number - 1); -1 if
+ *          there are no free inodes.
+ */
+long ialloc_alloc(inode_alloc *ia);
+
+/**
+ * Allocate the first free inode at or after near, wrapping around to the start
+ * of the bitmap, and mark it in the inode bitmap.
+ *
+ * @return  index of the inode in the inode bitmap; -1 if there are no free
+ *          inodes.
+ */
+long ialloc_alloc_near(inode_alloc *ia, uint32_t near);
+
+/**
+ * Allocate the first inode of an aligned run of count inodes (e.g. the inodes
+ * of an inode table block) that are all free, looking at or after near first,
+ * and mark it in the inode bitmap.
+ *
+ * @return  index of the inode in the inode bitmap; -1 if every such run has
+ *          inodes in use.
+ */
+long ialloc_alloc_block(inode_alloc *ia, uint32_t near, uint32_t count);
+
+/** Mark the inode at the given bitmap index as free. */
+void ialloc_free(inode_alloc *ia, uint32_t index);
+
+/** Print allocation counters and the latency histogram. */
+void ialloc_report(const inode_alloc *ia, FILE *out);
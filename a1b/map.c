@@ -17,6 +17,7 @@
  */
 
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -26,7 +27,29 @@
 #include "util.h"
 
 
-void *map_file(const char *path, size_t block_size, size_t *size)
+// Map size bytes of a file at an address aligned to A1FS_HUGE_PAGE_SIZE, by
+// reserving enough address space to contain an aligned range and mapping the
+// file over that range
+static void *mmap_huge(int fd, size_t size)
+{
+	size_t span = size + A1FS_HUGE_PAGE_SIZE;
+	char *area = mmap(NULL, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (area == MAP_FAILED) return MAP_FAILED;
+	char *start = (char *)align_up((uintptr_t)area, A1FS_HUGE_PAGE_SIZE);
+	void *addr = mmap(start, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	if (addr == MAP_FAILED) {
+		munmap(area, span);
+		return MAP_FAILED;
+	}
+	// Give back the unused parts of the reservation
+	if (start > area) munmap(area, start - area);
+	if (start + size < area + span) munmap(start + size, area + span - (start + size));
+
+	if (madvise(addr, size, MADV_HUGEPAGE) < 0) perror("madvise(MADV_HUGEPAGE)");
+	return addr;
+}
+
+void *map_file(const char *path, size_t block_size, size_t *size, bool huge)
 {
 	// Open the file for reading and writing
 	int fd = open(path, O_RDWR);
@@ -54,7 +77,11 @@ void *map_file(const char *path, size_t block_size, size_t *size)
 	}
 
 	// Map file contents into memory
-	addr = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (huge) {
+		addr = mmap_huge(fd, s.st_size);
+	} else {
+		addr = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
 	if (addr == MAP_FAILED) {
 		perror("mmap");
 		addr = NULL;
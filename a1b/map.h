@@ -18,18 +18,29 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 
 
+/** Size of a transparent huge page. */
+#define A1FS_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 /**
  * Map the whole file into memory for reading and writing.
  *
  * File size must be a non-zero multiple of the block_size.
  *
+ * In huge page mode the mapping starts at a multiple of A1FS_HUGE_PAGE_SIZE,
+ * so that aligned 2 MiB ranges of the file are aligned in memory too, and is
+ * marked with madvise(MADV_HUGEPAGE). Whether the kernel then backs it with
+ * huge pages depends on the file system the image is on (e.g. tmpfs mounted
+ * with huge=advise); failing to set the advice is not an error.
+ *
  * @param path        image file path.
  * @param block_size  file system block size.
  * @param size        pointer to the variable that will be set to file size.
+ * @param huge        whether to map the file for huge pages.
  * @return            pointer to the file mapping in memory on success;
  *                    NULL on failure.
  */
-void *map_file(const char *path, size_t block_size, size_t *size);
+void *map_file(const char *path, size_t block_size, size_t *size, bool huge);
@@ -21,11 +21,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/random.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
 
 #include "a1fs.h"
+#include "bitmap.h"
 #include "map.h"
 
 /** Command line options. */
@@ -45,6 +47,12 @@ typedef struct mkfs_opts {
 	bool verbose;
 	/** Zero out image contents. */
 	bool zero;
+	/** Optional features to enable (A1FS_FEATURE_*). */
+	uint32_t features;
+	/** Data blocks per allocation group; 0 selects the default. */
+	size_t blocks_per_group;
+	/** Inode size in bytes; 0 selects the default. */
+	size_t inode_size;
 
 } mkfs_opts;
 
@@ -56,12 +64,6 @@ int ceil_divide(int x, int y) {
 	return result;	
 }
 
-// Set the i-th index of the bitmap to 1
-void setBitOn(uint32_t *A, uint32_t i) {
-	int int_bits = sizeof(uint32_t) * 8;
-	A[i/int_bits] |= 1 << (i%int_bits);
-}
-
 static const char *help_str = "\
 Usage: %s options image\n\
 \n\
@@ -70,25 +72,71 @@ its size must be a multiple of a1fs block size - %zu bytes.\n\
 \n\
 Options:\n\
     -i num  number of inodes; required argument\n\
+    -g num  data blocks per allocation group, a multiple of 64\n\
+            (default %d)\n\
+    -I num  inode size in bytes with inline_extents or inline_data,\n\
+            a power of 2 (default %d)\n\
     -h      print help and exit\n\
     -f      force format - overwrite existing a1fs file system\n\
     -s      sync image file contents to disk\n\
     -v      verbose output\n\
     -z      zero out image contents\n\
+    -O list enable optional features (comma-separated):\n\
+              dir_index       hash-index directories larger than one block\n\
+              compact_dirent  variable length directory entries\n\
+              inline_extents  large inodes that hold the first extents\n\
+              inline_data     large inodes that hold the data of small files\n\
+              tail_packing    pack small files into shared blocks\n\
 ";
 
+/** Names of the optional features accepted by -O. */
+static const struct {
+	const char *name;
+	uint32_t flag;
+} features[] = {
+	{ "dir_index"     , A1FS_FEATURE_DIR_INDEX      },
+	{ "compact_dirent", A1FS_FEATURE_COMPACT_DIRENT },
+	{ "inline_extents", A1FS_FEATURE_INLINE_EXTENTS },
+	{ "inline_data"   , A1FS_FEATURE_INLINE_DATA    },
+	{ "tail_packing"  , A1FS_FEATURE_TAIL_PACKING   },
+};
+
+// Parse a comma-separated list of feature names into feature flags
+static bool parse_features(const char *list, uint32_t *flags)
+{
+	char buf[strlen(list) + 1];
+	strcpy(buf, list);
+	for (char *name = strtok(buf, ","); name != NULL; name = strtok(NULL, ",")) {
+		size_t i;
+		for (i = 0; i < sizeof(features) / sizeof(features[0]); i++) {
+			if (strcmp(name, features[i].name) == 0) break;
+		}
+		if (i == sizeof(features) / sizeof(features[0])) {
+			fprintf(stderr, "Unknown feature: %s\n", name);
+			return false;
+		}
+		*flags |= features[i].flag;
+	}
+	return true;
+}
+
 static void print_help(FILE *f, const char *progname)
 {
-	fprintf(f, help_str, progname, A1FS_BLOCK_SIZE);
+	fprintf(f, help_str, progname, A1FS_BLOCK_SIZE, A1FS_BLOCKS_PER_GROUP, A1FS_LARGE_INODE_SIZE);
 }
 
 
 static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 {
 	char o;
-	while ((o = getopt(argc, argv, "i:hfsvz")) != -1) {
+	while ((o = getopt(argc, argv, "i:g:I:hfsvzO:")) != -1) {
 		switch (o) {
 			case 'i': opts->n_inodes = strtoul(optarg, NULL, 10); break;
+			case 'g': opts->blocks_per_group = strtoul(optarg, NULL, 10); break;
+			case 'I': opts->inode_size = strtoul(optarg, NULL, 10); break;
+			case 'O':
+				if (!parse_features(optarg, &opts->features)) return false;
+				break;
 
 			case 'h': opts->help    = true; return true;// skip other arguments
 			case 'f': opts->force   = true; break;
@@ -111,6 +159,22 @@ static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 		fprintf(stderr, "Missing or invalid number of inodes\n");
 		return false;
 	}
+	if (opts->blocks_per_group == 0) {
+		opts->blocks_per_group = A1FS_BLOCKS_PER_GROUP;
+	} else if (opts->blocks_per_group % 64 != 0) {
+		fprintf(stderr, "Invalid number of blocks per group\n");
+		return false;
+	}
+	bool large_inodes = (opts->features & (A1FS_FEATURE_INLINE_EXTENTS | A1FS_FEATURE_INLINE_DATA)) != 0;
+	if (opts->inode_size == 0) {
+		opts->inode_size = large_inodes ? A1FS_LARGE_INODE_SIZE : sizeof(a1fs_inode);
+	} else if (!large_inodes || (opts->inode_size <= sizeof(a1fs_inode)) ||
+	           (opts->inode_size > A1FS_BLOCK_SIZE / 2) ||
+	           ((opts->inode_size & (opts->inode_size - 1)) != 0))
+	{
+		fprintf(stderr, "Invalid inode size\n");
+		return false;
+	}
 	return true;
 }
 
@@ -125,6 +189,18 @@ static bool a1fs_is_present(void *image)
 }
 
 
+// Pick a random non-zero name hash seed
+static uint32_t hash_seed(void)
+{
+	uint32_t seed = 0;
+	if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		seed = (uint32_t)now.tv_nsec ^ (uint32_t)now.tv_sec ^ ((uint32_t)getpid() << 16);
+	}
+	return (seed != 0) ? seed : 1;
+}
+
 /**
  * Format the image into a1fs.
  *
@@ -141,54 +217,78 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	int num_block = size / A1FS_BLOCK_SIZE;
 	int num_inode_bm = ceil_divide(opts->n_inodes, BITS_PER_BLOCK);
 	int num_data_bm = ceil_divide(num_block, BITS_PER_BLOCK);
-	int num_inode_t = ceil_divide(opts->n_inodes * sizeof(a1fs_inode), A1FS_BLOCK_SIZE);
-	int used_blocks = num_inode_t + num_data_bm + num_inode_bm + 1; // 1 block for superblock
-	if (used_blocks > num_block || opts->n_inodes < 1) {
+	int inode_size = opts->inode_size;
+	int num_inode_t = ceil_divide(opts->n_inodes * inode_size, A1FS_BLOCK_SIZE);
+	int bpg = opts->blocks_per_group;
+	int num_gd = ceil_divide(ceil_divide(num_block, bpg) * sizeof(a1fs_group_desc), A1FS_BLOCK_SIZE);
+	int used_blocks = num_inode_t + num_data_bm + num_inode_bm + num_gd + 1; // 1 block for superblock
+	if (used_blocks >= num_block || opts->n_inodes < 1) {
 		return false;
 	}
+	int num_data = num_block - used_blocks;
+	int num_groups = ceil_divide(num_data, bpg);
+	// Spread the inodes evenly, keeping each group's slice 64-bit aligned
+	int ipg = ceil_divide(ceil_divide(opts->n_inodes, num_groups), 64) * 64;
 	a1fs_superblock * sb = (struct a1fs_superblock *)(image);
+	// fields this mkfs does not set must read as 0 (see fs_ctx_init())
+	memset(sb, 0, A1FS_BLOCK_SIZE);
 	sb->magic = A1FS_MAGIC;
 	sb->size = size;
 	sb->s_inodes_count = opts->n_inodes;
 	sb->s_blocks_count = num_block;
-	sb->s_free_blocks_count = num_block - 1 - num_inode_bm - num_data_bm - num_inode_t;
+	sb->s_free_blocks_count = num_data;
 	sb->s_free_inodes_count = opts->n_inodes;
-	sb->bg_block_bitmap = (a1fs_blk_t) (1);
+	sb->bg_group_desc = (a1fs_blk_t) (1);
+	sb->s_groups_count = num_groups;
+	sb->s_blocks_per_group = bpg;
+	sb->s_inodes_per_group = ipg;
+	sb->bg_block_bitmap = (a1fs_blk_t) (1 + num_gd);
 	sb->block_bitmap_count = num_data_bm;
-	sb->bg_inode_bitmap = (a1fs_blk_t) (1 + num_data_bm);
+	sb->bg_inode_bitmap = (a1fs_blk_t) (1 + num_gd + num_data_bm);
 	sb->inode_bitmap_count = num_inode_bm;
-	sb->bg_inode_table = (a1fs_blk_t) (1 + num_data_bm + num_inode_bm);
+	sb->bg_inode_table = (a1fs_blk_t) (1 + num_gd + num_data_bm + num_inode_bm);
 	sb->inode_table_count = num_inode_t;
-	sb->bg_data_block = (a1fs_blk_t) (1 + num_data_bm + num_inode_bm + num_inode_t);
-	sb->data_block_count = num_block - 1 - num_data_bm - num_inode_bm - num_inode_t;
-	int j,i;
-	int num_int_bits = sizeof(int) * 8;
-	// data block bitmap
-	for (j = 0; j < num_data_bm; j++) {
-		uint32_t *data_bits = (uint32_t *) (image + A1FS_BLOCK_SIZE * (j + 1));
-		// Just fill the entire table with 0 bits, who cares overkill lol
-		for (i = 0; i < BITS_PER_BLOCK; i += num_int_bits){
-			*(data_bits + i) = 0; // int 0 = 32 zero bits
-		}
-	}
-	// inode bitmap
-	for (j = 0; j < num_inode_bm; j++) {
-		uint32_t *inode_bits = (uint32_t *) (image + A1FS_BLOCK_SIZE * (j + 1 + num_data_bm));
-		for (i = 0; i < BITS_PER_BLOCK; i += num_int_bits){
-			*(inode_bits + i) = 0;
-		}
+	sb->bg_data_block = (a1fs_blk_t) used_blocks;
+	sb->data_block_count = num_data;
+	sb->s_features = opts->features | A1FS_FEATURE_DIR_SIZE;
+	sb->s_hash_seed = hash_seed();
+	sb->s_inode_size = inode_size;
+
+	// allocation groups; the last one gets what is left
+	a1fs_group_desc *gd = (a1fs_group_desc *) (image + A1FS_BLOCK_SIZE * sb->bg_group_desc);
+	memset(gd, 0, (size_t)A1FS_BLOCK_SIZE * num_gd);
+	for (int g = 0; g < num_groups; g++) {
+		int blocks = num_data - g * bpg;
+		int inodes = (int)opts->n_inodes - g * ipg;
+		gd[g].free_blocks_count = (blocks < bpg) ? blocks : bpg;
+		gd[g].free_inodes_count = (inodes < 0) ? 0 : (inodes < ipg) ? inodes : ipg;
 	}
-	
+	// data block and inode bitmaps start out empty
+	memset(image + A1FS_BLOCK_SIZE * sb->bg_block_bitmap, 0,
+	       (size_t)A1FS_BLOCK_SIZE * (num_data_bm + num_inode_bm));
+
 	// change root inode to '1'
 	uint32_t *inode_bits = (uint32_t *) (image + A1FS_BLOCK_SIZE * (sb->bg_inode_bitmap));
-	setBitOn(inode_bits, 0);
+	bitmap_set(inode_bits, 0);
 	sb->s_free_inodes_count--;
+	gd[0].free_inodes_count--;
 	a1fs_inode * root_inode = (a1fs_inode *) (image + A1FS_BLOCK_SIZE * (sb->bg_inode_table));
 	root_inode->mode = __S_IFDIR | 0777;
 	root_inode->links = 2;
 	root_inode->size = 0;
 	clock_gettime(CLOCK_REALTIME, &(root_inode->mtime));
-	root_inode->dentry_count = 0;
+	root_inode->extentcount = 0;
+	root_inode->entry_count = 0;
+	root_inode->flags = 0;
+	root_inode->frag_offset = 0;
+	root_inode->hint_size_order = 0;
+	root_inode->hint_contig = 0;
+	root_inode->hint_group = 0;
+	root_inode->hole_blocks = 0;
+	memset(a1fs_inode_extents(root_inode), 0, inode_size - sizeof(a1fs_inode));
+	if (opts->features & A1FS_FEATURE_INLINE_EXTENTS) {
+		root_inode->flags = A1FS_INODE_INLINE_EXTENTS;
+	}
 	return true; 
 }
 
@@ -209,7 +309,7 @@ int main(int argc, char *argv[])
 
 	// Map image file into memory
 	size_t size;
-	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size);
+	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size, false);
 	if (image == NULL) return 1;
 
 	// Check if overwriting existing file system
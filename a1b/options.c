@@ -35,8 +35,13 @@ static const struct fuse_opt opt_spec[] = {
 	A1FS_OPT("-V"       , version),
 	A1FS_OPT("--version", version),
 
-	A1FS_OPT("--sync"   , sync   ),
-	A1FS_OPT("--verbose", verbose),
+	A1FS_OPT("--sync"      , sync         ),
+	A1FS_OPT("--verbose"   , verbose      ),
+	A1FS_OPT("--mt"        , multithreaded),
+	A1FS_OPT("--nodelalloc", nodelalloc   ),
+	A1FS_OPT("--hugepages" , hugepages    ),
+
+	{ "--dcache=%u", offsetof(a1fs_opts, dcache_size), 0 },
 
 	FUSE_OPT_END
 };
@@ -45,7 +50,7 @@ static const char *help_str = "\
 Usage: %s image dir [options]\n\
 \n\
 Mount a1fs image file at given mount point. Use fusermount(1) to unmount.\n\
-Only single-threaded mount is supported; -s FUSE option is implied.\n\
+The mount is single-threaded (-s FUSE option is implied) unless --mt is given.\n\
 \n\
 general options:\n\
     -o opt,[opt...]        mount options\n\
@@ -54,7 +59,14 @@ general options:\n\
 \n\
 a1fs options:\n\
     --sync                 sync image file contents to disk on unmount\n\
-    --verbose              verbose output; only useful in foreground mode (-f)\n\
+    --verbose              verbose output, including allocator statistics on\n\
+                           unmount; only useful in foreground mode (-f)\n\
+    --mt                   serve requests from multiple threads\n\
+    --dcache=KB            dentry cache memory budget in KiB (default 4096)\n\
+    --nodelalloc           allocate blocks as data is written instead of\n\
+                           buffering it until the file is closed or synced\n\
+    --hugepages            map the image for transparent huge pages and align\n\
+                           the extents of files of 2 MiB or more to them\n\
 \n\
 ";
 
@@ -91,7 +103,9 @@ bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts)
 		return false;
 	}
 
-	// Only single-threaded mount is supported
-	fuse_opt_add_arg(args, "-s");
+	// Single-threaded unless asked otherwise
+	if (!opts->multithreaded) {
+		fuse_opt_add_arg(args, "-s");
+	}
 	return true;
 }
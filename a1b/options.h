@@ -38,6 +38,15 @@ typedef struct a1fs_opts {
 	/** Verbose output. Only print logging/debug info if this flag is set. */
 	int verbose;
 
+	/** Serve requests from multiple threads instead of implying -s. */
+	int multithreaded;
+	/** Dentry cache memory budget in KiB; 0 selects the default. */
+	unsigned int dcache_size;
+	/** Allocate blocks on every write instead of on flush. */
+	int nodelalloc;
+	/** Map the image for huge pages and align large files' extents to them. */
+	int hugepages;
+
 } a1fs_opts;
 
 /**
@@ -0,0 +1,165 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Block reservation windows implementation.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "rsv.h"
+#include "util.h"
+
+
+static rsv_window **bucket(rsv_table *rt, a1fs_ino_t ino)
+{
+	return &rt->buckets[ino & (rt->nbuckets - 1)];
+}
+
+// Give the rest of a window back to its group
+static void close_window(rsv_table *rt, rsv_window *w)
+{
+	if (w->len > 0) group_window_close(rt->groups, w->start, w->len, w->gen);
+	w->len = 0;
+}
+
+bool rsv_init(rsv_table *rt, group_table *groups, size_t nbuckets)
+{
+	assert(is_powerof2(nbuckets));
+	rt->groups = groups;
+	rt->buckets = calloc(nbuckets, sizeof(rsv_window *));
+	rt->nbuckets = nbuckets;
+	rt->count = 0;
+	pthread_mutex_init(&rt->lock, NULL);
+	return rt->buckets != NULL;
+}
+
+void rsv_destroy(rsv_table *rt)
+{
+	if (rt->buckets == NULL) return;
+	for (size_t i = 0; i < rt->nbuckets; i++) {
+		while (rt->buckets[i] != NULL) {
+			rsv_window *w = rt->buckets[i];
+			rt->buckets[i] = w->next;
+			free(w);
+		}
+	}
+	free(rt->buckets);
+	rt->buckets = NULL;
+	pthread_mutex_destroy(&rt->lock);
+}
+
+// Find the window of an inode, adding an empty one if it has none
+static rsv_window *get_window(rsv_table *rt, a1fs_ino_t ino)
+{
+	rsv_window *w = *bucket(rt, ino);
+	while ((w != NULL) && (w->ino != ino)) w = w->next;
+	if (w != NULL) return w;
+	w = calloc(1, sizeof(rsv_window));
+	if (w == NULL) return NULL;
+	w->ino = ino;
+	w->size = A1FS_RSV_MIN_BLOCKS;
+	w->next = *bucket(rt, ino);
+	*bucket(rt, ino) = w;
+	rt->count++;
+	return w;
+}
+
+// Open a new window of at least len blocks at (or after) near
+static bool open_window(rsv_table *rt, rsv_window *w, uint32_t near, uint32_t len, uint32_t align)
+{
+	uint32_t size = (len > w->size) ? len : w->size;
+	long start = group_window_open(rt->groups, near, &size, align, &w->gen);
+	if (start < 0) return false;
+	w->start = start;
+	w->len = size;
+	if (w->size < A1FS_RSV_MAX_BLOCKS) w->size *= 2;
+	return true;
+}
+
+long rsv_alloc(rsv_table *rt, a1fs_ino_t ino, uint32_t near, uint32_t *len,
+               uint32_t align, uint32_t hint)
+{
+	pthread_mutex_lock(&rt->lock);
+	rsv_window *w = get_window(rt, ino);
+	if (w == NULL) {
+		pthread_mutex_unlock(&rt->lock);
+		return -ENOSPC;
+	}
+
+	// The file grew somewhere else (e.g. it was truncated)
+	if ((w->len > 0) && (w->start != near)) close_window(rt, w);
+	if ((w->len == 0) && !open_window(rt, w, near, (*len > hint) ? *len : hint, align)) {
+		pthread_mutex_unlock(&rt->lock);
+		return -ENOSPC;
+	}
+
+	uint32_t n = (*len < w->len) ? *len : w->len;
+	uint32_t claimed = group_window_claim(rt->groups, w->start, n, w->gen);
+	long start = w->start;
+	w->start += claimed;
+	w->len -= claimed;
+	// Some of the window was taken by someone else; it is of no use anymore
+	if (claimed < n) close_window(rt, w);
+	pthread_mutex_unlock(&rt->lock);
+
+	if (claimed == 0) return -ENOSPC;
+	*len = claimed;
+	return start;
+}
+
+void rsv_reserve(rsv_table *rt, a1fs_ino_t ino, uint32_t near, uint32_t len)
+{
+	pthread_mutex_lock(&rt->lock);
+	rsv_window *w = get_window(rt, ino);
+	if (w != NULL) {
+		close_window(rt, w);
+		open_window(rt, w, near, len, 1);
+	}
+	pthread_mutex_unlock(&rt->lock);
+}
+
+void rsv_release(rsv_table *rt, a1fs_ino_t ino)
+{
+	pthread_mutex_lock(&rt->lock);
+	rsv_window **prev = bucket(rt, ino);
+	while ((*prev != NULL) && ((*prev)->ino != ino)) prev = &(*prev)->next;
+	rsv_window *w = *prev;
+	if (w != NULL) {
+		close_window(rt, w);
+		*prev = w->next;
+		rt->count--;
+		free(w);
+	}
+	pthread_mutex_unlock(&rt->lock);
+}
+
+bool rsv_release_all(rsv_table *rt)
+{
+	bool any = false;
+	pthread_mutex_lock(&rt->lock);
+	for (size_t i = 0; (rt->count > 0) && (i < rt->nbuckets); i++) {
+		while (rt->buckets[i] != NULL) {
+			rsv_window *w = rt->buckets[i];
+			any = any || (w->len > 0);
+			close_window(rt, w);
+			rt->buckets[i] = w->next;
+			rt->count--;
+			free(w);
+		}
+	}
+	pthread_mutex_unlock(&rt->lock);
+	return any;
+}
@@ -0,0 +1,137 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Block reservation windows header file.
+ *
+ * A file that is being appended to gets a reservation window: a run of free
+ * blocks right after its last extent that is taken out of the free extent
+ * index of its group (see group_window_open()), so that other files'
+ * allocations go elsewhere, while the blocks stay free in the bitmap and the
+ * free counts. The file's next allocations are taken from the front of its
+ * window, so concurrent streaming writers each grow a long extent instead of
+ * interleaving their blocks. A window that runs out is replaced by one twice
+ * as large, up to A1FS_RSV_MAX_BLOCKS.
+ *
+ * Windows are soft: they are closed, and their blocks given back to the
+ * index, when the file is released or deleted, when it grows somewhere else,
+ * and all at once when an allocation would otherwise fail for lack of space.
+ * Nothing about them is stored on disk.
+ *
+ * The table lock is taken after inode locks and before allocation group
+ * locks.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+#include "groups.h"
+
+
+/** Size of the first reservation window of a file, in blocks. */
+#define A1FS_RSV_MIN_BLOCKS 64
+/** Largest reservation window, in blocks. */
+#define A1FS_RSV_MAX_BLOCKS 2048
+
+/** Reservation window of an inode. */
+typedef struct rsv_window {
+	/** Next window in the hash bucket. */
+	struct rsv_window *next;
+	/** Inode number the window belongs to. */
+	a1fs_ino_t ino;
+	/** Remaining blocks of the window, relative to bg_data_block. */
+	uint32_t start, len;
+	/** Size of the next window opened for the inode. */
+	uint32_t size;
+	/** Free extent index generation of the window's group when opened. */
+	uint32_t gen;
+} rsv_window;
+
+/** Reservation windows of all inodes, indexed by inode number. */
+typedef struct rsv_table {
+	/** Allocation groups the windows are taken from. */
+	group_table *groups;
+	/** Hash buckets. */
+	rsv_window **buckets;
+	/** Number of hash buckets, a power of 2. */
+	size_t nbuckets;
+	/** Number of windows. */
+	size_t count;
+	/** Protects the buckets, the count and the windows. */
+	pthread_mutex_t lock;
+} rsv_table;
+
+
+/**
+ * Initialize a reservation window table.
+ *
+ * @param rt        pointer to the table to initialize.
+ * @param groups    allocation groups of the file system.
+ * @param nbuckets  number of hash buckets, a power of 2.
+ * @return          true on success; false if out of memory.
+ */
+bool rsv_init(rsv_table *rt, group_table *groups, size_t nbuckets);
+
+/** Free all memory owned by the table; the windows are not closed. */
+void rsv_destroy(rsv_table *rt);
+
+/**
+ * Allocate blocks for an inode from its reservation window, opening a new
+ * window at (or after) near if the inode has none or its window does not
+ * start at near.
+ *
+ * @param rt     the table.
+ * @param ino    inode number.
+ * @param near   block right after the inode's last extent, relative to
+ *               bg_data_block.
+ * @param len    pointer to the number of blocks wanted/allocated; fewer may
+ *               be allocated if the window is shorter.
+ * @param align  alignment of a new window that cannot start at near (see
+ *               group_window_open()); 1 for none.
+ * @param hint   number of blocks the inode is expected to grow by (e.g. from
+ *               an allocation hint); a new window is made at least this large.
+ *               0 for none.
+ * @return       first block allocated, relative to bg_data_block; -ENOSPC if
+ *               no window could be opened.
+ */
+long rsv_alloc(rsv_table *rt, a1fs_ino_t ino, uint32_t near, uint32_t *len,
+               uint32_t align, uint32_t hint);
+
+/**
+ * Open a reservation window for an inode ahead of its allocations, e.g. for
+ * the size it is expected to grow to, replacing the window it has. Nothing
+ * happens if no window can be opened.
+ *
+ * @param rt    the table.
+ * @param ino   inode number.
+ * @param near  block right after the inode's last extent, relative to
+ *              bg_data_block.
+ * @param len   number of blocks wanted.
+ */
+void rsv_reserve(rsv_table *rt, a1fs_ino_t ino, uint32_t near, uint32_t len);
+
+/** Close the reservation window of an inode, if it has one. */
+void rsv_release(rsv_table *rt, a1fs_ino_t ino);
+
+/**
+ * Close all reservation windows.
+ *
+ * @return  true if there were any windows to close.
+ */
+bool rsv_release_all(rsv_table *rt);
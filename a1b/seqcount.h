@@ -0,0 +1,73 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Sequence counters.
+ *
+ * A sequence counter lets readers look at data without taking its lock.
+ * Writers (serialized by a lock of their own) make the counter odd while they
+ * modify the data; a reader samples the counter before and after reading and
+ * throws the result away if the counter was odd or has changed in between.
+ * Readers never write to shared memory, so they do not bounce cache lines
+ * between cores.
+ *
+ * Data read under a sequence counter may be torn, so readers must only copy
+ * it and not act on it before seqcount_read_retry() has validated the copy.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** A sequence counter; 0 is a valid initial value. */
+typedef uint32_t seqcount;
+
+/**
+ * Start a read section.
+ *
+ * @return  the counter value to pass to seqcount_read_retry(); odd if a
+ *          writer is active, in which case the read is bound to be retried.
+ */
+static inline uint32_t seqcount_read_begin(const seqcount *sc)
+{
+	return __atomic_load_n(sc, __ATOMIC_ACQUIRE);
+}
+
+/** End a read section; true if the data read since begin must be discarded. */
+static inline bool seqcount_read_retry(const seqcount *sc, uint32_t start)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return ((start & 1) != 0) || (__atomic_load_n(sc, __ATOMIC_RELAXED) != start);
+}
+
+/** Start modifying the data; the caller holds the writers' lock. */
+static inline void seqcount_write_begin(seqcount *sc)
+{
+	__atomic_store_n(sc, *sc + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/** Finish modifying the data. */
+static inline void seqcount_write_end(seqcount *sc)
+{
+	__atomic_store_n(sc, *sc + 1, __ATOMIC_RELEASE);
+}
+
+/** Check if a writer is active; only meaningful to the writers themselves. */
+static inline bool seqcount_writing(const seqcount *sc)
+{
+	return (__atomic_load_n(sc, __ATOMIC_RELAXED) & 1) != 0;
+}
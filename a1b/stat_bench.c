@@ -0,0 +1,140 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Multi-threaded stat benchmark.
+ *
+ * Measures stat() throughput on a mounted file system (mount it with --mt)
+ * with 1, 2, 4, ... threads, each stat-ing random files of a small directory
+ * tree, and reports how well lookups scale with the number of threads.
+ *
+ * Usage: stat_bench directory [max threads] [seconds per run]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// Size of the directory tree: DIRS directories of FILES files each
+#define DIRS 16
+#define FILES 64
+
+static char paths[DIRS * FILES][4096];
+static volatile bool stop;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Create the directory tree under root, reusing what is already there
+static bool make_tree(const char *root)
+{
+	char dir[4096];
+	snprintf(dir, sizeof(dir), "%s/stat_bench", root);
+	if ((mkdir(dir, 0755) < 0) && (errno != EEXIST)) {
+		perror(dir);
+		return false;
+	}
+	for (int d = 0; d < DIRS; d++) {
+		snprintf(dir, sizeof(dir), "%s/stat_bench/d%d", root, d);
+		if ((mkdir(dir, 0755) < 0) && (errno != EEXIST)) {
+			perror(dir);
+			return false;
+		}
+		for (int f = 0; f < FILES; f++) {
+			char *path = paths[d * FILES + f];
+			snprintf(path, sizeof(paths[0]), "%s/stat_bench/d%d/f%d", root, d, f);
+			int fd = open(path, O_CREAT | O_WRONLY, 0644);
+			if (fd < 0) {
+				perror(path);
+				return false;
+			}
+			close(fd);
+		}
+	}
+	return true;
+}
+
+// Stat random files until told to stop; returns the number of calls
+static void *worker(void *arg)
+{
+	unsigned seed = (unsigned)(size_t)arg;
+	unsigned long *count = malloc(sizeof(unsigned long));
+	*count = 0;
+	struct stat st;
+	while (!stop) {
+		if (stat(paths[rand_r(&seed) % (DIRS * FILES)], &st) < 0) {
+			perror("stat");
+			break;
+		}
+		(*count)++;
+	}
+	return count;
+}
+
+// Run nthreads threads for secs seconds; returns stat() calls per second
+static double run(int nthreads, double secs)
+{
+	pthread_t threads[nthreads];
+	stop = false;
+	double start = now();
+	for (int t = 0; t < nthreads; t++) {
+		pthread_create(&threads[t], NULL, worker, (void *)(size_t)(t + 1));
+	}
+	usleep(secs * 1e6);
+	stop = true;
+
+	unsigned long total = 0;
+	for (int t = 0; t < nthreads; t++) {
+		unsigned long *count;
+		pthread_join(threads[t], (void **)&count);
+		total += *count;
+		free(count);
+	}
+	return total / (now() - start);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s directory [max threads] [seconds per run]\n", argv[0]);
+		return 1;
+	}
+	int max_threads = (argc > 2) ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+	double secs = (argc > 3) ? atof(argv[3]) : 2;
+	if (!make_tree(argv[1])) return 1;
+
+	// Warm up the caches
+	run(1, 0.2);
+
+	double base = 0;
+	printf("threads   stat/s   speedup\n");
+	for (int n = 1; n <= max_threads; n *= 2) {
+		double rate = run(n, secs);
+		if (n == 1) base = rate;
+		printf("%7d %10.0f %7.2fx\n", n, rate, rate / base);
+	}
+	return 0;
+}
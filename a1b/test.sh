@@ -1,35 +1,92 @@
-cd /tmp/mnt
-ls -al 
-mkdir new
-stat new 
-ls -al 
-cd new
-mkdir new1
-ls -al 
-cd ..
-mkdir hello
-ls -al
-touch ./new
-touch ./new/new1
-cd ./new
-touch ../hello
-stat ./new1
-stat ../hello
-stat ../new
-cd ..
-echo "hello,world" > newfile
-cat newfile
-echo "the next world" >> newfile
-cat newfile
-unlink newfile 
-ls -al
-rmdir hello
-ls -al
-mkdir moveto
-mkdir movefrom
-mv movefrom moveto
-ls -al
-cd moveto
-ls -al
-cd ..
-echo "hello,world" > newfile
\ No newline at end of file
+#!/bin/sh
+# Run the a1fs tests on images formatted with each set of optional features.
+#
+# a1fs_test calls the file system operations directly on an image. If FUSE is
+# available, each image is then also mounted, the commands in demo() are run
+# on it, and it is mounted again to check that their result was kept.
+#
+# Usage: ./test.sh  (IMG and MNT override the image and mount point paths)
+
+set -e
+cd "$(dirname "$0")"
+IMG=${IMG:-/tmp/a1fs_test.img}
+MNT=${MNT:-/tmp/a1fs_test_mnt}
+
+make all a1fs_test
+
+# Runs in a subshell, so that it can change the current directory
+demo()
+(
+	cd "$MNT"
+	ls -al
+	mkdir new
+	stat new
+	ls -al
+	cd new
+	mkdir new1
+	ls -al
+	cd ..
+	mkdir hello
+	ls -al
+	touch ./new
+	touch ./new/new1
+	cd ./new
+	touch ../hello
+	stat ./new1
+	stat ../hello
+	stat ../new
+	cd ..
+	echo "hello,world" > newfile
+	cat newfile
+	echo "the next world" >> newfile
+	cat newfile
+	unlink newfile
+	ls -al
+	rmdir hello
+	ls -al
+	mkdir moveto
+	mkdir movefrom
+	mv movefrom moveto
+	ls -al
+	cd moveto
+	ls -al
+	cd ..
+	echo "hello,world" > newfile
+)
+
+mount_test()
+{
+	mkdir -p "$MNT"
+	./a1fs "$IMG" "$MNT"
+	demo
+	fusermount -u "$MNT"
+	./a1fs "$IMG" "$MNT"
+	[ "$(cat "$MNT/newfile")" = "hello,world" ]
+	[ -d "$MNT/moveto/movefrom" ]
+	fusermount -u "$MNT"
+}
+
+# mkfs.a1fs options of the images, one set per line
+while read -r options; do
+	echo "== mkfs.a1fs $options"
+	rm -f "$IMG"
+	truncate -s 64M "$IMG"
+	./mkfs.a1fs $options "$IMG"
+	./a1fs_test "$IMG"
+	if [ -c /dev/fuse ] && command -v fusermount > /dev/null; then
+		mount_test
+	fi
+done <<EOF
+-i 4096
+-i 4096 -g 4096
+-i 4096 -O dir_index
+-i 4096 -O dir_index,compact_dirent
+-i 4096 -O inline_extents,inline_data
+-i 4096 -I 256 -O inline_data
+-i 4096 -O tail_packing
+-i 4096 -O dir_index,compact_dirent,inline_extents,inline_data,tail_packing
+-i 4096 -I 256 -g 4096 -O dir_index,compact_dirent,inline_extents,inline_data,tail_packing
+EOF
+
+rm -f "$IMG"
+echo "All tests passed"